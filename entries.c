@@ -0,0 +1,596 @@
+#include <stdint.h>
+#include <stdatomic.h>
+#include <ctype.h>
+
+/* One directory entry as the drawing and carry code sees it. Listings are
+ * kept in an EntryTable, this is only materialized for single rows. */
+typedef struct
+{
+        char name[256];
+        bool is_dir, is_exec, meta_pending;
+        bool sized; /* size of a directory is the total of its subtree */
+        off_t size;
+        char git_status[3];
+} FileEntry;
+
+#define ENTRY_DIR 0x01
+#define ENTRY_EXEC 0x02
+#define ENTRY_META_PENDING 0x04
+#define ENTRY_META_QUEUED 0x08
+#define ENTRY_GONE 0x10
+#define ENTRY_META_STALE 0x20 /* metadata shown but known to be outdated */
+
+/* Columnar directory listing. Names are packed NUL-terminated into one arena
+ * and rows are only ever appended, display order is a separate permutation so
+ * sorting moves 4-byte indices instead of whole entries. */
+typedef struct
+{
+        char *names;
+        size_t names_len, names_cap;
+        uint32_t *name_off;
+        uint16_t *name_len;
+        uint8_t *flags;
+        off_t *size;
+        int64_t *mtime;
+        char (*git)[2];
+        int count, cap;
+} EntryTable;
+
+void entries_free(EntryTable *t)
+{
+        free(t->names);
+        free(t->name_off);
+        free(t->name_len);
+        free(t->flags);
+        free(t->size);
+        free(t->mtime);
+        free(t->git);
+        memset(t, 0, sizeof(*t));
+}
+
+void entries_clear(EntryTable *t)
+{
+        t->count = 0;
+        t->names_len = 0;
+}
+
+/* Heap bytes held by the table, for memory accounting. */
+size_t entries_bytes(const EntryTable *t)
+{
+        size_t row = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) + sizeof(off_t) + sizeof(int64_t) + sizeof(t->git[0]);
+        return t->names_cap + (size_t)t->cap * row;
+}
+
+static bool entries_grow(void **p, int cap, size_t elem)
+{
+        void *grown = realloc(*p, cap * elem) orelse return false;
+        *p = grown;
+        return true;
+}
+
+static bool entries_reserve(EntryTable *t, int rows, size_t name_bytes)
+{
+        if (rows > t->cap)
+        {
+                int cap = t->cap ? t->cap : 256;
+                while (cap < rows)
+                        cap *= 2;
+                (entries_grow((void **)&t->name_off, cap, sizeof(uint32_t)) &&
+                 entries_grow((void **)&t->name_len, cap, sizeof(uint16_t)) &&
+                 entries_grow((void **)&t->flags, cap, sizeof(uint8_t)) &&
+                 entries_grow((void **)&t->size, cap, sizeof(off_t)) &&
+                 entries_grow((void **)&t->mtime, cap, sizeof(int64_t)) &&
+                 entries_grow((void **)&t->git, cap, sizeof(t->git[0]))) orelse return false;
+                t->cap = cap;
+        }
+        if (name_bytes > t->names_cap)
+        {
+                size_t cap = t->names_cap ? t->names_cap : 4096;
+                while (cap < name_bytes)
+                        cap *= 2;
+                (cap <= UINT32_MAX) orelse return false;
+                char *grown = realloc(t->names, cap) orelse return false;
+                t->names = grown;
+                t->names_cap = cap;
+        }
+        return true;
+}
+
+/* Appends a row and returns its index, -1 when out of memory. */
+int entries_add(EntryTable *t, const char *name, int len, uint8_t flags, off_t size, int64_t mtime)
+{
+        if (len > 255)
+                len = 255;
+        (entries_reserve(t, t->count + 1, t->names_len + len + 1)) orelse return -1;
+
+        int row = t->count++;
+        t->name_off[row] = (uint32_t)t->names_len;
+        t->name_len[row] = (uint16_t)len;
+        memcpy(t->names + t->names_len, name, len);
+        t->names[t->names_len + len] = '\0';
+        t->names_len += len + 1;
+        t->flags[row] = flags;
+        t->size[row] = size;
+        t->mtime[row] = mtime;
+        t->git[row][0] = t->git[row][1] = '\0';
+        return row;
+}
+
+/* Appends all rows of src, their indices in dst start at the old dst->count. */
+bool entries_append(EntryTable *dst, const EntryTable *src)
+{
+        (entries_reserve(dst, dst->count + src->count, dst->names_len + src->names_len)) orelse return false;
+
+        uint32_t base = (uint32_t)dst->names_len;
+        memcpy(dst->names + dst->names_len, src->names, src->names_len);
+        for (int i = 0; i < src->count; i++)
+                dst->name_off[dst->count + i] = src->name_off[i] + base;
+        memcpy(dst->name_len + dst->count, src->name_len, src->count * sizeof(uint16_t));
+        memcpy(dst->flags + dst->count, src->flags, src->count * sizeof(uint8_t));
+        memcpy(dst->size + dst->count, src->size, src->count * sizeof(off_t));
+        memcpy(dst->mtime + dst->count, src->mtime, src->count * sizeof(int64_t));
+        memcpy(dst->git + dst->count, src->git, src->count * sizeof(dst->git[0]));
+        dst->names_len += src->names_len;
+        dst->count += src->count;
+        return true;
+}
+
+/* Drops rows carrying ENTRY_GONE, packing the name arena down with them. If
+ * remap is given it receives the new index of every old row. */
+void entries_compact(EntryTable *t, uint32_t *remap)
+{
+        int kept = 0;
+        size_t names_len = 0;
+        for (int i = 0; i < t->count; i++)
+        {
+                if (remap)
+                        remap[i] = (t->flags[i] & ENTRY_GONE) ? UINT32_MAX : (uint32_t)kept;
+                if (t->flags[i] & ENTRY_GONE)
+                        continue;
+                int len = t->name_len[i];
+                memmove(t->names + names_len, t->names + t->name_off[i], len + 1);
+                t->name_off[kept] = (uint32_t)names_len;
+                t->name_len[kept] = (uint16_t)len;
+                t->flags[kept] = t->flags[i];
+                t->size[kept] = t->size[i];
+                t->mtime[kept] = t->mtime[i];
+                memcpy(t->git[kept], t->git[i], sizeof(t->git[0]));
+                names_len += len + 1;
+                kept++;
+        }
+        t->count = kept;
+        t->names_len = names_len;
+}
+
+/* A table several owners read at once, freed with the last reference. Whoever
+ * wants to write to it first makes it private with shared_entries_own(). */
+typedef struct
+{
+        atomic_int refs;
+        EntryTable t;
+} SharedEntries;
+
+SharedEntries *shared_entries_new(void)
+{
+        SharedEntries *s = calloc(1, sizeof(SharedEntries)) orelse return NULL;
+        atomic_init(&s->refs, 1);
+        return s;
+}
+
+SharedEntries *shared_entries_ref(SharedEntries *s)
+{
+        atomic_fetch_add(&s->refs, 1);
+        return s;
+}
+
+void shared_entries_release(SharedEntries *s)
+{
+        (s && atomic_fetch_sub(&s->refs, 1) == 1) orelse return;
+        entries_free(&s->t);
+        free(s);
+}
+
+/* Swaps *s for a copy of itself while anyone else still holds it, row indices
+ * stay the same. Fails only when out of memory. */
+bool shared_entries_own(SharedEntries **s)
+{
+        (atomic_load(&(*s)->refs) > 1) orelse return true;
+        SharedEntries *copy = shared_entries_new() orelse return false;
+        if (!entries_append(&copy->t, &(*s)->t))
+        {
+                shared_entries_release(copy);
+                return false;
+        }
+        shared_entries_release(*s);
+        *s = copy;
+        return true;
+}
+
+/* Flat form of a table for files that are mapped back in later: a header and
+ * then the columns one after another, each padded to 8 bytes. */
+typedef struct
+{
+        uint32_t rows, reserved;
+        uint64_t names_len;
+} EntriesFlat;
+
+#define FLAT_PAD(n) (((size_t)(n) + 7) & ~(size_t)7)
+
+size_t entries_flat_size(const EntryTable *t)
+{
+        size_t n = t->count;
+        return sizeof(EntriesFlat) + 2 * FLAT_PAD(n * 8) + FLAT_PAD(n * 4) + FLAT_PAD(n * 2) + FLAT_PAD(n) + FLAT_PAD(n * 2) + FLAT_PAD(t->names_len);
+}
+
+static void flat_put(FILE *f, const void *p, size_t n)
+{
+        static const char zero[8];
+        if (n)
+                fwrite(p, n, 1, f);
+        fwrite(zero, FLAT_PAD(n) - n, 1, f);
+}
+
+/* Writes exactly entries_flat_size(t) bytes. Sizes go out as 64 bits
+ * whatever off_t is here. */
+void entries_write_flat(const EntryTable *t, FILE *f)
+{
+        EntriesFlat h = {(uint32_t)t->count, 0, t->names_len};
+        fwrite(&h, sizeof(h), 1, f);
+        for (int i = 0; i < t->count; i++)
+        {
+                int64_t size = t->size[i];
+                fwrite(&size, sizeof(size), 1, f);
+        }
+        flat_put(f, t->mtime, t->count * sizeof(int64_t));
+        flat_put(f, t->name_off, t->count * sizeof(uint32_t));
+        flat_put(f, t->name_len, t->count * sizeof(uint16_t));
+        flat_put(f, t->flags, t->count);
+        flat_put(f, t->git, t->count * sizeof(t->git[0]));
+        flat_put(f, t->names, t->names_len);
+}
+
+/* Reads a flat table of at most size bytes into the empty table t, checking
+ * every name so a damaged file cannot point outside of it or hand a name
+ * entries_add() would not have taken to entries_get(). Returns the bytes
+ * used, 0 on failure. */
+size_t entries_read_flat(EntryTable *t, const void *data, size_t size)
+{
+        raw EntriesFlat h;
+        (size >= sizeof(h)) orelse return 0;
+        memcpy(&h, data, sizeof(h));
+        (h.rows < INT32_MAX / 8 && h.names_len < UINT32_MAX) orelse return 0;
+        EntryTable probe = {.count = (int)h.rows, .names_len = h.names_len};
+        size_t used = entries_flat_size(&probe);
+        (used <= size && entries_reserve(t, h.rows, h.names_len)) orelse return 0;
+
+        size_t n = h.rows;
+        const uint8_t *p = (const uint8_t *)data + sizeof(h);
+        const int64_t *sizes = (const int64_t *)p;
+        p += FLAT_PAD(n * 8);
+        memcpy(t->mtime, p, n * 8);
+        p += FLAT_PAD(n * 8);
+        memcpy(t->name_off, p, n * 4);
+        p += FLAT_PAD(n * 4);
+        memcpy(t->name_len, p, n * 2);
+        p += FLAT_PAD(n * 2);
+        memcpy(t->flags, p, n);
+        p += FLAT_PAD(n);
+        memcpy(t->git, p, n * 2);
+        p += FLAT_PAD(n * 2);
+        memcpy(t->names, p, h.names_len);
+
+        for (size_t i = 0; i < n; i++)
+        {
+                t->size[i] = sizes[i];
+                t->flags[i] &= ~ENTRY_META_QUEUED;
+                size_t off = t->name_off[i], len = t->name_len[i];
+                (len <= 255 && off + len < h.names_len && t->names[off + len] == '\0') orelse return 0;
+                (!memchr(t->names + off, '\0', len)) orelse return 0;
+        }
+        t->count = (int)n;
+        t->names_len = h.names_len;
+        return used;
+}
+
+static inline const char *entry_name(const EntryTable *t, int row)
+{
+        return t->names + t->name_off[row];
+}
+
+void entries_get(const EntryTable *t, int row, FileEntry *out)
+{
+        memcpy(out->name, entry_name(t, row), t->name_len[row] + 1);
+        out->is_dir = t->flags[row] & ENTRY_DIR;
+        out->is_exec = t->flags[row] & ENTRY_EXEC;
+        out->meta_pending = t->flags[row] & ENTRY_META_PENDING;
+        out->size = t->size[row];
+        out->sized = false;
+        out->git_status[0] = t->git[row][0];
+        out->git_status[1] = t->git[row][1];
+        out->git_status[2] = '\0';
+}
+
+
+/* Sort engine. Every row gets a compact key once: its group (".." first, then
+ * directories, then files) and 8 order-preserving bytes for the active mode.
+ * Most comparisons are settled on those, only ties fall back to the full
+ * comparison. */
+typedef enum
+{
+        SORT_NAME,
+        SORT_NATURAL,
+        SORT_SIZE,
+        SORT_MTIME,
+        SORT_EXT,
+        SORT_COUNT
+} SortMode;
+
+const char *sort_mode_names[SORT_COUNT] = {"name", "natural", "size", "modified", "type"};
+
+/* Modes that need a stat of every entry, d_type alone is not enough. */
+bool sort_needs_meta(SortMode mode)
+{
+        return mode == SORT_SIZE || mode == SORT_MTIME;
+}
+
+typedef struct
+{
+        uint64_t key;
+        uint32_t row;
+        uint32_t group;
+} SortKey;
+
+#define SORT_PARALLEL_MIN 65536
+
+static int entry_group(const EntryTable *t, uint32_t row)
+{
+        if (t->name_len[row] == 2 && !memcmp(entry_name(t, row), "..", 2))
+                return 0;
+        return (t->flags[row] & ENTRY_DIR) ? 1 : 2;
+}
+
+static const char *entry_ext(const EntryTable *t, uint32_t row)
+{
+        const char *name = entry_name(t, row);
+        const char *dot = strrchr(name, '.');
+        return (dot && dot != name) ? dot + 1 : "";
+}
+
+static int natural_cmp(const char *a, const char *b)
+{
+        while (*a && *b)
+        {
+                if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b))
+                {
+                        while (*a == '0')
+                                a++;
+                        while (*b == '0')
+                                b++;
+                        int la = 0, lb = 0;
+                        while (isdigit((unsigned char)a[la]))
+                                la++;
+                        while (isdigit((unsigned char)b[lb]))
+                                lb++;
+                        if (la != lb)
+                                return la - lb;
+                        int c = memcmp(a, b, la);
+                        if (c)
+                                return c;
+                        a += la;
+                        b += lb;
+                        continue;
+                }
+                int ca = tolower((unsigned char)*a), cb = tolower((unsigned char)*b);
+                if (ca != cb)
+                        return ca - cb;
+                a++;
+                b++;
+        }
+        return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int case_cmp(const char *a, const char *b)
+{
+        for (;; a++, b++)
+        {
+                int ca = tolower((unsigned char)*a), cb = tolower((unsigned char)*b);
+                if (ca != cb || !ca)
+                        return ca - cb;
+        }
+}
+
+/* Full comparison for mode, also used to merge streamed batches. Size and
+ * mtime sort largest/newest first. */
+int entries_cmp_mode(const EntryTable *t, SortMode mode, uint32_t a, uint32_t b)
+{
+        int ga = entry_group(t, a), gb = entry_group(t, b);
+        if (ga != gb)
+                return ga - gb;
+
+        const char *na = entry_name(t, a), *nb = entry_name(t, b);
+        int c = 0;
+        switch (mode)
+        {
+        case SORT_NATURAL:
+                c = natural_cmp(na, nb);
+                break;
+        case SORT_SIZE:
+                c = (t->size[a] < t->size[b]) - (t->size[a] > t->size[b]);
+                break;
+        case SORT_MTIME:
+                c = (t->mtime[a] < t->mtime[b]) - (t->mtime[a] > t->mtime[b]);
+                break;
+        case SORT_EXT:
+                c = case_cmp(entry_ext(t, a), entry_ext(t, b));
+                break;
+        default:
+                break;
+        }
+        return c ? c : strcmp(na, nb);
+}
+
+static uint64_t sort_prefix(const char *s, bool fold, bool natural)
+{
+        uint64_t k = 0;
+        int i = 0;
+        for (; i < 8 && s[i]; i++)
+        {
+                unsigned char ch = (unsigned char)s[i];
+                /* A digit run compares numerically, so the key stops at it with
+                 * a marker that still orders like any digit would. */
+                if (natural && isdigit(ch))
+                {
+                        k = (k << 8) | '0';
+                        i++;
+                        break;
+                }
+                k = (k << 8) | (fold ? (unsigned char)tolower(ch) : ch);
+        }
+        return i ? k << (8 * (8 - i)) : 0;
+}
+
+static void sort_make_keys(const EntryTable *t, SortMode mode, const uint32_t *rows, SortKey *keys, int n)
+{
+        for (int i = 0; i < n; i++)
+        {
+                uint32_t row = rows[i];
+                SortKey *k = &keys[i];
+                k->row = row;
+                k->group = entry_group(t, row);
+                switch (mode)
+                {
+                case SORT_NATURAL:
+                        k->key = sort_prefix(entry_name(t, row), true, true);
+                        break;
+                case SORT_SIZE:
+                        k->key = ~((uint64_t)t->size[row] ^ (1ULL << 63));
+                        break;
+                case SORT_MTIME:
+                        k->key = ~((uint64_t)t->mtime[row] ^ (1ULL << 63));
+                        break;
+                case SORT_EXT:
+                        k->key = sort_prefix(entry_ext(t, row), true, false);
+                        break;
+                default:
+                        k->key = sort_prefix(entry_name(t, row), false, false);
+                        break;
+                }
+        }
+}
+
+static inline int sort_key_cmp(const EntryTable *t, SortMode mode, const SortKey *a, const SortKey *b)
+{
+        if (a->group != b->group)
+                return (int)a->group - (int)b->group;
+        if (a->key != b->key)
+                return a->key < b->key ? -1 : 1;
+        return entries_cmp_mode(t, mode, a->row, b->row);
+}
+
+static void sort_merge(const EntryTable *t, SortMode mode, const SortKey *a, int na, const SortKey *b, int nb, SortKey *out)
+{
+        int i = 0, j = 0, k = 0;
+        while (i < na && j < nb)
+                out[k++] = sort_key_cmp(t, mode, &b[j], &a[i]) < 0 ? b[j++] : a[i++];
+        memcpy(out + k, a + i, (na - i) * sizeof(SortKey));
+        memcpy(out + k + (na - i), b + j, (nb - j) * sizeof(SortKey));
+}
+
+/* Sorts keys[0..n) using tmp as scratch, the result ends up in keys. */
+static void sort_range(const EntryTable *t, SortMode mode, SortKey *keys, SortKey *tmp, int n)
+{
+        if (n < 16)
+        {
+                for (int i = 1; i < n; i++)
+                {
+                        SortKey v = keys[i];
+                        int j = i - 1;
+                        for (; j >= 0 && sort_key_cmp(t, mode, &keys[j], &v) > 0; j--)
+                                keys[j + 1] = keys[j];
+                        keys[j + 1] = v;
+                }
+                return;
+        }
+
+        int half = n / 2;
+        sort_range(t, mode, keys, tmp, half);
+        sort_range(t, mode, keys + half, tmp + half, n - half);
+        if (sort_key_cmp(t, mode, &keys[half - 1], &keys[half]) <= 0)
+                return;
+        sort_merge(t, mode, keys, half, keys + half, n - half, tmp);
+        memcpy(keys, tmp, n * sizeof(SortKey));
+}
+
+typedef struct
+{
+        const EntryTable *t;
+        SortMode mode;
+        SortKey *keys, *tmp;
+        int lo, mid, hi;
+} SortTask;
+
+static void sort_task_sort(void *arg)
+{
+        SortTask *st = arg;
+        sort_range(st->t, st->mode, st->keys + st->lo, st->tmp + st->lo, st->hi - st->lo);
+}
+
+static void sort_task_merge(void *arg)
+{
+        SortTask *st = arg;
+        sort_merge(st->t, st->mode, st->keys + st->lo, st->mid - st->lo, st->keys + st->mid, st->hi - st->mid, st->tmp + st->lo);
+        memcpy(st->keys + st->lo, st->tmp + st->lo, (st->hi - st->lo) * sizeof(SortKey));
+}
+
+/* Large inputs are cut into one run per worker, the runs are sorted and then
+ * merged pairwise, each level of merges running in parallel. */
+static void sort_parallel(const EntryTable *t, SortMode mode, SortKey *keys, SortKey *tmp, int n)
+{
+        int runs = fs_jobs_count();
+        if (runs > 16)
+                runs = 16;
+        if (n < SORT_PARALLEL_MIN || runs < 2)
+        {
+                sort_range(t, mode, keys, tmp, n);
+                return;
+        }
+
+        int bounds[17];
+        for (int r = 0; r <= runs; r++)
+                bounds[r] = (int)((long long)n * r / runs);
+
+        SortTask tasks[16];
+        FsJobGroup g;
+        fs_group_init(&g);
+        for (int r = 0; r < runs; r++)
+        {
+                tasks[r] = (SortTask){t, mode, keys, tmp, bounds[r], 0, bounds[r + 1]};
+                fs_group_submit(&g, sort_task_sort, &tasks[r]);
+        }
+        fs_group_wait(&g);
+
+        for (int width = 1; width < runs; width *= 2)
+        {
+                fs_group_init(&g);
+                int m = 0;
+                for (int r = 0; r + width < runs; r += 2 * width)
+                {
+                        int hi = r + 2 * width < runs ? r + 2 * width : runs;
+                        tasks[m] = (SortTask){t, mode, keys, tmp, bounds[r], bounds[r + width], bounds[hi]};
+                        fs_group_submit(&g, sort_task_merge, &tasks[m++]);
+                }
+                fs_group_wait(&g);
+        }
+}
+
+/* Sorts a list of row indices in place for mode. */
+void entries_sort(const EntryTable *t, SortMode mode, uint32_t *rows, int n)
+{
+        (n > 1) orelse return;
+        SortKey *keys = malloc(2 * (size_t)n * sizeof(SortKey)) orelse return;
+        sort_make_keys(t, mode, rows, keys, n);
+        sort_parallel(t, mode, keys, keys + n, n);
+        for (int i = 0; i < n; i++)
+                rows[i] = keys[i].row;
+        free(keys);
+}
@@ -1,8 +1,14 @@
 #include "terminal.c"
-#include <dirent.h>
-#include <sys/stat.h>
-#include <limits.h>
+#include "fs.c"
+#include "memfs.c"
+#include "entries.c"
 #include <ctype.h>
+#include <sys/file.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 Color clr_bg = {-1, -1, -1}, clr_bar = {170, 170, 170}, clr_text = {255, 255, 255}, clr_folder = {255, 255, 85}, clr_hover = {170, 170, 170}, clr_sel_bg = {40, 70, 120};
 
@@ -25,14 +31,6 @@ typedef struct
         AppState *app;
 } MoveAction;
 
-typedef struct
-{
-        char name[256];
-        bool is_dir, is_exec;
-        off_t size;
-        char git_status[3];
-} FileEntry;
-
 typedef struct
 {
         FileEntry entry;
@@ -52,11 +50,426 @@ typedef struct
         AppState *app;
 } CopyAction;
 
+typedef struct
+{
+        char name[256];
+        char status[3];
+} GitStatusEntry;
+
+#define DIR_LOAD_CHUNK 512
+#define REFRESH_INTERVAL_MS 250
+#define POLL_MIN_MS 250
+#define POLL_MAX_MS 4000
+#define STALE_MAX 64
+
+/* How long the UI thread waits on a filesystem call before it gives up on it
+ * and carries on, a poll only briefly since it comes back anyway. */
+#define UI_FS_DEADLINE_MS 150
+
+/* Type-ahead: keys typed within this long of each other make one prefix. */
+#define TYPE_AHEAD_MS 1000
+#define POLL_DEADLINE_MS 20
+
+/* What a directory looked like when its listing was taken. */
+typedef struct
+{
+        long long mtime, mtime_ns, ctime, ctime_ns;
+} DirStamp;
+
+/* New metadata for a row that survived a refresh. */
+typedef struct
+{
+        uint32_t row;
+        uint8_t flags;
+        off_t size;
+        int64_t mtime;
+} DirChange;
+
+/* A directory listing in progress on a worker. The UI thread pulls batches out
+ * with dir_model_pump_load() until done is set; both sides hold a reference. */
+typedef struct
+{
+        pthread_mutex_t lock;
+        atomic_int refs;
+        atomic_bool cancel;
+        int dfd;
+        bool refresh, swapped, need_meta;
+        char path[PATH_MAX];
+
+        /* The job opens path itself when dfd is -1 and stamps what it lists,
+         * failed is set if it could not. Prefetches give up past limit rows. */
+        int limit;
+        DirStamp stamp;
+
+        EntryTable batch;
+        bool listed, done, failed;
+
+        /* A refresh diffs the new scan against the listing as it was when it
+         * started, batch then only holds the added rows. The listing is shared
+         * with the UI thread rather than copied, which copies it only if it
+         * writes to it before the diff is done. */
+        SharedEntries *prev;
+        unsigned gen;
+        bool diffed;
+        uint32_t *removed;
+        int removed_count;
+        DirChange *changed;
+        int changed_count;
+
+        char git_branch[64];
+        GitStatusEntry *git;
+        int git_count;
+
+        /* A content search for grep, leaving out hidden and ignored trees
+         * when grep_skip is set. */
+        char grep[256];
+        bool grep_skip;
+} DirLoad;
+
+/* size/is_exec lookups for rows that came out of the scan with only d_type. */
+typedef struct
+{
+        atomic_int refs;
+        atomic_bool cancel, done;
+        char path[PATH_MAX];
+        unsigned gen;
+        int count;
+        struct
+        {
+                char name[256];
+                int row;
+                bool is_exec, ok;
+                off_t size;
+                int64_t mtime;
+        } items[];
+} MetaLoad;
+
+#define META_LOAD_MAX 256
+
+/* A directory right inside a walked one, totalled on its own for the
+ * treemap's second level. */
+typedef struct
+{
+        char name[256];
+        atomic_llong bytes;
+        int64_t mtime;
+} DirSizeSub;
+
+#define DIR_SIZE_SUB_BLOCK 64
+
+/* Subs only ever get added, by the one walker reading the directory. Blocks
+ * are put in front and count is bumped once a sub is filled in, so the UI
+ * thread can read along. */
+typedef struct DirSizeSubBlock
+{
+        struct DirSizeSubBlock *next;
+        atomic_int count;
+        DirSizeSub subs[DIR_SIZE_SUB_BLOCK];
+} DirSizeSubBlock;
+
+/* Recursive size of one directory row, streamed in while it is walked. */
+typedef struct
+{
+        char name[256];
+        atomic_llong bytes;
+        atomic_int pending; /* directories of the subtree not read yet */
+        atomic_bool done;
+        bool cached;
+        int64_t mtime;
+        _Atomic(DirSizeSubBlock *) subs;
+} DirSizeTarget;
+
+typedef struct
+{
+        char *path;
+        int target;
+        DirSizeSub *sub;
+        int depth; /* 0 for the target itself */
+} DirSizeItem;
+
+typedef struct
+{
+        dev_t dev;
+        ino_t ino;
+} DirSizeInode;
+
+/* Directories waiting to be read. The walker that owns it pushes and pops at
+ * the top, so it goes depth first, the others steal from the bottom where the
+ * larger subtrees are. */
+typedef struct
+{
+        pthread_mutex_t lock;
+        DirSizeItem *items;
+        int lo, hi, cap;
+} DirSizeDeque;
+
+/* Subtree sizes of every directory row of a listing, walked on the pool.
+ * Hard links and directories reached twice count once by dev/ino. Rows added
+ * to the listing meanwhile get a walk of their own in front of the running
+ * one, older points to that. */
+typedef struct DirSizeWalk
+{
+        struct DirSizeWalk *older;
+        atomic_int refs, active, next_deque;
+        atomic_bool cancel;
+        atomic_llong notified;
+        char path[PATH_MAX];
+        unsigned gen;
+        int walkers;
+        DirSizeDeque *deques;
+
+        pthread_mutex_t seen_lock;
+        DirSizeInode *seen;
+        size_t seen_count, seen_cap;
+
+        int *by_row; /* target of each row, -1 for files and rows of older walks */
+        int rows, remaining;
+        int count;
+        DirSizeTarget targets[];
+} DirSizeWalk;
+
+#define DIR_SIZE_SLICE_MS 10
+#define DIR_SIZE_NOTIFY_MS 50
+#define DIR_SIZE_CACHE_SLOTS 4096
+
+/* Totals of directories walked to the end, shared by all tabs. A total is
+ * dropped by dir_size_invalidate() once a change is seen in the directory or
+ * below it, and not reused if the directory's mtime moved meanwhile. */
+typedef struct
+{
+        char *path;
+        uint32_t hash;
+        int64_t mtime;
+        off_t bytes;
+        DirSizeSub *kids;
+        int kid_count;
+        unsigned long long used;
+} CachedDirSize;
+
+CachedDirSize dir_size_cache[DIR_SIZE_CACHE_SLOTS];
+unsigned long long dir_size_tick = 0;
+
+/* Toggled with Ctrl+U, walks the directories of every listing on screen. */
+bool dir_sizes_on = false;
+
+#define FIND_BLOCK 4096
+#define FIND_MAX_BLOCKS 4096
+#define FIND_ARENA_BYTES (1 << 20)
+#define FIND_TOP 1000
+#define FIND_RANK_MS 4
+
+/* A path found below the root of a find, relative to it. */
+typedef struct
+{
+        const char *path;
+        uint16_t len, name; /* name is where the last component starts */
+        bool is_dir;
+} FindEntry;
+
+/* What Ctrl+G looks for: a literal, tied to the start of a line with a
+ * leading ^ and to its end with a trailing $. All lowercase matches either
+ * case. first and last hold both cases of the needle's end bytes. */
+typedef struct
+{
+        char needle[256];
+        int len;
+        bool fold, at_start, at_end;
+        unsigned char first[2], last[2];
+} GrepPattern;
+
+typedef struct FindArena
+{
+        struct FindArena *next;
+        size_t used;
+        char data[FIND_ARENA_BYTES];
+} FindArena;
+
+/* Everything below a directory, walked on the pool by the same work stealing
+ * walkers as directory sizes. Entries go into blocks that never move and
+ * count is bumped once they are filled in, so the UI thread reads along
+ * without the lock. */
+typedef struct
+{
+        atomic_int refs, active, next_deque, pending, count;
+        atomic_bool cancel, done, started;
+        atomic_llong notified;
+        char root[PATH_MAX];
+        bool skip; /* leaves out hidden names and what git ignores */
+        char **ignored;
+        int ignored_count;
+        int walkers;
+        DirSizeDeque *deques;
+
+        /* A content search hands the files that hold pat to load instead
+         * of keeping what it finds, and finishes load once it is through. */
+        DirLoad *load;
+        GrepPattern pat;
+
+        pthread_mutex_t lock;
+        FindArena *arena;
+        FindEntry *blocks[FIND_MAX_BLOCKS];
+} FindWalk;
+
+/* What one walker reads a directory into, and its files for a search. */
+typedef struct
+{
+        EntryTable chunk, found;
+        char *buf;
+        size_t cap;
+} FindScratch;
+
+typedef struct
+{
+        uint32_t entry;
+        int score, len;
+} FindHit;
+
+/* Ctrl+F in a tab. Entries are scored against the query on the UI thread a
+ * few milliseconds per frame as they stream in. A query that only got longer
+ * just filters the matches of the one before it. The best FIND_TOP are kept
+ * in a heap, worst on top, and sorted into shown when they change. */
+typedef struct
+{
+        FindWalk *walk;
+        char query[256], ranked[256], needle[256];
+        bool fold;
+        uint32_t *matches;
+        int match_count, match_cap, scanned;
+        int refilter, refilter_end, kept;
+        FindHit heap[FIND_TOP], shown[FIND_TOP];
+        int heap_count, shown_count;
+        bool heap_dirty;
+        UIListState list;
+} Finder;
+
+/* Ctrl+O in a tab: the directories of the frecency table, copied out when it
+ * opens and ranked in memory on every change of the query. */
+typedef struct
+{
+        char *path;
+        uint16_t len, name;
+        int rank;
+        double frecency;
+} RecentDir;
+
+typedef struct
+{
+        RecentDir *dirs;
+        int count;
+        RecentDir **shown;
+        int shown_count;
+        char query[256], ranked[256], needle[256];
+        bool fold, fresh;
+        UIListState list;
+} RecentPrompt;
+
+/* Whether new finds leave out hidden and ignored trees, Tab in the finder. */
+bool find_skip = false;
+
+/* Display order of a listing for a sort mode that is not active right now,
+ * kept so switching back does not need a sort. */
+typedef struct
+{
+        uint32_t *order;
+        int count;
+        unsigned gen;
+} SortCache;
+
+#define LISTING_CACHE_SLOTS 32
+#define LISTING_CACHE_BYTES (64 << 20)
+
+/* Listings of directories that were navigated away from, shared by all tabs.
+ * An entry is only reused while the directory's stamp still matches, least
+ * recently used ones go first once the slots or the byte budget run out. */
+typedef struct
+{
+        char path[PATH_MAX];
+        DirStamp stamp;
+        EntryTable table;
+        uint32_t *order;
+        int count;
+        SortMode sort;
+        uint32_t cursor_row;
+        char git_branch[64];
+        size_t bytes;
+        unsigned long long used;
+} CachedListing;
+
+CachedListing listing_cache[LISTING_CACHE_SLOTS];
+size_t listing_cache_bytes = 0;
+unsigned long long listing_cache_tick = 0;
+
+#define PREFETCH_MAX 2
+#define PREFETCH_MAX_ENTRIES 50000
+#define PREFETCH_DELAY_MS 150
+
+/* A directory next to the current one that is listed ahead of time: slot 0
+ * is the directory under the cursor, slot 1 the parent. */
+typedef struct
+{
+        char path[PATH_MAX];
+        long long due;
+        bool done;
+        DirLoad *load;
+} Prefetch;
+
+/* Prefetches running across all tabs, at most PREFETCH_MAX. */
+int prefetch_running = 0;
+
+/* Set from EAGER_STAT, stats every entry during the scan like before. */
+bool eager_stat = false;
+
+/* One directory as read from disk, shared by every tab that shows it: the
+ * rows, git status, the loads and stats in flight and the change watch. Tabs
+ * keep their own display order, selection and scroll on top of it. */
+typedef struct DirModel
+{
+        struct DirModel *next;
+        int refs;
+        char path[PATH_MAX];
+        SharedEntries *rows;
+        unsigned gen;
+
+        DirStamp stamp;
+        long long last_mtime, last_mtime_ns;
+        long long refresh_due, last_refresh;
+
+        /* The directory is watched through inotify when possible, otherwise
+         * its mtime is polled, less often the longer it stays the same. Names
+         * written to are collected in stale until the next frame. */
+        bool watched;
+        int watch_wd;
+        long long poll_due;
+        int poll_interval;
+        char stale[STALE_MAX][256];
+        int stale_count;
+        bool stale_all;
+
+        char git_branch[64];
+        DirLoad *load;
+        MetaLoad *meta;
+        DirSizeWalk *sizes;
+        bool sizes_dirty;
+        bool lost; /* the last read failed, see dir_model_lost() */
+
+        /* Set for the results of a content search below path, rows are then
+         * paths relative to it. Never shared through dir_model_find(). */
+        char grep[256];
+} DirModel;
+
+/* Directories open in at least one tab, by canonical path. */
+DirModel *dir_models = NULL;
+
+/* Source of DirModel.gen, a generation never repeats across directories. */
+unsigned dir_model_gen = 0;
+
 struct AppState
 {
-        FileEntry *entries;
-        int capacity, count;
+        DirModel *dir;
+        uint32_t *order;
+        int order_cap, count;
         char cwd[PATH_MAX], next_dir[PATH_MAX];
+        char opening[PATH_MAX]; /* the next_dir that did not answer in time yet */
         UIListState list;
         bool quit;
 
@@ -77,37 +490,128 @@ struct AppState
         char trash_dir[PATH_MAX];
         int trash_counter;
 
-        long long last_mtime;
-        long long last_mtime_ns;
+        SortMode sort;
+        SortCache sort_cache[SORT_COUNT];
+        Prefetch prefetch[2];
 
-        char git_branch[64];
+        Finder *find;
+        char select_name[256];
+
+        bool grep_prompt;
+        char grep_query[256];
+
+        /* The filter bar. While filter is set the display order only holds
+         * ".." and the rows whose name has it. filter_base is the whole order
+         * as it was in the current sort, rows from filter_rows on came in
+         * after it was taken. */
+        bool filter_open;
+        char filter_query[256], filter[256];
+        GrepPattern filter_pat;
+        bool filter_narrow;
+        uint32_t *filter_base;
+        int filter_base_count, filter_rows;
+
+        char jump[64];
+        long long jump_at;
+
+        RecentPrompt *recent;
 };
 
-#define MAX_TABS 8
+static DirModel *dir_model_find(const char *path)
+{
+        for (DirModel *m = dir_models; m; m = m->next)
+                if (!m->grep[0] && !strcmp(m->path, path))
+                        return m;
+        return NULL;
+}
+
+static inline const EntryTable *dir_rows(const DirModel *m)
+{
+        return &m->rows->t;
+}
+
+/* The rows for writing, copied first while a refresh still reads them. */
+static EntryTable *dir_rows_mut(DirModel *m)
+{
+        (shared_entries_own(&m->rows)) orelse return NULL;
+        return &m->rows->t;
+}
+
+const char *app_name(const AppState *app, int i)
+{
+        return entry_name(dir_rows(app->dir), app->order[i]);
+}
+
+bool app_is_dir(const AppState *app, int i)
+{
+        return dir_rows(app->dir)->flags[app->order[i]] & ENTRY_DIR;
+}
+
+void app_entry(const AppState *app, int i, FileEntry *out)
+{
+        entries_get(dir_rows(app->dir), app->order[i], out);
+}
 
+/* Tabs live at a fixed address once created, closed ones are reused, since
+ * undo actions keep pointing at their AppState. A tab that no dock leaf shows
+ * is put to sleep: only cwd, sort, view mode and scroll are kept. shown is
+ * set for the tabs drawn in the current frame. */
 typedef struct
 {
         AppState app;
-        bool in_use;
+        bool in_use, asleep, shown;
 } AppTab;
 
-extern AppTab tabs[MAX_TABS];
+extern AppTab **tabs;
+extern int tab_count;
 extern UIDockState dock;
 int add_tab(const char *dir);
 
-void get_dir_mtime(const char *path, long long *sec, long long *ns)
+int app_tab_id(const AppState *app)
 {
-        struct stat st;
-        if (stat(path, &st) == 0)
-        {
-                *sec = st.st_mtime;
+        for (int i = 0; i < tab_count; i++)
+                if (&tabs[i]->app == app)
+                        return i;
+        return -1;
+}
+
+void stat_mtime(const struct stat *st, long long *sec, long long *ns)
+{
+        *sec = st->st_mtime;
+#ifdef __APPLE__
+        *ns = st->st_mtimespec.tv_nsec;
+#else
+        *ns = st->st_mtim.tv_nsec;
+#endif
+}
+
+void dir_stamp(const struct stat *st, DirStamp *out)
+{
+        stat_mtime(st, &out->mtime, &out->mtime_ns);
+        out->ctime = st->st_ctime;
 #ifdef __APPLE__
-                *ns = st.st_mtimespec.tv_nsec;
+        out->ctime_ns = st->st_ctimespec.tv_nsec;
 #else
-                *ns = st.st_mtim.tv_nsec;
+        out->ctime_ns = st->st_ctim.tv_nsec;
 #endif
+}
+
+long long now_ms(void)
+{
+        raw struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Leaves sec and ns as they are when the directory does not answer in time. */
+void get_dir_mtime(const char *path, long long *sec, long long *ns)
+{
+        struct stat st;
+        if (fs_stat_path(path, &st, 0, POLL_DEADLINE_MS))
+        {
+                stat_mtime(&st, sec, ns);
         }
-        else
+        else if (errno != ETIMEDOUT)
         {
                 *sec = 0;
                 *ns = 0;
@@ -117,92 +621,136 @@ void get_dir_mtime(const char *path, long long *sec, long long *ns)
 void rm_rf(const char *path)
 {
         struct stat st;
-        if (stat(path, &st) != 0)
+        if (fs_vfs->stat(path, &st) != 0)
                 return;
         if (S_ISDIR(st.st_mode))
         {
-                DIR *d = opendir(path);
-                if (d)
+                int dfd = fs_open_dir(path);
+                FsDirIter *it = dfd >= 0 ? malloc(sizeof(FsDirIter)) : NULL;
+                if (it && fs_dir_begin(it, dfd))
                 {
-                        struct dirent *dir;
-                        while ((dir = readdir(d)) != NULL)
+                        const char *name;
+                        unsigned char type;
+                        while (fs_dir_next(it, &name, &type))
                         {
-                                if (!strcmp(dir->d_name, ".") || !strcmp(dir->d_name, ".."))
+                                if (!strcmp(name, ".."))
                                         continue;
                                 char sub[PATH_MAX];
-                                snprintf(sub, PATH_MAX, "%s/%s", path, dir->d_name);
+                                snprintf(sub, PATH_MAX, "%s/%s", path, name);
                                 rm_rf(sub);
                         }
-                        closedir(d);
+                        fs_dir_end(it);
                 }
-                rmdir(path);
+                free(it);
+                if (dfd >= 0)
+                        fs_vfs->close(dfd);
+                fs_vfs->rmdir(path);
         }
         else
         {
-                unlink(path);
+                fs_vfs->unlink(path);
+        }
+}
+
+/* Picks "name.copy.ext", then "name.copy1.ext" and so on in dir, the first
+ * that is free. False when dir does not answer in time. */
+static bool copy_dest_path(const char *dir, const char *name, char *out)
+{
+        raw char base_name[256];
+        snprintf(base_name, sizeof(base_name), "%s", name);
+        char *slash = strrchr(base_name, '/');
+        char *stem = slash ? slash + 1 : base_name;
+        char *dot = strrchr(stem, '.');
+        char ext[256] = "";
+        if (dot && dot != stem)
+        {
+                strcpy(ext, dot);
+                *dot = '\0';
+        }
+
+        raw struct stat st;
+        for (int copy_num = 0;; copy_num++)
+        {
+                if (copy_num == 0)
+                        snprintf(out, PATH_MAX, "%s/%s.copy%s", dir, base_name, ext);
+                else
+                        snprintf(out, PATH_MAX, "%s/%s.copy%d%s", dir, base_name, copy_num, ext);
+                if (!fs_stat_path(out, &st, 0, UI_FS_DEADLINE_MS))
+                        return errno != ETIMEDOUT;
         }
 }
 
+/* True only when all of src made it to dst. The stats wait as long as the
+ * reads do, a copy that skipped a slow entry would pass for a whole one. */
 bool copy_path(const char *src, const char *dst)
 {
         if (strncmp(dst, src, strlen(src)) == 0 && (dst[strlen(src)] == '/' || dst[strlen(src)] == '\0'))
                 return false;
         struct stat st;
-        if (stat(src, &st) != 0)
+        if (fs_vfs->stat(src, &st) != 0)
                 return false;
 
         if (S_ISDIR(st.st_mode))
         {
-                mkdir(dst, 0777);
-                DIR *d = opendir(src);
-                if (!d)
+                if (fs_vfs->mkdir(dst, 0777) != 0 && errno != EEXIST)
+                        return false;
+                int dfd = fs_open_dir(src);
+                if (dfd < 0)
                         return false;
-                struct dirent *dir;
-                while ((dir = readdir(d)) != NULL)
+                defer fs_vfs->close(dfd);
+                FsDirIter *it = malloc(sizeof(FsDirIter)) orelse return false;
+                defer free(it);
+                (fs_dir_begin(it, dfd)) orelse return false;
+                defer fs_dir_end(it);
+
+                const char *name;
+                unsigned char type;
+                while (fs_dir_next(it, &name, &type))
                 {
-                        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+                        if (strcmp(name, "..") == 0)
                                 continue;
                         char sub_src[PATH_MAX], sub_dst[PATH_MAX];
-                        snprintf(sub_src, PATH_MAX, "%s/%s", src, dir->d_name);
-                        snprintf(sub_dst, PATH_MAX, "%s/%s", dst, dir->d_name);
-                        copy_path(sub_src, sub_dst);
+                        snprintf(sub_src, PATH_MAX, "%s/%s", src, name);
+                        snprintf(sub_dst, PATH_MAX, "%s/%s", dst, name);
+                        (copy_path(sub_src, sub_dst)) orelse return false;
                 }
-                closedir(d);
-                chmod(dst, st.st_mode);
+                fs_vfs->chmod(dst, st.st_mode);
                 return true;
         }
         else
         {
-                FILE *fs = fopen(src, "rb");
-                if (!fs)
+                int in = fs_vfs->open_file(src, O_RDONLY, 0);
+                if (in < 0)
                         return false;
-                FILE *fd = fopen(dst, "wb");
-                if (!fd)
-                {
-                        fclose(fs);
+                defer fs_vfs->close(in);
+                int out = fs_vfs->open_file(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (out < 0)
                         return false;
-                }
+                defer fs_vfs->close(out);
+
                 char buf[8192];
-                size_t n;
-                while ((n = fread(buf, 1, sizeof(buf), fs)) > 0)
-                        fwrite(buf, 1, n, fd);
-                fclose(fs);
-                fclose(fd);
-                chmod(dst, st.st_mode);
-                return true;
+                ssize_t n;
+                while ((n = fs_vfs->read(in, buf, sizeof(buf))) > 0)
+                {
+                        for (ssize_t off = 0, w; off < n; off += w)
+                        {
+                                w = fs_vfs->write(out, buf + off, n - off);
+                                if (w <= 0)
+                                        return false;
+                        }
+                }
+                fs_vfs->chmod(dst, st.st_mode);
+                return n == 0;
         }
 }
 
 bool move_path(const char *src, const char *dst)
 {
-        if (rename(src, dst) == 0)
+        if (fs_vfs->rename(src, dst) == 0)
                 return true;
-        if (copy_path(src, dst))
-        {
-                rm_rf(src);
-                return true;
-        }
-        return false;
+        (copy_path(src, dst)) orelse return false;
+        rm_rf(src);
+        return true;
 }
 
 void cb_undo_move(void *data)
@@ -361,7 +909,7 @@ void app_do_delete(AppState *app, int target_idx)
         {
                 if ((drag_multi && s->selections[i]) || (!drag_multi && i == target_idx))
                 {
-                        if (strcmp(app->entries[i].name, "..") != 0)
+                        if (strcmp(app_name(app, i), "..") != 0)
                         {
                                 count++;
                                 last_deleted = i;
@@ -389,13 +937,15 @@ void app_do_delete(AppState *app, int target_idx)
         {
                 if ((drag_multi && s->selections[i]) || (!drag_multi && i == target_idx))
                 {
-                        if (strcmp(app->entries[i].name, "..") != 0)
+                        if (strcmp(app_name(app, i), "..") != 0)
                         {
                                 char src_path[PATH_MAX];
-                                snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
+                                snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
 
+                                const char *base = strrchr(app_name(app, i), '/');
+                                base = base ? base + 1 : app_name(app, i);
                                 char dst_path[PATH_MAX];
-                                snprintf(dst_path, PATH_MAX, "%s/trash_%d_%s", app->trash_dir, app->trash_counter++, app->entries[i].name);
+                                snprintf(dst_path, PATH_MAX, "%s/trash_%d_%s", app->trash_dir, app->trash_counter++, base);
 
                                 if (move_path(src_path, dst_path))
                                 {
@@ -460,18 +1010,6 @@ void app_do_delete(AppState *app, int target_idx)
         }
 }
 
-int cmp_entries(const void *a, const void *b)
-{
-        FileEntry *ea = (FileEntry *)a, *eb = (FileEntry *)b;
-        if (ea->is_dir != eb->is_dir)
-                return eb->is_dir - ea->is_dir;
-        if (!strcmp(ea->name, ".."))
-                return -1;
-        if (!strcmp(eb->name, ".."))
-                return 1;
-        return strcmp(ea->name, eb->name);
-}
-
 void draw_item_grid(AppState *app, FileEntry *e, int x, int y, int w, int h, bool is_sel, bool is_hover, bool is_ghost, bool is_drop_target, bool is_multi_sel, bool is_dropped, bool is_popping, bool is_pressed, bool is_ctx_target)
 {
         int float_y = 0;
@@ -559,7 +1097,20 @@ void draw_item_grid(AppState *app, FileEntry *e, int x, int y, int w, int h, boo
         }
 }
 
-void draw_item_list(AppState *app, FileEntry *e, int x, int y, int w, int h, bool is_sel, bool is_hover, bool is_ghost, bool is_drop_target, bool is_multi_sel, bool is_dropped, bool is_popping, bool is_pressed, bool is_ctx_target)
+/* Seven columns wide. */
+static void format_size(char *out, off_t s)
+{
+        if (s < 1024)
+                snprintf(out, 32, "%5lld B", (long long)s);
+        else if (s < 1024 * 1024)
+                snprintf(out, 32, "%4lld KB", (long long)(s >> 10));
+        else if (s < 1024 * 1024 * 1024)
+                snprintf(out, 32, "%4lld MB", (long long)(s >> 20));
+        else
+                snprintf(out, 32, "%4lld GB", (long long)(s >> 30));
+}
+
+void draw_item_list(AppState *app, FileEntry *e, int idx, int x, int y, int w, int h, bool is_sel, bool is_hover, bool is_ghost, bool is_drop_target, bool is_multi_sel, bool is_dropped, bool is_popping, bool is_pressed, bool is_ctx_target)
 {
         int float_y = 0;
         if (is_popping)
@@ -594,7 +1145,7 @@ void draw_item_list(AppState *app, FileEntry *e, int x, int y, int w, int h, boo
                 ui_rect(x, y, w, 1, item_bg, false);
         }
 
-        ui_text(x, y, e->is_dir ? (((e - app->entries) % 2 == 0) ? "▓]" : "▒]") : "■ ", icon_fg, item_bg, false, false);
+        ui_text(x, y, e->is_dir ? ((idx % 2 == 0) ? "▓]" : "▒]") : "■ ", icon_fg, item_bg, false, false);
         int name_x = x + 3;
 
         if (has_git)
@@ -604,7 +1155,8 @@ void draw_item_list(AppState *app, FileEntry *e, int x, int y, int w, int h, boo
                 name_x += 3;
         }
 
-        int right_margin = (!e->is_dir) ? 8 : 1;
+        bool show_size = !e->is_dir || e->sized;
+        int right_margin = show_size ? 8 : 1;
         int max_name_len = w - name_x - right_margin;
         if (max_name_len < 0)
                 max_name_len = 0;
@@ -617,27 +1169,25 @@ void draw_item_list(AppState *app, FileEntry *e, int x, int y, int w, int h, boo
         ui_text(name_x, y, l, is_ghost ? icon_fg : base_text_clr, item_bg, is_dropped, false);
 
         raw char size_str[32];
-        if (!e->is_dir)
+        if (!e->is_dir && e->meta_pending)
         {
-                off_t s = e->size;
-                if (s < 1024)
-                        snprintf(size_str, 32, "%5lld B", (long long)s);
-                else if (s < 1024 * 1024)
-                        snprintf(size_str, 32, "%4lld KB", (long long)(s >> 10));
-                else if (s < 1024 * 1024 * 1024)
-                        snprintf(size_str, 32, "%4lld MB", (long long)(s >> 20));
-                else
-                        snprintf(size_str, 32, "%4lld GB", (long long)(s >> 30));
-                ui_text(x + w - 7, y, size_str, is_ghost ? icon_fg : clr_bar, item_bg, false, false);
+                ui_text(x + w - 7, y, "    ···", clr_bar, item_bg, false, false);
+        }
+        else if (show_size)
+        {
+                /* A directory total still being added up is drawn dimmed. */
+                Color size_clr = is_ghost ? icon_fg : (e->is_dir && e->meta_pending ? (Color){100, 100, 100} : clr_bar);
+                format_size(size_str, e->size);
+                ui_text(x + w - 7, y, size_str, size_clr, item_bg, false, false);
         }
 }
 
-void draw_item(AppState *app, FileEntry *e, UIItemResult *res, bool is_sel, bool is_ghost, bool is_dropped, bool is_popping, bool is_pressed, bool is_ctx_target)
+void draw_item(AppState *app, FileEntry *e, int idx, UIItemResult *res, bool is_sel, bool is_ghost, bool is_dropped, bool is_popping, bool is_pressed, bool is_ctx_target)
 {
         if (app->list.mode == UI_MODE_GRID)
                 draw_item_grid(app, e, res->x, res->y, res->w, res->h, is_sel, res->hovered, is_ghost, res->is_drop_target, res->is_selected, is_dropped, is_popping, is_pressed, is_ctx_target);
         else
-                draw_item_list(app, e, res->x, res->y, res->w, res->h, is_sel, res->hovered, is_ghost, res->is_drop_target, res->is_selected, is_dropped, is_popping, is_pressed, is_ctx_target);
+                draw_item_list(app, e, idx, res->x, res->y, res->w, res->h, is_sel, res->hovered, is_ghost, res->is_drop_target, res->is_selected, is_dropped, is_popping, is_pressed, is_ctx_target);
 }
 
 bool is_item_dropped(AppState *app, const char *path)
@@ -660,227 +1210,215 @@ bool is_item_carried(AppState *app, const char *path)
         return false;
 }
 
-void app_load_dir(AppState *app, const char *path)
+/* Opens path (relative to app->cwd) as a directory without touching the
+ * process cwd. Absolute paths that no longer exist fall back to their nearest
+ * existing parent, same for a stale app->cwd. On success app->cwd holds the
+ * canonical path of the opened directory. Gives up with -1 on a directory
+ * that does not answer within timeout_ms, with 0 it only picks up what an
+ * earlier call left running. */
+int app_open_dir(AppState *app, const char *path, int timeout_ms)
 {
-        bool dir_changed = (strcmp(path, ".") != 0);
-
-        char prev_cwd[PATH_MAX];
-        getcwd(prev_cwd, sizeof(prev_cwd)) orelse return;
-        defer chdir(prev_cwd);
+        int max_age = timeout_ms ? 0 : FS_STAT_TTL_MS;
+        raw char base[PATH_MAX];
+        if (app->cwd[0])
+                strcpy(base, app->cwd);
+        else
+                getcwd(base, sizeof(base)) orelse return -1;
 
-        if (app->cwd[0] && path[0] != '/')
+        if (path[0] != '/')
         {
-                while (chdir(app->cwd) != 0)
+                struct stat st;
+                while (!fs_stat_path(base, &st, max_age, timeout_ms) || !S_ISDIR(st.st_mode))
                 {
-                        char *last_slash = strrchr(app->cwd, '/');
-                        if (!last_slash || last_slash == app->cwd)
+                        (errno != ETIMEDOUT) orelse return -1;
+                        char *last_slash = strrchr(base, '/');
+                        if (!last_slash || last_slash == base)
                         {
-                                strcpy(app->cwd, "/");
-                                chdir(app->cwd);
+                                strcpy(base, "/");
                                 break;
                         }
                         *last_slash = '\0';
                 }
+                if (app->cwd[0])
+                        strcpy(app->cwd, base);
         }
 
-        char mut_path[PATH_MAX];
-        strncpy(mut_path, path, PATH_MAX - 1);
-        mut_path[PATH_MAX - 1] = '\0';
+        raw char full[PATH_MAX];
+        fs_join(full, base, path);
 
-        while (chdir(mut_path) != 0)
+        int fd;
+        while ((fd = fs_open_dir_within(full, timeout_ms)) < 0)
         {
-                if (mut_path[0] == '/')
-                {
-                        char *last_slash = strrchr(mut_path, '/');
-                        if (!last_slash || last_slash == mut_path)
-                        {
-                                chdir("/");
-                                break;
-                        }
-                        *last_slash = '\0';
-                }
-                else
+                (path[0] == '/' && errno != ETIMEDOUT) orelse return -1;
+                char *last_slash = strrchr(full, '/');
+                if (!last_slash || last_slash == full)
                 {
-                        return;
+                        strcpy(full, "/");
+                        fd = fs_open_dir_within(full, timeout_ms);
+                        break;
                 }
+                *last_slash = '\0';
         }
+        (fd >= 0) orelse return -1;
+
+        if (!fs_fd_path(fd, app->cwd) && !realpath(full, app->cwd))
+                strcpy(app->cwd, full);
+        return fd;
+}
+
+void dir_load_release(DirLoad *ld)
+{
+        if (atomic_fetch_sub(&ld->refs, 1) != 1)
+                return;
+        if (ld->dfd >= 0)
+                fs_vfs->close(ld->dfd);
+        pthread_mutex_destroy(&ld->lock);
+        entries_free(&ld->batch);
+        shared_entries_release(ld->prev);
+        free(ld->removed);
+        free(ld->changed);
+        free(ld->git);
+        free(ld);
+}
 
-        DIR *d = opendir(".");
-        d orelse return;
-        defer closedir(d);
-        getcwd(app->cwd, sizeof(app->cwd)) orelse return;
-        get_dir_mtime(".", &app->last_mtime, &app->last_mtime_ns);
+static void dir_load_push(DirLoad *ld, const EntryTable *chunk)
+{
+        pthread_mutex_lock(&ld->lock);
+        entries_append(&ld->batch, chunk);
+        if (ld->limit && ld->batch.count > ld->limit)
+                atomic_store(&ld->cancel, true);
+        pthread_mutex_unlock(&ld->lock);
+        fs_jobs_notify();
+}
 
-        char sel[256] = "";
-        if (app->count > 0 && app->list.selected_idx >= 0)
-                strcpy(sel, app->entries[app->list.selected_idx].name);
+/* Stats the rows of a chunk that d_type could not settle in one batch and
+ * drops the ones that vanished meanwhile. */
+static void dir_load_stat_chunk(DirLoad *ld, EntryTable *chunk, FsStatReq *reqs, int nreq)
+{
+        (nreq > 0) orelse return;
+        for (int r = 0; r < nreq; r++)
+                reqs[r].name = entry_name(chunk, reqs[r].tag);
+        fs_stat_many(ld->dfd, reqs, nreq);
 
-        int saved_sel_count = 0;
-        raw char (*saved_sels)[256] = NULL;
-        if (app->count > 0 && app->list.selections)
+        for (int r = 0; r < nreq; r++)
         {
-                saved_sels = malloc(app->count * 256);
-                if (saved_sels)
+                int row = reqs[r].tag;
+                if (!reqs[r].ok)
                 {
-                        for (int i = 0; i < app->count; i++)
-                        {
-                                if (app->list.selections[i])
-                                        strcpy(saved_sels[saved_sel_count++], app->entries[i].name);
-                        }
+                        chunk->flags[row] = ENTRY_GONE;
+                        continue;
                 }
+                bool is_dir = S_ISDIR(reqs[r].st.st_mode);
+                chunk->flags[row] = is_dir ? ENTRY_DIR : ((reqs[r].st.st_mode & S_IXUSR) ? ENTRY_EXEC : 0);
+                chunk->size[row] = reqs[r].st.st_size;
+                chunk->mtime[row] = reqs[r].st.st_mtime;
         }
+        entries_compact(chunk, NULL);
+}
 
-        UIListMode m = app->list.mode;
-        ui_list_reset(&app->list);
-        app->list.mode = m;
-        if (app->list.selections && app->list.selections_cap > 0)
-                memset(app->list.selections, 0, app->list.selections_cap * sizeof(bool));
-        if (app->list.active_box_selections && app->list.selections_cap > 0)
-                memset(app->list.active_box_selections, 0, app->list.selections_cap * sizeof(bool));
-        if (dir_changed)
-        {
-                app->list.drop_anim = 0.0f;
-                app->list.fly_anim = 0.0f;
-                app->list.pickup_anim = 0.0f;
-                app->list.is_dragging = false;
-                app->list.is_box_selecting = false;
-                app->list.carrying = false;
-                app->drop_count = 0;
-        }
-        app->last_hovered_idx = -1;
-        app->count = 0;
-
-        bool has_dot_dot = false;
-        while (1)
+static void dir_load_scan(DirLoad *ld)
+{
+        raw FsDirIter it;
+        (fs_dir_begin(&it, ld->dfd)) orelse return;
+        defer fs_dir_end(&it);
+
+        EntryTable chunk = {0};
+        defer entries_free(&chunk);
+        FsStatReq *reqs = malloc(DIR_LOAD_CHUNK * sizeof(FsStatReq)) orelse return;
+        defer free(reqs);
+
+        /* The first chunk is kept small so the first screenful shows up fast. */
+        int nreq = 0, flush_at = 64;
+        const char *name;
+        unsigned char type;
+        while (fs_dir_next(&it, &name, &type))
         {
-                struct dirent *dir = readdir(d);
-                if (!dir)
-                        break;
-                if (!strcmp(dir->d_name, "."))
+                if (atomic_load(&ld->cancel))
+                        return;
+                if (!strcmp(name, ".."))
                         continue;
-                if (!strcmp(dir->d_name, ".."))
-                        has_dot_dot = true;
 
-                if (app->count >= app->capacity)
-                {
-                        app->capacity = app->capacity ? app->capacity * 2 : 256;
-                        app->entries = realloc(app->entries, app->capacity * sizeof(FileEntry));
-                        if (!app->entries)
-                                break;
-                }
+                /* Symlinks still need a stat to know whether they point at a
+                 * directory, everything else can wait until it is on screen. */
+                bool typed = !eager_stat && !ld->need_meta && type != DT_UNKNOWN && type != DT_LNK;
+                uint8_t flags = typed ? ((type == DT_DIR ? ENTRY_DIR : 0) | ENTRY_META_PENDING) : 0;
+                int row = entries_add(&chunk, name, (int)strlen(name), flags, 0, 0);
+                (row >= 0) orelse continue;
+                if (!typed)
+                        reqs[nreq++].tag = row;
 
-                raw struct stat st;
-                memset(&st, 0, sizeof(st));
-                if (stat(dir->d_name, &st))
+                if (chunk.count == flush_at)
                 {
-                        if (lstat(dir->d_name, &st))
-                        {
-                                if (strcmp(dir->d_name, "..") == 0)
-                                        st.st_mode = S_IFDIR;
-                                else
-                                        continue;
-                        }
+                        dir_load_stat_chunk(ld, &chunk, reqs, nreq);
+                        dir_load_push(ld, &chunk);
+                        entries_clear(&chunk);
+                        nreq = 0;
+                        flush_at = DIR_LOAD_CHUNK;
                 }
-
-                FileEntry *e = &app->entries[app->count++];
-                strcpy(e->name, dir->d_name);
-                e->size = st.st_size;
-                e->is_dir = S_ISDIR(st.st_mode);
-                e->is_exec = (st.st_mode & S_IXUSR) && !e->is_dir;
-
-                e->git_status[0] = '\0';
-                e->git_status[1] = '\0';
-                e->git_status[2] = '\0';
         }
+        dir_load_stat_chunk(ld, &chunk, reqs, nreq);
+        dir_load_push(ld, &chunk);
+}
 
-        if (!has_dot_dot && strcmp(app->cwd, "/") != 0)
+/* A refresh of search results stats the rows it has instead of searching
+ * again, what is gone drops out in the diff. */
+static void dir_load_restat(DirLoad *ld)
+{
+        const EntryTable *prev = &ld->prev->t;
+        EntryTable chunk = {0};
+        defer entries_free(&chunk);
+        FsStatReq *reqs = malloc(DIR_LOAD_CHUNK * sizeof(FsStatReq)) orelse return;
+        defer free(reqs);
+
+        for (int r = 0; r < prev->count && !atomic_load(&ld->cancel); r++)
         {
-                if (app->count >= app->capacity)
-                {
-                        app->capacity = app->capacity ? app->capacity * 2 : 256;
-                        app->entries = realloc(app->entries, app->capacity * sizeof(FileEntry));
-                }
-                if (app->entries)
+                (strcmp(entry_name(prev, r), "..") && !(prev->flags[r] & ENTRY_GONE)) orelse continue;
+                int row = entries_add(&chunk, entry_name(prev, r), prev->name_len[r], 0, 0, 0);
+                (row >= 0) orelse continue;
+                reqs[chunk.count - 1].tag = row;
+                if (chunk.count == DIR_LOAD_CHUNK)
                 {
-                        FileEntry *e = &app->entries[app->count++];
-                        strcpy(e->name, "..");
-                        e->size = 0;
-                        e->is_dir = true;
-                        e->is_exec = false;
-                        e->git_status[0] = '\0';
-                        e->git_status[1] = '\0';
-                        e->git_status[2] = '\0';
+                        dir_load_stat_chunk(ld, &chunk, reqs, chunk.count);
+                        dir_load_push(ld, &chunk);
+                        entries_clear(&chunk);
                 }
         }
+        dir_load_stat_chunk(ld, &chunk, reqs, chunk.count);
+        dir_load_push(ld, &chunk);
+}
 
-        if (app->entries)
-                qsort(app->entries, app->count, sizeof(FileEntry), cmp_entries);
+static int cmp_git_entries(const void *a, const void *b)
+{
+        return strcmp(((const GitStatusEntry *)a)->name, ((const GitStatusEntry *)b)->name);
+}
 
-        if (!dir_changed && saved_sels)
+static void dir_load_git(DirLoad *ld)
+{
+        (fs_vfs == &fs_posix && !ld->grep[0]) orelse return;
+        raw char branch[64];
+        branch[0] = '\0';
+        pid_t pid;
+        char *branch_argv[] = {"git", "-C", ld->path, "branch", "--show-current", NULL};
+        FILE *f = fs_popen(branch_argv, &pid);
+        if (f)
         {
-                for (int i = 0; i < app->count; i++)
+                if (fgets(branch, sizeof(branch), f))
                 {
-                        for (int j = 0; j < saved_sel_count; j++)
-                        {
-                                if (!strcmp(app->entries[i].name, saved_sels[j]))
-                                {
-                                        app->list.selections[i] = true;
-                                        break;
-                                }
-                        }
-                }
-        }
-        if (saved_sels)
-                free(saved_sels);
-
-        if (!dir_changed && app->list.drop_anim > 0.0f)
-        {
-                for (int i = 0; i < app->count; i++)
-                {
-                        raw char p[PATH_MAX];
-                        snprintf(p, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
-                        for (int di = 0; di < app->drop_count; di++)
-                        {
-                                if (!strcmp(p, app->drop_paths[di]))
-                                {
-                                        app->list.selections[i] = true;
-                                        app->list.selected_idx = i;
-                                        break;
-                                }
-                        }
-                }
-        }
-
-        if (dir_changed && app->count > 0)
-                app->list.selected_idx = 0;
-        else if (app->count > 0 && sel[0])
-        {
-                for (int i = 0; i < app->count; i++)
-                {
-                        if (!strcmp(app->entries[i].name, sel))
-                        {
-                                app->list.selected_idx = i;
-                                break;
-                        }
-                }
-        }
-
-        app->git_branch[0] = '\0';
-        FILE *f = popen("git branch --show-current 2>/dev/null", "r");
-        if (f)
-        {
-                if (fgets(app->git_branch, sizeof(app->git_branch), f))
-                {
-                        char *nl = strchr(app->git_branch, '\n');
+                        char *nl = strchr(branch, '\n');
                         if (nl)
                                 *nl = '\0';
                 }
-                pclose(f);
+                else
+                        branch[0] = '\0';
+                fs_pclose(f, pid);
         }
 
-        if (app->git_branch[0] != '\0')
+        GitStatusEntry *git = NULL;
+        int git_count = 0, git_cap = 0;
+        if (branch[0] != '\0' && !atomic_load(&ld->cancel))
         {
-                f = popen("git --no-optional-locks status -s . 2>/dev/null", "r");
+                char *status_argv[] = {"git", "-C", ld->path, "--no-optional-locks", "status", "-s", ".", NULL};
+                f = fs_popen(status_argv, &pid);
                 if (f)
                 {
                         char line[1024];
@@ -888,7 +1426,6 @@ void app_load_dir(AppState *app, const char *path)
                         {
                                 if (strlen(line) < 4)
                                         continue;
-                                char status[3] = {line[0], line[1], '\0'};
 
                                 char *p = line + 3;
                                 if (p[0] == '"')
@@ -909,21 +1446,3213 @@ void app_load_dir(AppState *app, const char *path)
                                 if (slash)
                                         *slash = '\0';
 
-                                for (int i = 0; i < app->count; i++)
+                                if (git_count >= git_cap)
                                 {
-                                        if (strcmp(app->entries[i].name, p) == 0)
-                                        {
-                                                if (app->entries[i].git_status[0] == '\0' || status[0] == 'M' || status[1] == 'M')
-                                                {
-                                                        strcpy(app->entries[i].git_status, status);
-                                                }
-                                                break;
-                                        }
+                                        git_cap = git_cap ? git_cap * 2 : 64;
+                                        git = realloc(git, git_cap * sizeof(GitStatusEntry)) orelse break;
                                 }
+                                GitStatusEntry *g = &git[git_count++];
+                                snprintf(g->name, sizeof(g->name), "%s", p);
+                                g->status[0] = line[0];
+                                g->status[1] = line[1];
+                                g->status[2] = '\0';
+                        }
+                        fs_pclose(f, pid);
+                }
+        }
+
+        /* Paths below a subdirectory collapse onto its name, keep one status
+         * per name and prefer a modification. Sorted for lookups by name. */
+        if (git && git_count > 1)
+        {
+                qsort(git, git_count, sizeof(GitStatusEntry), cmp_git_entries);
+                int kept = 0;
+                for (int i = 0; i < git_count; i++)
+                {
+                        if (kept > 0 && !strcmp(git[kept - 1].name, git[i].name))
+                        {
+                                if (git[i].status[0] == 'M' || git[i].status[1] == 'M')
+                                        git[kept - 1] = git[i];
+                                continue;
+                        }
+                        git[kept++] = git[i];
+                }
+                git_count = kept;
+        }
+
+        pthread_mutex_lock(&ld->lock);
+        strcpy(ld->git_branch, branch);
+        ld->git = git;
+        ld->git_count = git ? git_count : 0;
+        pthread_mutex_unlock(&ld->lock);
+}
+
+static int dir_diff_cmp(const EntryTable *a, uint32_t ra, const EntryTable *b, uint32_t rb)
+{
+        bool da = a->flags[ra] & ENTRY_DIR, db = b->flags[rb] & ENTRY_DIR;
+        if (da != db)
+                return db - da;
+        return strcmp(entry_name(a, ra), entry_name(b, rb));
+}
+
+/* Walks the old and new listing in name order and splits the difference into
+ * removed rows, rows with new metadata and a table of added rows. */
+static void dir_load_diff(DirLoad *ld)
+{
+        EntryTable *old = &ld->prev->t, *cur = &ld->batch;
+        uint32_t *po = malloc((old->count + 1) * sizeof(uint32_t)) orelse return;
+        defer free(po);
+        uint32_t *pc = malloc((cur->count + 1) * sizeof(uint32_t)) orelse return;
+        defer free(pc);
+
+        int no = 0, nc = cur->count;
+        for (int r = 0; r < old->count; r++)
+                if (!(old->flags[r] & ENTRY_GONE) && strcmp(entry_name(old, r), ".."))
+                        po[no++] = r;
+        for (int r = 0; r < nc; r++)
+                pc[r] = r;
+        entries_sort(old, SORT_NAME, po, no);
+        entries_sort(cur, SORT_NAME, pc, nc);
+
+        ld->removed = malloc((no + 1) * sizeof(uint32_t)) orelse return;
+        ld->changed = malloc(((no < nc ? no : nc) + 1) * sizeof(DirChange)) orelse return;
+        EntryTable added = {0};
+
+        int i = 0, j = 0;
+        while (i < no || j < nc)
+        {
+                int c = i >= no ? 1 : (j >= nc ? -1 : dir_diff_cmp(old, po[i], cur, pc[j]));
+                if (c < 0)
+                {
+                        ld->removed[ld->removed_count++] = po[i++];
+                        continue;
+                }
+
+                uint32_t r = pc[j++];
+                if (c > 0)
+                {
+                        entries_add(&added, entry_name(cur, r), cur->name_len[r], cur->flags[r], cur->size[r], cur->mtime[r]);
+                        continue;
+                }
+
+                /* A d_type-only scan says nothing new about a row that is
+                 * still there, keep whatever was stat'ed before. */
+                uint32_t o = po[i++];
+                if (cur->flags[r] & ENTRY_META_PENDING)
+                        continue;
+                if ((old->flags[o] & (ENTRY_EXEC | ENTRY_META_PENDING)) != (cur->flags[r] & ENTRY_EXEC) ||
+                    old->size[o] != cur->size[r] || old->mtime[o] != cur->mtime[r])
+                        ld->changed[ld->changed_count++] = (DirChange){o, cur->flags[r], cur->size[r], cur->mtime[r]};
+        }
+
+        entries_free(cur);
+        *cur = added;
+        ld->diffed = true;
+}
+
+/* Opening happens on the worker as well, on slow mounts that alone can take
+ * a while. */
+static bool dir_load_open(DirLoad *ld)
+{
+        if (ld->dfd < 0)
+                ld->dfd = fs_open_dir(ld->path);
+        raw struct stat st;
+        (ld->dfd >= 0 && fs_vfs->fstat(ld->dfd, &st) == 0) orelse return false;
+        dir_stamp(&st, &ld->stamp);
+        return true;
+}
+
+static bool grep_compile(GrepPattern *p, const char *query);
+static FindWalk *find_start(const char *root, bool skip, DirLoad *load, const GrepPattern *pat);
+
+static void dir_load_job(void *arg)
+{
+        DirLoad *ld = arg;
+        bool ok = dir_load_open(ld);
+
+        /* A search runs on the walkers of a find, which end the load. */
+        raw GrepPattern pat;
+        if (ok && ld->grep[0] && !ld->refresh && grep_compile(&pat, ld->grep) && find_start(ld->path, ld->grep_skip, ld, &pat))
+                return;
+        if (ok && ld->grep[0] && ld->prev)
+                dir_load_restat(ld);
+        else if (ok && !ld->grep[0])
+                dir_load_scan(ld);
+        if (ok && ld->refresh && !atomic_load(&ld->cancel))
+                dir_load_diff(ld);
+        shared_entries_release(ld->prev);
+        ld->prev = NULL;
+
+        pthread_mutex_lock(&ld->lock);
+        ld->listed = true;
+        ld->failed = !ok;
+        pthread_mutex_unlock(&ld->lock);
+        fs_jobs_notify();
+
+        if (ok && !atomic_load(&ld->cancel))
+                dir_load_git(ld);
+
+        pthread_mutex_lock(&ld->lock);
+        ld->done = true;
+        pthread_mutex_unlock(&ld->lock);
+        fs_jobs_notify();
+        dir_load_release(ld);
+}
+
+/* Lists a directory nobody looks at yet for the listing cache. */
+static void dir_prefetch_job(void *arg)
+{
+        DirLoad *ld = arg;
+        if (dir_load_open(ld))
+                dir_load_scan(ld);
+        else
+                atomic_store(&ld->cancel, true);
+
+        pthread_mutex_lock(&ld->lock);
+        ld->listed = ld->done = true;
+        pthread_mutex_unlock(&ld->lock);
+        fs_jobs_notify();
+        dir_load_release(ld);
+}
+
+void dir_model_cancel_load(DirModel *m)
+{
+        if (!m->load)
+                return;
+        atomic_store(&m->load->cancel, true);
+        dir_load_release(m->load);
+        m->load = NULL;
+}
+
+static void meta_load_release(MetaLoad *m)
+{
+        if (atomic_fetch_sub(&m->refs, 1) == 1)
+                free(m);
+}
+
+static void meta_load_job(void *arg)
+{
+        MetaLoad *m = arg;
+        int dfd = fs_open_dir(m->path);
+        FsStatReq *reqs = calloc(m->count, sizeof(FsStatReq));
+        if (dfd >= 0 && reqs && !atomic_load(&m->cancel))
+        {
+                for (int i = 0; i < m->count; i++)
+                        reqs[i].name = m->items[i].name;
+                fs_stat_many(dfd, reqs, m->count);
+                for (int i = 0; i < m->count; i++)
+                {
+                        m->items[i].ok = reqs[i].ok;
+                        m->items[i].size = reqs[i].st.st_size;
+                        m->items[i].mtime = reqs[i].st.st_mtime;
+                        m->items[i].is_exec = (reqs[i].st.st_mode & S_IXUSR) && !S_ISDIR(reqs[i].st.st_mode);
+                }
+        }
+        free(reqs);
+        if (dfd >= 0)
+                fs_vfs->close(dfd);
+        atomic_store(&m->done, true);
+        fs_jobs_notify();
+        meta_load_release(m);
+}
+
+static bool row_wants_meta(uint8_t flags)
+{
+        return (flags & (ENTRY_META_PENDING | ENTRY_META_STALE)) && !(flags & ENTRY_META_QUEUED);
+}
+
+/* Sorting by size or time and the treemap need every row stat'ed. */
+static bool app_needs_meta(const AppState *app)
+{
+        return sort_needs_meta(app->sort) || app->list.mode == UI_MODE_TREEMAP;
+}
+
+/* Whether any tab showing m needs something only a stat tells. */
+static bool dir_model_needs_meta(const DirModel *m)
+{
+        for (int t = 0; t < tab_count; t++)
+                if (tabs[t]->in_use && tabs[t]->app.dir == m && app_needs_meta(&tabs[t]->app))
+                        return true;
+        return false;
+}
+
+/* Queues a stat for the on-screen rows that still only have d_type info or
+ * were written to since. One request is in flight per directory, the next
+ * frame of whichever tab shows it picks up whatever is left. */
+void app_request_meta(AppState *app, int first, int end, const UIItemResult *items)
+{
+        DirModel *dm = app->dir;
+        (dm && !dm->meta) orelse return;
+
+        const uint8_t *flags = dir_rows(dm)->flags;
+        int n = 0;
+        for (int i = first; i < end; i++)
+                if (items[i - first].w != -1 && row_wants_meta(flags[app->order[i]]))
+                        n++;
+        (n > 0) orelse return;
+        if (n > META_LOAD_MAX)
+                n = META_LOAD_MAX;
+
+        EntryTable *t = dir_rows_mut(dm) orelse return;
+        MetaLoad *m = calloc(1, sizeof(MetaLoad) + n * sizeof(m->items[0])) orelse return;
+        atomic_init(&m->refs, 2);
+        strcpy(m->path, dm->path);
+        m->gen = dm->gen;
+        for (int i = first; i < end && m->count < n; i++)
+        {
+                uint32_t row = app->order[i];
+                if (items[i - first].w == -1 || !row_wants_meta(t->flags[row]))
+                        continue;
+                t->flags[row] |= ENTRY_META_QUEUED;
+                strcpy(m->items[m->count].name, entry_name(t, row));
+                m->items[m->count].row = row;
+                m->count++;
+        }
+        dm->meta = m;
+        fs_jobs_submit(meta_load_job, m);
+}
+
+/* Rows are never reordered within a table, results go straight back to them
+ * unless the table was renumbered in the meantime. */
+static void dir_model_finish_meta(DirModel *dm, bool apply)
+{
+        MetaLoad *m = dm->meta;
+        EntryTable *t = dir_rows_mut(dm);
+        for (int i = 0; t && i < m->count && m->gen == dm->gen; i++)
+        {
+                int row = m->items[i].row;
+                t->flags[row] &= ~ENTRY_META_QUEUED;
+                if (!apply)
+                        continue;
+                t->flags[row] &= ~(ENTRY_META_PENDING | ENTRY_META_STALE);
+                if (m->items[i].ok)
+                {
+                        t->size[row] = m->items[i].size;
+                        t->mtime[row] = m->items[i].mtime;
+                        t->flags[row] = (t->flags[row] & ~ENTRY_EXEC) | (m->items[i].is_exec ? ENTRY_EXEC : 0);
+                }
+        }
+        dm->meta = NULL;
+        meta_load_release(m);
+}
+
+void dir_model_pump_meta(DirModel *m)
+{
+        (m->meta && atomic_load(&m->meta->done)) orelse return;
+        dir_model_finish_meta(m, true);
+}
+
+void dir_model_cancel_meta(DirModel *m)
+{
+        (m->meta) orelse return;
+        atomic_store(&m->meta->cancel, true);
+        dir_model_finish_meta(m, false);
+}
+
+static uint32_t dir_size_hash(const char *path)
+{
+        uint32_t h = 2166136261u;
+        for (; *path; path++)
+                h = (h ^ (unsigned char)*path) * 16777619u;
+        return h;
+}
+
+static CachedDirSize *dir_size_cached(const char *path)
+{
+        uint32_t h = dir_size_hash(path);
+        for (int i = 0; i < DIR_SIZE_CACHE_SLOTS; i++)
+                if (dir_size_cache[i].path && dir_size_cache[i].hash == h && !strcmp(dir_size_cache[i].path, path))
+                        return &dir_size_cache[i];
+        return NULL;
+}
+
+static void dir_size_cache_drop(CachedDirSize *c)
+{
+        free(c->path);
+        free(c->kids);
+        memset(c, 0, sizeof(*c));
+}
+
+/* Takes over kids, the totals of the directories right inside path. Without
+ * them the ones already known are kept as long as nothing changed. */
+static void dir_size_cache_put(const char *path, int64_t mtime, off_t bytes, DirSizeSub *kids, int kid_count)
+{
+        CachedDirSize *c = dir_size_cached(path);
+        if (c && !kids && c->mtime == mtime && c->bytes == bytes)
+        {
+                c->used = ++dir_size_tick;
+                return;
+        }
+        if (!c)
+        {
+                c = &dir_size_cache[0];
+                for (int i = 1; i < DIR_SIZE_CACHE_SLOTS && c->path; i++)
+                        if (!dir_size_cache[i].path || dir_size_cache[i].used < c->used)
+                                c = &dir_size_cache[i];
+                dir_size_cache_drop(c);
+                c->path = strdup(path) orelse
+                {
+                        free(kids);
+                        return;
+                };
+        }
+        free(c->kids);
+        c->hash = dir_size_hash(path);
+        c->mtime = mtime;
+        c->bytes = bytes;
+        c->kids = kids;
+        c->kid_count = kids ? kid_count : 0;
+        c->used = ++dir_size_tick;
+}
+
+static bool path_within(const char *path, const char *dir)
+{
+        (dir) orelse return false;
+        size_t len = strlen(dir);
+        return len > 0 && !strncmp(path, dir, len) && (path[len] == '\0' || path[len] == '/' || dir[len - 1] == '/');
+}
+
+/* Something in path changed, so its total and the totals of every directory
+ * above it are off. Walks on screen that counted it start over, which is the
+ * ones where path is a directory row or lies below one. */
+void dir_size_invalidate(const char *path, bool is_dir)
+{
+        for (int i = 0; i < DIR_SIZE_CACHE_SLOTS; i++)
+        {
+                if (path_within(path, dir_size_cache[i].path))
+                        dir_size_cache_drop(&dir_size_cache[i]);
+        }
+        for (DirModel *m = dir_models; m; m = m->next)
+        {
+                (m->sizes && strcmp(path, m->path) && path_within(path, m->path)) orelse continue;
+                const char *rel = path + strlen(m->path);
+                while (*rel == '/')
+                        rel++;
+                if (is_dir || strchr(rel, '/'))
+                        m->sizes_dirty = true;
+        }
+}
+
+static void dir_size_release(DirSizeWalk *w)
+{
+        (atomic_fetch_sub(&w->refs, 1) == 1) orelse return;
+        for (int i = 0; i < w->walkers; i++)
+        {
+                DirSizeDeque *q = &w->deques[i];
+                for (int j = q->lo; j < q->hi; j++)
+                        free(q->items[j].path);
+                free(q->items);
+                pthread_mutex_destroy(&q->lock);
+        }
+        free(w->deques);
+        for (int i = 0; i < w->count; i++)
+        {
+                DirSizeSubBlock *b = atomic_load(&w->targets[i].subs);
+                while (b)
+                {
+                        DirSizeSubBlock *next = b->next;
+                        free(b);
+                        b = next;
+                }
+        }
+        pthread_mutex_destroy(&w->seen_lock);
+        free(w->seen);
+        free(w->by_row);
+        free(w);
+}
+
+static bool dir_size_push(DirSizeDeque *q, DirSizeItem item)
+{
+        pthread_mutex_lock(&q->lock);
+        if (q->hi == q->cap && q->lo > 0)
+        {
+                memmove(q->items, q->items + q->lo, (q->hi - q->lo) * sizeof(DirSizeItem));
+                q->hi -= q->lo;
+                q->lo = 0;
+        }
+        if (q->hi == q->cap)
+        {
+                int cap = q->cap ? q->cap * 2 : 64;
+                DirSizeItem *grown = realloc(q->items, cap * sizeof(DirSizeItem));
+                if (!grown)
+                {
+                        pthread_mutex_unlock(&q->lock);
+                        return false;
+                }
+                q->items = grown;
+                q->cap = cap;
+        }
+        q->items[q->hi++] = item;
+        pthread_mutex_unlock(&q->lock);
+        return true;
+}
+
+static bool dir_size_take(DirSizeDeque *q, bool steal, DirSizeItem *out)
+{
+        pthread_mutex_lock(&q->lock);
+        bool got = q->lo < q->hi;
+        if (got)
+        {
+                *out = steal ? q->items[q->lo++] : q->items[--q->hi];
+                if (q->lo == q->hi)
+                        q->lo = q->hi = 0;
+        }
+        pthread_mutex_unlock(&q->lock);
+        return got;
+}
+
+static size_t dir_size_seen_slot(const DirSizeWalk *w, dev_t dev, ino_t ino)
+{
+        size_t mask = w->seen_cap - 1;
+        uint64_t h = ((uint64_t)ino ^ ((uint64_t)dev << 40)) * 0x9E3779B97F4A7C15ull;
+        size_t i = (size_t)(h ^ (h >> 29)) & mask;
+        while ((w->seen[i].dev || w->seen[i].ino) && (w->seen[i].dev != dev || w->seen[i].ino != ino))
+                i = (i + 1) & mask;
+        return i;
+}
+
+/* Whether this is the first time the walk comes across the inode of st. */
+static bool dir_size_first_seen(DirSizeWalk *w, const struct stat *st)
+{
+        pthread_mutex_lock(&w->seen_lock);
+        if ((w->seen_count + 1) * 2 > w->seen_cap)
+        {
+                size_t old_cap = w->seen_cap, cap = old_cap ? old_cap * 2 : 1024;
+                DirSizeInode *seen = calloc(cap, sizeof(DirSizeInode));
+                if (!seen)
+                {
+                        pthread_mutex_unlock(&w->seen_lock);
+                        return true;
+                }
+                DirSizeInode *old = w->seen;
+                w->seen = seen;
+                w->seen_cap = cap;
+                for (size_t i = 0; i < old_cap; i++)
+                        if (old[i].dev || old[i].ino)
+                                w->seen[dir_size_seen_slot(w, old[i].dev, old[i].ino)] = old[i];
+                free(old);
+        }
+        size_t i = dir_size_seen_slot(w, st->st_dev, st->st_ino);
+        bool first = !w->seen[i].dev && !w->seen[i].ino;
+        if (first)
+        {
+                w->seen[i].dev = st->st_dev;
+                w->seen[i].ino = st->st_ino;
+                w->seen_count++;
+        }
+        pthread_mutex_unlock(&w->seen_lock);
+        return first;
+}
+
+static void dir_size_job(void *arg);
+
+/* Puts one more walker on the pool while the walk has fewer than it may use. */
+static void dir_size_spawn(DirSizeWalk *w)
+{
+        int n = atomic_load(&w->active);
+        while (n < w->walkers && !atomic_compare_exchange_weak(&w->active, &n, n + 1))
+                ;
+        (n < w->walkers) orelse return;
+        atomic_fetch_add(&w->refs, 1);
+        if (!fs_jobs_submit_idle(dir_size_job, w))
+        {
+                atomic_fetch_sub(&w->active, 1);
+                atomic_fetch_sub(&w->refs, 1);
+        }
+}
+
+static void dir_size_notify(DirSizeWalk *w)
+{
+        long long now = now_ms(), last = atomic_load(&w->notified);
+        if (now - last >= DIR_SIZE_NOTIFY_MS && atomic_compare_exchange_strong(&w->notified, &last, now))
+                fs_jobs_notify();
+}
+
+/* Only called by the walker reading the target itself. */
+static DirSizeSub *dir_size_add_sub(DirSizeTarget *t, const char *name)
+{
+        DirSizeSubBlock *b = atomic_load(&t->subs);
+        if (!b || atomic_load(&b->count) == DIR_SIZE_SUB_BLOCK)
+        {
+                DirSizeSubBlock *fresh = calloc(1, sizeof(DirSizeSubBlock)) orelse return NULL;
+                fresh->next = b;
+                atomic_store(&t->subs, fresh);
+                b = fresh;
+        }
+        int n = atomic_load(&b->count);
+        snprintf(b->subs[n].name, sizeof(b->subs[n].name), "%s", name);
+        atomic_store(&b->count, n + 1);
+        return &b->subs[n];
+}
+
+/* Adds up one chunk of a directory's entries and queues its subdirectories
+ * on the walker's own deque. */
+static void dir_size_stat_chunk(DirSizeWalk *w, int self, const DirSizeItem *item, int dfd, EntryTable *chunk, FsStatReq *reqs)
+{
+        for (int r = 0; r < chunk->count; r++)
+                reqs[r].name = entry_name(chunk, r);
+        fs_lstat_many(dfd, reqs, chunk->count);
+
+        DirSizeTarget *t = &w->targets[item->target];
+        size_t len = strlen(item->path);
+        off_t bytes = 0;
+        bool pushed = false;
+        for (int r = 0; r < chunk->count; r++)
+        {
+                const struct stat *st = &reqs[r].st;
+                (reqs[r].ok) orelse continue;
+                if (!S_ISDIR(st->st_mode))
+                {
+                        if (st->st_nlink <= 1 || dir_size_first_seen(w, st))
+                                bytes += st->st_size;
+                        continue;
+                }
+                char *path = malloc(len + chunk->name_len[r] + 2) orelse continue;
+                memcpy(path, item->path, len);
+                path[len] = '/';
+                memcpy(path + len + 1, reqs[r].name, chunk->name_len[r] + 1);
+                DirSizeSub *sub = item->depth == 0 ? dir_size_add_sub(t, reqs[r].name) : item->sub;
+                atomic_fetch_add(&t->pending, 1);
+                if (dir_size_push(&w->deques[self], (DirSizeItem){path, item->target, sub, item->depth + 1}))
+                {
+                        pushed = true;
+                }
+                else
+                {
+                        free(path);
+                        atomic_fetch_sub(&t->pending, 1);
+                }
+        }
+        atomic_fetch_add(&t->bytes, bytes);
+        if (item->sub)
+                atomic_fetch_add(&item->sub->bytes, bytes);
+        entries_clear(chunk);
+        if (pushed)
+                dir_size_spawn(w);
+}
+
+static void dir_size_visit(DirSizeWalk *w, int self, const DirSizeItem *item, EntryTable *chunk, FsStatReq *reqs)
+{
+        int dfd = fs_open_dir(item->path);
+        (dfd >= 0) orelse return;
+        defer fs_vfs->close(dfd);
+        raw struct stat st;
+        (fs_vfs->fstat(dfd, &st) == 0 && dir_size_first_seen(w, &st)) orelse return;
+        DirSizeTarget *t = &w->targets[item->target];
+        if (item->depth == 0)
+                t->mtime = st.st_mtime;
+        else if (item->depth == 1 && item->sub)
+                item->sub->mtime = st.st_mtime;
+        atomic_fetch_add(&t->bytes, st.st_size);
+        if (item->sub)
+                atomic_fetch_add(&item->sub->bytes, st.st_size);
+
+        raw FsDirIter it;
+        (fs_dir_begin(&it, dfd)) orelse return;
+        defer fs_dir_end(&it);
+        const char *name;
+        unsigned char type;
+        while (!atomic_load(&w->cancel) && fs_dir_next(&it, &name, &type))
+        {
+                if (!strcmp(name, ".."))
+                        continue;
+                entries_add(chunk, name, (int)strlen(name), 0, 0, 0);
+                if (chunk->count == DIR_LOAD_CHUNK)
+                        dir_size_stat_chunk(w, self, item, dfd, chunk, reqs);
+        }
+        if (chunk->count > 0)
+                dir_size_stat_chunk(w, self, item, dfd, chunk, reqs);
+        dir_size_notify(w);
+}
+
+/* One walker. It works off its own deque and steals once that runs dry, and
+ * hands its worker back every slice so listings queued meanwhile go first. */
+static void dir_size_job(void *arg)
+{
+        DirSizeWalk *w = arg;
+        int self = atomic_fetch_add(&w->next_deque, 1) % w->walkers;
+        EntryTable chunk = {0};
+        defer entries_free(&chunk);
+        FsStatReq *reqs = malloc(DIR_LOAD_CHUNK * sizeof(FsStatReq));
+        defer free(reqs);
+
+        long long until = now_ms() + DIR_SIZE_SLICE_MS;
+        raw DirSizeItem item;
+        while (reqs && !atomic_load(&w->cancel))
+        {
+                bool got = dir_size_take(&w->deques[self], false, &item);
+                for (int i = 1; !got && i < w->walkers; i++)
+                        got = dir_size_take(&w->deques[(self + i) % w->walkers], true, &item);
+                (got) orelse break;
+
+                dir_size_visit(w, self, &item, &chunk, reqs);
+                free(item.path);
+                DirSizeTarget *t = &w->targets[item.target];
+                if (atomic_fetch_sub(&t->pending, 1) == 1)
+                {
+                        atomic_store(&t->done, true);
+                        fs_jobs_notify();
+                }
+
+                if (now_ms() >= until)
+                {
+                        if (fs_jobs_submit_idle(dir_size_job, w))
+                                return;
+                        until = now_ms() + DIR_SIZE_SLICE_MS;
+                }
+        }
+        atomic_fetch_sub(&w->active, 1);
+        dir_size_release(w);
+}
+
+static bool row_is_subdir(const EntryTable *t, int row)
+{
+        return (t->flags[row] & ENTRY_DIR) && !(t->flags[row] & ENTRY_GONE) && strcmp(entry_name(t, row), "..");
+}
+
+/* Starts walking the directory rows of m from row from on, the ones with a
+ * cached total are filled in right away. */
+static DirSizeWalk *dir_size_walk_start(DirModel *m, int from)
+{
+        const EntryTable *t = dir_rows(m);
+        int count = 0;
+        for (int r = from; r < t->count; r++)
+                if (row_is_subdir(t, r))
+                        count++;
+
+        DirSizeWalk *w = calloc(1, sizeof(DirSizeWalk) + count * sizeof(DirSizeTarget)) orelse return NULL;
+        w->walkers = fs_jobs_count();
+        w->deques = calloc(w->walkers, sizeof(DirSizeDeque));
+        w->by_row = malloc((t->count ? t->count : 1) * sizeof(int));
+        if (!w->deques || !w->by_row)
+        {
+                free(w->deques);
+                free(w->by_row);
+                free(w);
+                return NULL;
+        }
+        for (int i = 0; i < w->walkers; i++)
+                pthread_mutex_init(&w->deques[i].lock, NULL);
+        pthread_mutex_init(&w->seen_lock, NULL);
+        atomic_init(&w->refs, 1);
+        strcpy(w->path, m->path);
+        w->gen = m->gen;
+        w->rows = t->count;
+
+        raw char path[PATH_MAX];
+        int queued = 0;
+        for (int r = 0; r < t->count; r++)
+        {
+                w->by_row[r] = -1;
+                (r >= from && row_is_subdir(t, r)) orelse continue;
+                DirSizeTarget *d = &w->targets[w->count];
+                memcpy(d->name, entry_name(t, r), t->name_len[r] + 1);
+                fs_join(path, m->path, d->name);
+
+                CachedDirSize *c = dir_size_cached(path);
+                if (c && ((t->flags[r] & ENTRY_META_PENDING) || t->mtime[r] == c->mtime))
+                {
+                        c->used = ++dir_size_tick;
+                        for (int k = 0; k < c->kid_count; k++)
+                        {
+                                DirSizeSub *sub = dir_size_add_sub(d, c->kids[k].name) orelse break;
+                                atomic_store(&sub->bytes, atomic_load(&c->kids[k].bytes));
+                                sub->mtime = c->kids[k].mtime;
                         }
-                        pclose(f);
+                        atomic_init(&d->bytes, c->bytes);
+                        atomic_init(&d->done, true);
+                        d->cached = true;
+                        w->by_row[r] = w->count++;
+                        continue;
+                }
+                char *root = strdup(path) orelse continue;
+                atomic_init(&d->pending, 1);
+                if (!dir_size_push(&w->deques[queued % w->walkers], (DirSizeItem){root, w->count, NULL, 0}))
+                {
+                        free(root);
+                        continue;
+                }
+                queued++;
+                w->remaining++;
+                w->by_row[r] = w->count++;
+        }
+
+        for (int i = 0; i < queued && i < w->walkers; i++)
+                dir_size_spawn(w);
+        return w;
+}
+
+static void dir_model_start_sizes(DirModel *m)
+{
+        m->sizes = dir_size_walk_start(m, 0);
+        m->sizes_dirty = false;
+}
+
+/* Rows were added to a listing being walked. New directories get a walk in
+ * front of the running one, which goes on as it is. */
+static void dir_model_extend_sizes(DirModel *m)
+{
+        const EntryTable *t = dir_rows(m);
+        DirSizeWalk *w = m->sizes;
+        bool subdirs = false;
+        for (int r = w->rows; r < t->count && !subdirs; r++)
+                subdirs = row_is_subdir(t, r);
+        if (subdirs)
+        {
+                DirSizeWalk *fresh = dir_size_walk_start(m, w->rows) orelse return;
+                fresh->older = w;
+                m->sizes = fresh;
+                return;
+        }
+        int *by_row = realloc(w->by_row, t->count * sizeof(int)) orelse return;
+        for (int r = w->rows; r < t->count; r++)
+                by_row[r] = -1;
+        w->by_row = by_row;
+        w->rows = t->count;
+}
+
+/* Walks run for listings on screen that show sizes, in a list with Ctrl+U
+ * or as a treemap. */
+static bool dir_model_wants_sizes(const DirModel *m)
+{
+        for (int t = 0; t < tab_count; t++)
+        {
+                const AppTab *tab = tabs[t];
+                if (tab->in_use && tab->shown && tab->app.dir == m && (dir_sizes_on || tab->app.list.mode == UI_MODE_TREEMAP))
+                        return true;
+        }
+        return false;
+}
+
+/* Keeps the totals of the directories that were walked to the end, and of
+ * the ones right inside them so going down a level is instant. */
+static void dir_size_walk_pump(DirSizeWalk *w)
+{
+        (w->remaining > 0) orelse return;
+        raw char path[PATH_MAX], sub_path[PATH_MAX];
+        for (int i = 0; i < w->count; i++)
+        {
+                DirSizeTarget *d = &w->targets[i];
+                (!d->cached && atomic_load(&d->done)) orelse continue;
+                d->cached = true;
+                w->remaining--;
+
+                int kid_count = 0;
+                for (DirSizeSubBlock *b = atomic_load(&d->subs); b; b = b->next)
+                        kid_count += atomic_load(&b->count);
+                DirSizeSub *kids = malloc((kid_count ? kid_count : 1) * sizeof(DirSizeSub));
+                fs_join(path, w->path, d->name);
+                int k = 0;
+                for (DirSizeSubBlock *b = atomic_load(&d->subs); b; b = b->next)
+                {
+                        for (int j = 0; j < atomic_load(&b->count); j++)
+                        {
+                                const DirSizeSub *sub = &b->subs[j];
+                                fs_join(sub_path, path, sub->name);
+                                dir_size_cache_put(sub_path, sub->mtime, atomic_load(&sub->bytes), NULL, 0);
+                                if (kids)
+                                {
+                                        memcpy(kids[k].name, sub->name, sizeof(sub->name));
+                                        atomic_init(&kids[k].bytes, atomic_load(&sub->bytes));
+                                        kids[k++].mtime = sub->mtime;
+                                }
+                        }
+                }
+                dir_size_cache_put(path, d->mtime, atomic_load(&d->bytes), kids, k);
+        }
+}
+
+void dir_model_pump_sizes(DirModel *m)
+{
+        for (DirSizeWalk *w = m->sizes; w; w = w->older)
+                dir_size_walk_pump(w);
+}
+
+void dir_model_cancel_sizes(DirModel *m)
+{
+        while (m->sizes)
+        {
+                DirSizeWalk *w = m->sizes;
+                m->sizes = w->older;
+                atomic_store(&w->cancel, true);
+                dir_size_release(w);
+        }
+}
+
+/* The walk target of a directory row, NULL if it is not being walked. */
+static DirSizeTarget *dir_model_size_target(DirModel *m, uint32_t row)
+{
+        for (DirSizeWalk *w = m->sizes; w && w->gen == m->gen; w = w->older)
+                if (row < (uint32_t)w->rows && w->by_row[row] >= 0)
+                        return &w->targets[w->by_row[row]];
+        return NULL;
+}
+
+/* The total of a directory row so far, meta_pending while it still grows. */
+static void dir_model_fill_size(DirModel *m, uint32_t row, FileEntry *e)
+{
+        DirSizeTarget *d = dir_model_size_target(m, row) orelse return;
+        e->size = atomic_load(&d->bytes);
+        e->meta_pending = !atomic_load(&d->done);
+        e->sized = true;
+}
+
+static void find_release(FindWalk *w)
+{
+        (atomic_fetch_sub(&w->refs, 1) == 1) orelse return;
+        for (int i = 0; i < w->walkers; i++)
+        {
+                DirSizeDeque *q = &w->deques[i];
+                for (int j = q->lo; j < q->hi; j++)
+                        free(q->items[j].path);
+                free(q->items);
+                pthread_mutex_destroy(&q->lock);
+        }
+        free(w->deques);
+        for (int i = 0; i < FIND_MAX_BLOCKS && w->blocks[i]; i++)
+                free(w->blocks[i]);
+        while (w->arena)
+        {
+                FindArena *next = w->arena->next;
+                free(w->arena);
+                w->arena = next;
+        }
+        for (int i = 0; i < w->ignored_count; i++)
+                free(w->ignored[i]);
+        free(w->ignored);
+        if (w->load)
+                dir_load_release(w->load);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+}
+
+static inline FindEntry *find_entry(FindWalk *w, uint32_t i)
+{
+        return &w->blocks[i / FIND_BLOCK][i % FIND_BLOCK];
+}
+
+static int cmp_find_paths(const void *a, const void *b)
+{
+        return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* What git ignores below the root, relative to it and sorted. Directories
+ * come without their trailing slash. */
+static void find_load_ignored(FindWalk *w)
+{
+        (fs_vfs == &fs_posix) orelse return;
+        pid_t pid;
+        char *argv[] = {"git", "-C", w->root, "ls-files", "-z", "--others", "--ignored", "--exclude-standard", "--directory", NULL};
+        FILE *f = fs_popen(argv, &pid) orelse return;
+        char *line = NULL;
+        size_t line_cap = 0;
+        int cap = 0;
+        while (!atomic_load(&w->cancel) && getdelim(&line, &line_cap, '\0', f) > 0)
+        {
+                size_t len = strlen(line);
+                if (len > 0 && line[len - 1] == '/')
+                        line[--len] = '\0';
+                (len > 0) orelse continue;
+                if (w->ignored_count == cap)
+                {
+                        cap = cap ? cap * 2 : 64;
+                        char **grown = realloc(w->ignored, cap * sizeof(char *)) orelse break;
+                        w->ignored = grown;
+                }
+                w->ignored[w->ignored_count] = strdup(line) orelse break;
+                w->ignored_count++;
+        }
+        free(line);
+        fs_pclose(f, pid);
+        qsort(w->ignored, w->ignored_count, sizeof(char *), cmp_find_paths);
+}
+
+static void find_job(void *arg);
+
+static void find_spawn(FindWalk *w)
+{
+        int n = atomic_load(&w->active);
+        while (n < w->walkers && !atomic_compare_exchange_weak(&w->active, &n, n + 1))
+                ;
+        (n < w->walkers) orelse return;
+        atomic_fetch_add(&w->refs, 1);
+        if (!fs_jobs_submit_idle(find_job, w))
+        {
+                atomic_fetch_sub(&w->active, 1);
+                atomic_fetch_sub(&w->refs, 1);
+        }
+}
+
+static const char *find_intern(FindWalk *w, const char *s, size_t len)
+{
+        if (!w->arena || w->arena->used + len + 1 > FIND_ARENA_BYTES)
+        {
+                FindArena *a = malloc(sizeof(FindArena)) orelse return NULL;
+                a->next = w->arena;
+                a->used = 0;
+                w->arena = a;
+        }
+        char *p = w->arena->data + w->arena->used;
+        memcpy(p, s, len);
+        p[len] = '\0';
+        w->arena->used += len + 1;
+        return p;
+}
+
+static bool find_cancelled(FindWalk *w)
+{
+        return atomic_load(&w->cancel) || (w->load && atomic_load(&w->load->cancel));
+}
+
+/* Queues the subdirectory name of item on the walker's own deque. */
+static bool find_push_dir(FindWalk *w, int self, const DirSizeItem *item, const char *name, int name_len)
+{
+        size_t dir_len = strlen(item->path);
+        char *sub = malloc(dir_len + name_len + 2) orelse return false;
+        memcpy(sub, item->path, dir_len);
+        sub[dir_len] = '/';
+        memcpy(sub + dir_len + 1, name, name_len + 1);
+        atomic_fetch_add(&w->pending, 1);
+        (dir_size_push(&w->deques[self], (DirSizeItem){sub, 0, NULL, item->depth + 1})) orelse
+        {
+                free(sub);
+                atomic_fetch_sub(&w->pending, 1);
+                return false;
+        };
+        return true;
+}
+
+/* Publishes one chunk of a directory's entries and queues its subdirectories. */
+static void find_add_chunk(FindWalk *w, int self, const DirSizeItem *item, const char *rel, EntryTable *chunk)
+{
+        size_t rel_len = strlen(rel);
+        raw char path[PATH_MAX];
+        memcpy(path, rel, rel_len);
+        if (rel_len)
+                path[rel_len++] = '/';
+        bool pushed = false;
+
+        pthread_mutex_lock(&w->lock);
+        uint32_t n = atomic_load(&w->count);
+        for (int r = 0; r < chunk->count; r++)
+        {
+                size_t len = rel_len + chunk->name_len[r];
+                (len < PATH_MAX && n < FIND_MAX_BLOCKS * FIND_BLOCK) orelse continue;
+                memcpy(path + rel_len, entry_name(chunk, r), chunk->name_len[r] + 1);
+                if (w->ignored_count && bsearch(&(const char *){path}, w->ignored, w->ignored_count, sizeof(char *), cmp_find_paths))
+                        continue;
+                if (!w->blocks[n / FIND_BLOCK])
+                        w->blocks[n / FIND_BLOCK] = malloc(FIND_BLOCK * sizeof(FindEntry)) orelse break;
+                const char *interned = find_intern(w, path, len) orelse break;
+                bool is_dir = chunk->flags[r] & ENTRY_DIR;
+                *find_entry(w, n++) = (FindEntry){interned, (uint16_t)len, (uint16_t)rel_len, is_dir};
+                if (is_dir)
+                        pushed |= find_push_dir(w, self, item, entry_name(chunk, r), chunk->name_len[r]);
+        }
+        atomic_store(&w->count, n);
+        pthread_mutex_unlock(&w->lock);
+        entries_clear(chunk);
+        if (pushed)
+                find_spawn(w);
+}
+
+static bool grep_compile(GrepPattern *p, const char *query)
+{
+        *p = (GrepPattern){0};
+        p->at_start = query[0] == '^';
+        query += p->at_start;
+        size_t len = strlen(query);
+        p->at_end = len > 0 && query[len - 1] == '$';
+        len -= p->at_end;
+        (len > 0 && len < sizeof(p->needle)) orelse return false;
+        memcpy(p->needle, query, len);
+        p->len = (int)len;
+        p->fold = true;
+        for (int i = 0; i < p->len; i++)
+                if (isupper((unsigned char)p->needle[i]))
+                        p->fold = false;
+        unsigned char f = p->needle[0], l = p->needle[p->len - 1];
+        p->first[0] = p->first[1] = f;
+        p->last[0] = p->last[1] = l;
+        if (p->fold)
+        {
+                p->first[1] = toupper(f);
+                p->last[1] = toupper(l);
+        }
+        return true;
+}
+
+static inline bool grep_equal(const GrepPattern *p, const char *at)
+{
+        if (!p->fold)
+                return !memcmp(at, p->needle, p->len);
+        for (int i = 0; i < p->len; i++)
+                if (tolower((unsigned char)at[i]) != p->needle[i])
+                        return false;
+        return true;
+}
+
+/* Where the needle first shows up at or after from, -1 if nowhere. 16 bytes
+ * at a time are tested for the needle's first byte and, len - 1 further on,
+ * its last one. Only where both line up are the bytes between compared. */
+static ssize_t grep_find(const GrepPattern *p, const char *hay, size_t n, size_t from)
+{
+        size_t k = p->len - 1, i = from;
+        (n >= (size_t)p->len) orelse return -1;
+#if defined(__SSE2__)
+        __m128i f0 = _mm_set1_epi8((char)p->first[0]), f1 = _mm_set1_epi8((char)p->first[1]);
+        __m128i l0 = _mm_set1_epi8((char)p->last[0]), l1 = _mm_set1_epi8((char)p->last[1]);
+        for (; i + k + 16 <= n; i += 16)
+        {
+                __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+                __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + k));
+                __m128i hit = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1)),
+                                            _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1)));
+                for (unsigned mask = (unsigned)_mm_movemask_epi8(hit); mask; mask &= mask - 1)
+                {
+                        size_t at = i + __builtin_ctz(mask);
+                        if (grep_equal(p, hay + at))
+                                return (ssize_t)at;
+                }
+        }
+#elif defined(__ARM_NEON)
+        uint8x16_t f0 = vdupq_n_u8(p->first[0]), f1 = vdupq_n_u8(p->first[1]);
+        uint8x16_t l0 = vdupq_n_u8(p->last[0]), l1 = vdupq_n_u8(p->last[1]);
+        for (; i + k + 16 <= n; i += 16)
+        {
+                uint8x16_t a = vld1q_u8((const uint8_t *)hay + i), b = vld1q_u8((const uint8_t *)hay + i + k);
+                uint8x16_t hit = vandq_u8(vorrq_u8(vceqq_u8(a, f0), vceqq_u8(a, f1)), vorrq_u8(vceqq_u8(b, l0), vceqq_u8(b, l1)));
+                /* Four bits per byte as there is no movemask, one kept. */
+                uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0) & 0x8888888888888888ull;
+                for (; mask; mask &= mask - 1)
+                {
+                        size_t at = i + __builtin_ctzll(mask) / 4;
+                        if (grep_equal(p, hay + at))
+                                return (ssize_t)at;
+                }
+        }
+#endif
+        for (; i + k < n; i++)
+        {
+                unsigned char c = hay[i], e = hay[i + k];
+                if ((c == p->first[0] || c == p->first[1]) && (e == p->last[0] || e == p->last[1]) && grep_equal(p, hay + i))
+                        return (ssize_t)i;
+        }
+        return -1;
+}
+
+/* Whether data holds the pattern. head and tail tell whether data starts and
+ * ends where the file does. A match against the end of a block is left to the
+ * next one, which starts with the last p->len + 1 bytes of this one, and one
+ * at its very start was looked at already. */
+static bool grep_match(const GrepPattern *p, const char *data, size_t n, bool head, bool tail)
+{
+        for (ssize_t at = 0; (at = grep_find(p, data, n, at)) >= 0; at++)
+        {
+                size_t end = at + p->len;
+                if ((at == 0 && !head) || (end == n && !tail))
+                        continue;
+                if (p->at_start && at > 0 && data[at - 1] != '\n')
+                        continue;
+                if (p->at_end && end < n && data[end] != '\n' && data[end] != '\r')
+                        continue;
+                return true;
+        }
+        return false;
+}
+
+#define GREP_BLOCK (1 << 20)
+#define GREP_PROBE 8192
+
+/* Whether the file at path holds the pattern, st gets its metadata. It is
+ * read in blocks of up to GREP_BLOCK into buf as far as its size went when
+ * opened, a file that shrinks meanwhile just ends early. A NUL byte in the first GREP_PROBE bytes marks a binary,
+ * which is left out. The open does not wait for a writer, so a FIFO reached
+ * through a link is passed over too. */
+static bool grep_file(const GrepPattern *p, const char *path, struct stat *st, char **buf, size_t *cap)
+{
+        int fd = fs_vfs->open_file(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC, 0);
+        (fd >= 0) orelse return false;
+        defer fs_vfs->close(fd);
+        (fs_vfs->fstat(fd, st) == 0 && S_ISREG(st->st_mode) && st->st_size >= p->len) orelse return false;
+        size_t block = st->st_size < GREP_BLOCK ? (size_t)st->st_size : GREP_BLOCK;
+        size_t need = block + p->len + 1;
+        if (*cap < need)
+        {
+                char *grown = realloc(*buf, need) orelse return false;
+                *buf = grown;
+                *cap = need;
+        }
+
+        size_t keep = 0, total = 0;
+        for (bool head = true;; head = false)
+        {
+                size_t got = keep;
+                while (got < keep + block)
+                {
+                        ssize_t n = fs_vfs->read(fd, *buf + got, keep + block - got);
+                        (n > 0) orelse break;
+                        got += n;
+                }
+                total += got - keep;
+                bool tail = got < keep + block || total >= (size_t)st->st_size;
+                if (head && memchr(*buf, 0, got < GREP_PROBE ? got : GREP_PROBE))
+                        return false;
+                if (grep_match(p, *buf, got, head, tail))
+                        return true;
+                (!tail) orelse return false;
+                keep = p->len + 1 < got ? p->len + 1 : got;
+                memmove(*buf, *buf + got - keep, keep);
+        }
+}
+
+/* The content search side of a walk: files of the chunk that hold the
+ * pattern go to the load as paths relative to the root. */
+static void grep_chunk(FindWalk *w, int self, const DirSizeItem *item, const char *rel, EntryTable *chunk, FindScratch *sc)
+{
+        size_t rel_len = strlen(rel), dir_len = strlen(item->path);
+        raw char path[PATH_MAX], full[PATH_MAX];
+        memcpy(path, rel, rel_len);
+        if (rel_len)
+                path[rel_len++] = '/';
+        memcpy(full, item->path, dir_len);
+        full[dir_len++] = '/';
+        bool pushed = false;
+
+        for (int r = 0; r < chunk->count && !find_cancelled(w); r++)
+        {
+                const char *name = entry_name(chunk, r);
+                (rel_len + chunk->name_len[r] < PATH_MAX && dir_len + chunk->name_len[r] < PATH_MAX) orelse continue;
+                memcpy(path + rel_len, name, chunk->name_len[r] + 1);
+                if (w->ignored_count && bsearch(&(const char *){path}, w->ignored, w->ignored_count, sizeof(char *), cmp_find_paths))
+                        continue;
+                if (chunk->flags[r] & ENTRY_DIR)
+                {
+                        pushed |= find_push_dir(w, self, item, name, chunk->name_len[r]);
+                        continue;
+                }
+                memcpy(full + dir_len, name, chunk->name_len[r] + 1);
+                raw struct stat st;
+                (grep_file(&w->pat, full, &st, &sc->buf, &sc->cap)) orelse continue;
+                entries_add(&sc->found, path, (int)(rel_len + chunk->name_len[r]), (st.st_mode & S_IXUSR) ? ENTRY_EXEC : 0, st.st_size, st.st_mtime);
+        }
+        if (sc->found.count > 0)
+        {
+                dir_load_push(w->load, &sc->found);
+                entries_clear(&sc->found);
+        }
+        entries_clear(chunk);
+        if (pushed)
+                find_spawn(w);
+}
+
+static void find_visit(FindWalk *w, int self, const DirSizeItem *item, FindScratch *sc)
+{
+        int dfd = fs_open_dir(item->path);
+        (dfd >= 0) orelse return;
+        defer fs_vfs->close(dfd);
+        raw FsDirIter it;
+        (fs_dir_begin(&it, dfd)) orelse return;
+        defer fs_dir_end(&it);
+
+        const char *rel = item->path + strlen(w->root);
+        while (*rel == '/')
+                rel++;
+        EntryTable *chunk = &sc->chunk;
+        const char *name;
+        unsigned char type;
+        while (!find_cancelled(w) && fs_dir_next(&it, &name, &type))
+        {
+                (strcmp(name, "..") && (!w->skip || name[0] != '.')) orelse continue;
+                raw struct stat st;
+                if (type == DT_UNKNOWN && fs_vfs->fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                        type = IFTODT(st.st_mode);
+                /* A search only opens what can be a file, a FIFO or device
+                 * would hold up the worker. */
+                if (w->load && type != DT_DIR && type != DT_REG && type != DT_LNK && type != DT_UNKNOWN)
+                        continue;
+                entries_add(chunk, name, (int)strlen(name), type == DT_DIR ? ENTRY_DIR : 0, 0, 0);
+                if (chunk->count < DIR_LOAD_CHUNK)
+                        continue;
+                if (w->load)
+                        grep_chunk(w, self, item, rel, chunk, sc);
+                else
+                        find_add_chunk(w, self, item, rel, chunk);
+        }
+        if (chunk->count > 0 && w->load)
+                grep_chunk(w, self, item, rel, chunk, sc);
+        else if (chunk->count > 0)
+                find_add_chunk(w, self, item, rel, chunk);
+
+        long long now = now_ms(), last = atomic_load(&w->notified);
+        if (now - last >= DIR_SIZE_NOTIFY_MS && atomic_compare_exchange_strong(&w->notified, &last, now))
+                fs_jobs_notify();
+}
+
+/* One walker of a find, run like dir_size_job(). The first one in reads what
+ * git ignores before anything else is queued. The last directory read ends a
+ * content search's load. */
+static void find_job(void *arg)
+{
+        FindWalk *w = arg;
+        int self = atomic_fetch_add(&w->next_deque, 1) % w->walkers;
+        if (!atomic_exchange(&w->started, true) && w->skip)
+                find_load_ignored(w);
+        FindScratch sc = {0};
+        defer
+        {
+                entries_free(&sc.chunk);
+                entries_free(&sc.found);
+                free(sc.buf);
+        }
+
+        long long until = now_ms() + DIR_SIZE_SLICE_MS;
+        raw DirSizeItem item;
+        while (!find_cancelled(w))
+        {
+                bool got = dir_size_take(&w->deques[self], false, &item);
+                for (int i = 1; !got && i < w->walkers; i++)
+                        got = dir_size_take(&w->deques[(self + i) % w->walkers], true, &item);
+                (got) orelse break;
+
+                find_visit(w, self, &item, &sc);
+                free(item.path);
+                if (atomic_fetch_sub(&w->pending, 1) == 1)
+                {
+                        atomic_store(&w->done, true);
+                        if (w->load)
+                        {
+                                pthread_mutex_lock(&w->load->lock);
+                                w->load->listed = w->load->done = true;
+                                pthread_mutex_unlock(&w->load->lock);
+                        }
+                        fs_jobs_notify();
+                }
+
+                if (now_ms() >= until)
+                {
+                        if (fs_jobs_submit_idle(find_job, w))
+                                return;
+                        until = now_ms() + DIR_SIZE_SLICE_MS;
+                }
+        }
+        atomic_fetch_sub(&w->active, 1);
+        find_release(w);
+}
+
+/* Walks everything below root. With a load, the walk is a content search for
+ * pat that takes over the caller's reference to it. */
+static FindWalk *find_start(const char *root, bool skip, DirLoad *load, const GrepPattern *pat)
+{
+        FindWalk *w = calloc(1, sizeof(FindWalk)) orelse return NULL;
+        w->walkers = fs_jobs_count();
+        w->deques = calloc(w->walkers, sizeof(DirSizeDeque));
+        char *path = strdup(root);
+        if (!w->deques || !path)
+        {
+                free(w->deques);
+                free(path);
+                free(w);
+                return NULL;
+        }
+        for (int i = 0; i < w->walkers; i++)
+                pthread_mutex_init(&w->deques[i].lock, NULL);
+        pthread_mutex_init(&w->lock, NULL);
+        atomic_init(&w->refs, 1);
+        atomic_init(&w->pending, 1);
+        snprintf(w->root, sizeof(w->root), "%s", root);
+        w->skip = skip;
+        w->load = load;
+        if (pat)
+                w->pat = *pat;
+        dir_size_push(&w->deques[0], (DirSizeItem){path, 0, NULL, 0});
+        find_spawn(w);
+        return w;
+}
+
+static inline char find_fold(char c, bool fold)
+{
+        return fold && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/* Fuzzy score of a path, INT_MIN unless the whole query shows up in it in
+ * order. The shortest stretch that holds the query is scored: hits right
+ * after a separator or at a case change count more, so do runs and hits in
+ * the last component, gaps count against it. marks, when given, gets the
+ * bytes that were hit. */
+static int find_score(const char *needle, bool fold, const FindEntry *e, bool *marks)
+{
+        int qlen = (int)strlen(needle);
+        (qlen > 0) orelse return 0;
+        const char *p = e->path;
+        int end = -1;
+        for (int i = 0, q = 0; i < e->len; i++)
+        {
+                if (find_fold(p[i], fold) == needle[q] && ++q == qlen)
+                {
+                        end = i;
+                        break;
+                }
+        }
+        (end >= 0) orelse return INT_MIN;
+        int start = end;
+        for (int q = qlen - 1; start > 0; start--)
+                if (find_fold(p[start], fold) == needle[q] && --q < 0)
+                        break;
+
+        int score = 0, last = -1;
+        for (int i = start, q = 0; q < qlen && i <= end; i++)
+        {
+                (find_fold(p[i], fold) == needle[q]) orelse continue;
+                char prev = i > 0 ? p[i - 1] : '/';
+                score += 16;
+                if (prev == '/')
+                        score += 10;
+                else if (prev == '_' || prev == '-' || prev == '.' || prev == ' ')
+                        score += 8;
+                else if (islower((unsigned char)prev) && isupper((unsigned char)p[i]))
+                        score += 7;
+                if (last >= 0)
+                        score += last == i - 1 ? 6 : -(i - last - 1 < 8 ? i - last - 1 : 8);
+                if (i >= e->name)
+                        score += 2;
+                if (marks)
+                        marks[i] = true;
+                last = i;
+                q++;
+        }
+        return score;
+}
+
+static bool find_better(const FindHit *a, const FindHit *b)
+{
+        if (a->score != b->score)
+                return a->score > b->score;
+        if (a->len != b->len)
+                return a->len < b->len;
+        return a->entry < b->entry;
+}
+
+static int cmp_find_hits(const void *a, const void *b)
+{
+        return find_better(a, b) ? -1 : find_better(b, a);
+}
+
+static void finder_offer(Finder *f, FindHit hit)
+{
+        FindHit *h = f->heap;
+        int i;
+        if (f->heap_count < FIND_TOP)
+        {
+                for (i = f->heap_count++; i > 0 && find_better(&h[(i - 1) / 2], &hit); i = (i - 1) / 2)
+                        h[i] = h[(i - 1) / 2];
+        }
+        else
+        {
+                (find_better(&hit, &h[0])) orelse return;
+                for (i = 0;;)
+                {
+                        int c = i * 2 + 1;
+                        (c < FIND_TOP) orelse break;
+                        if (c + 1 < FIND_TOP && find_better(&h[c], &h[c + 1]))
+                                c++;
+                        (find_better(&hit, &h[c])) orelse break;
+                        h[i] = h[c];
+                        i = c;
+                }
+        }
+        h[i] = hit;
+        f->heap_dirty = true;
+}
+
+static bool finder_consider(Finder *f, uint32_t entry)
+{
+        const FindEntry *e = find_entry(f->walk, entry);
+        int score = f->needle[0] ? find_score(f->needle, f->fold, e, NULL) : 0;
+        (score != INT_MIN) orelse return false;
+        finder_offer(f, (FindHit){entry, score, e->len});
+        return true;
+}
+
+/* Catches the ranking up with the query and the walk, for at most
+ * FIND_RANK_MS so typing never waits on it. */
+static void finder_rank(Finder *f)
+{
+        if (strcmp(f->query, f->ranked))
+        {
+                size_t had = strlen(f->ranked);
+                if (!strncmp(f->query, f->ranked, had))
+                {
+                        /* Matches not filtered yet move up behind the kept
+                         * ones, all of them are filtered again. */
+                        int rest = f->refilter_end - f->refilter;
+                        memmove(f->matches + f->kept, f->matches + f->refilter, rest * sizeof(uint32_t));
+                        f->refilter_end = f->refilter_end ? f->kept + rest : f->match_count;
+                }
+                else
+                {
+                        f->match_count = f->scanned = 0;
+                        f->refilter_end = 0;
+                }
+                f->refilter = f->kept = 0;
+                f->heap_count = 0;
+                f->heap_dirty = true;
+                strcpy(f->ranked, f->query);
+                f->fold = true;
+                for (int i = 0; f->query[i]; i++)
+                        if (isupper((unsigned char)f->query[i]))
+                                f->fold = false;
+                for (int i = 0; i < (int)sizeof(f->needle); i++)
+                        if (!(f->needle[i] = find_fold(f->query[i], f->fold)))
+                                break;
+        }
+
+        long long until = now_ms() + FIND_RANK_MS;
+        int budget = 0;
+        while (f->refilter < f->refilter_end)
+        {
+                if (++budget % 1024 == 0 && now_ms() >= until)
+                        return;
+                uint32_t entry = f->matches[f->refilter++];
+                if (finder_consider(f, entry))
+                        f->matches[f->kept++] = entry;
+        }
+        if (f->refilter_end)
+        {
+                f->match_count = f->kept;
+                f->refilter = f->refilter_end = f->kept = 0;
+        }
+
+        int count = atomic_load(&f->walk->count);
+        while (f->scanned < count)
+        {
+                if (++budget % 1024 == 0 && now_ms() >= until)
+                        return;
+                if (f->match_count == f->match_cap)
+                {
+                        int cap = f->match_cap ? f->match_cap * 2 : 4096;
+                        uint32_t *grown = realloc(f->matches, cap * sizeof(uint32_t)) orelse return;
+                        f->matches = grown;
+                        f->match_cap = cap;
+                }
+                uint32_t entry = f->scanned++;
+                if (finder_consider(f, entry))
+                        f->matches[f->match_count++] = entry;
+        }
+}
+
+static bool finder_busy(const Finder *f)
+{
+        return strcmp(f->query, f->ranked) || f->refilter < f->refilter_end || f->scanned < atomic_load(&f->walk->count);
+}
+
+static void finder_close(AppState *app)
+{
+        Finder *f = app->find;
+        (f) orelse return;
+        atomic_store(&f->walk->cancel, true);
+        find_release(f->walk);
+        free(f->matches);
+        free(f->list.selections);
+        free(f->list.active_box_selections);
+        free(f);
+        app->find = NULL;
+}
+
+/* Starts over below the tab's directory, keeping the query. */
+static void finder_restart(Finder *f, const char *root)
+{
+        FindWalk *w = find_start(root, find_skip, NULL, NULL) orelse return;
+        if (f->walk)
+        {
+                atomic_store(&f->walk->cancel, true);
+                find_release(f->walk);
+        }
+        f->walk = w;
+        f->ranked[0] = '\0';
+        f->match_count = f->scanned = 0;
+        f->refilter = f->refilter_end = f->kept = 0;
+        f->heap_count = f->shown_count = 0;
+        f->heap_dirty = true;
+        f->list.selected_idx = 0;
+        f->list.target_scroll = f->list.current_scroll = 0;
+}
+
+static void finder_open(AppState *app)
+{
+        (!app->find) orelse return;
+        Finder *f = calloc(1, sizeof(Finder)) orelse return;
+        f->list.mode = UI_MODE_LIST;
+        finder_restart(f, app->cwd);
+        if (!f->walk)
+        {
+                free(f);
+                return;
+        }
+        app->find = f;
+}
+
+static bool app_reserve_order(AppState *app, int count)
+{
+        if (count <= app->order_cap)
+                return true;
+        int cap = app->order_cap ? app->order_cap : 256;
+        while (cap < count)
+                cap *= 2;
+        uint32_t *grown = realloc(app->order, cap * sizeof(uint32_t)) orelse return false;
+        app->order = grown;
+        app->order_cap = cap;
+        return true;
+}
+
+static void app_add_dot_dot(AppState *app)
+{
+        (app_reserve_order(app, app->count + 1)) orelse return;
+        EntryTable *t = dir_rows_mut(app->dir) orelse return;
+        int row = entries_add(t, "..", 2, ENTRY_DIR, 0, 0);
+        (row >= 0) orelse return;
+        app->order[app->count++] = (uint32_t)row;
+}
+
+/* Marks the rows of [from, to) whose name holds p in hit. The names arena is
+ * searched in one pass, a hit is then matched to its row by walking the row
+ * offsets along with it. */
+static void filter_scan(const EntryTable *t, const GrepPattern *p, int from, int to, uint8_t *hit)
+{
+        memset(hit, 0, to - from);
+        (from < to) orelse return;
+        size_t end = to < t->count ? t->name_off[to] : t->names_len;
+        int row = from;
+        for (ssize_t at = t->name_off[from]; (at = grep_find(p, t->names, end, at)) >= 0;)
+        {
+                while (row + 1 < to && t->name_off[row + 1] <= (size_t)at)
+                        row++;
+                size_t off = t->name_off[row];
+                bool ok = (!p->at_start || (size_t)at == off) && (!p->at_end || (size_t)at + p->len == off + t->name_len[row]);
+                if (!ok)
+                {
+                        at++;
+                        continue;
+                }
+                hit[row - from] = 1;
+                (row + 1 < to) orelse break;
+                at = t->name_off[++row];
+        }
+}
+
+/* Fills idx with the rows of [base, base + n) that are still there and pass
+ * the filter, returns how many did. */
+static int app_filter_take(const AppState *app, uint32_t base, int n, uint32_t *idx)
+{
+        const EntryTable *t = dir_rows(app->dir);
+        uint8_t *hit = NULL;
+        defer free(hit);
+        if (app->filter[0] && app->filter_narrow)
+        {
+                hit = malloc(n) orelse return 0;
+                filter_scan(t, &app->filter_pat, base, base + n, hit);
+        }
+        int k = 0;
+        for (int r = 0; r < n; r++)
+        {
+                (!(t->flags[base + r] & ENTRY_GONE)) orelse continue;
+                if (!hit || hit[r] || !strcmp(entry_name(t, base + r), ".."))
+                        idx[k++] = base + r;
+        }
+        return k;
+}
+
+/* Merges rows [base, base + n) of the directory into the sorted display order
+ * with one backwards pass, keeping the selection bitmap and cursor on the same
+ * entries. */
+static void app_merge_rows(AppState *app, uint32_t base, int n)
+{
+        (n > 0 && app_reserve_order(app, app->count + n)) orelse return;
+        uint32_t *idx = malloc(n * sizeof(uint32_t)) orelse return;
+        defer free(idx);
+
+        const EntryTable *t = dir_rows(app->dir);
+        n = app_filter_take(app, base, n, idx);
+        (n > 0) orelse return;
+        entries_sort(t, app->sort, idx, n);
+
+        UIListState *s = &app->list;
+        ui_list_reserve(s, app->count + n);
+
+        int i = app->count - 1, j = n - 1, k = app->count + n - 1;
+        int sel = s->selected_idx;
+        while (j >= 0)
+        {
+                if (i >= 0 && entries_cmp_mode(t, app->sort, app->order[i], idx[j]) > 0)
+                {
+                        app->order[k] = app->order[i];
+                        s->selections[k] = s->selections[i];
+                        if (s->selected_idx == i)
+                                sel = k;
+                        i--;
+                }
+                else
+                {
+                        app->order[k] = idx[j--];
+                        s->selections[k] = false;
+                }
+                k--;
+        }
+        s->selected_idx = sel;
+        app->count += n;
+}
+
+/* Streams a batch into the directory and the display order of every tab
+ * showing it. */
+static void dir_model_append(DirModel *m, const EntryTable *add)
+{
+        EntryTable *t = dir_rows_mut(m) orelse return;
+        uint32_t base = (uint32_t)t->count;
+        (add->count > 0 && entries_append(t, add)) orelse return;
+        for (int v = 0; v < tab_count; v++)
+                if (tabs[v]->in_use && tabs[v]->app.dir == m)
+                        app_merge_rows(&tabs[v]->app, base, add->count);
+}
+
+/* Brings the display order into app->sort order, copied from cached when
+ * given. Selections and the cursor follow their rows. */
+static void app_reorder(AppState *app, const uint32_t *cached)
+{
+        UIListState *s = &app->list;
+        int n = app->count;
+        const EntryTable *t = dir_rows(app->dir);
+
+        bool *row_sel = calloc(t->count + 1, sizeof(bool));
+        int sel_row = (s->selected_idx >= 0 && s->selected_idx < n) ? (int)app->order[s->selected_idx] : -1;
+        for (int i = 0; i < n && row_sel; i++)
+                row_sel[app->order[i]] = s->selections[i];
+
+        if (cached)
+                memcpy(app->order, cached, n * sizeof(uint32_t));
+        else
+                entries_sort(t, app->sort, app->order, n);
+
+        /* The order the filter narrows down from is in the old sort. */
+        free(app->filter_base);
+        app->filter_base = NULL;
+
+        for (int i = 0; i < n; i++)
+        {
+                uint32_t row = app->order[i];
+                s->selections[i] = row_sel && row_sel[row];
+                if ((int)row == sel_row)
+                        s->selected_idx = i;
+        }
+        free(row_sel);
+}
+
+static void app_drop_sort_cache(AppState *app)
+{
+        for (int m = 0; m < SORT_COUNT; m++)
+                app->sort_cache[m].count = -1;
+}
+
+/* Rows that only have d_type info sort as empty and old, reload with a full
+ * stat to get them in place when the tab sorts by size or date. */
+static void app_check_sort_meta(AppState *app)
+{
+        (app_needs_meta(app)) orelse return;
+        const EntryTable *t = dir_rows(app->dir);
+        for (int i = 0; i < app->count; i++)
+        {
+                if (t->flags[app->order[i]] & ENTRY_META_PENDING)
+                {
+                        strcpy(app->next_dir, ".");
+                        return;
+                }
+        }
+}
+
+/* Switches the display order to mode, reusing the order from the last time
+ * mode was active when the listing has not changed since. */
+void app_set_sort(AppState *app, SortMode mode)
+{
+        (mode != app->sort && app->dir) orelse return;
+        int n = app->count;
+
+        SortCache *old = &app->sort_cache[app->sort];
+        uint32_t *saved = realloc(old->order, (n ? n : 1) * sizeof(uint32_t));
+        if (saved)
+        {
+                memcpy(saved, app->order, n * sizeof(uint32_t));
+                old->order = saved;
+                old->count = n;
+                old->gen = app->dir->gen;
+        }
+        else
+                old->count = -1;
+
+        app->sort = mode;
+        SortCache *c = &app->sort_cache[mode];
+        app_reorder(app, (c->order && c->count == n && c->gen == app->dir->gen) ? c->order : NULL);
+        app_check_sort_meta(app);
+}
+
+/* Brings the display order in line with filter_query. Every change starts
+ * over from filter_base, taken from the order the first time and sorted
+ * afresh only when the sort changed since. Selections and the cursor stay on
+ * their rows while those are shown. */
+static void app_filter_apply(AppState *app)
+{
+        (app->dir && strcmp(app->filter, app->filter_query)) orelse return;
+        const EntryTable *t = dir_rows(app->dir);
+        UIListState *s = &app->list;
+        int n = app->count;
+
+        if (!app->filter_base)
+        {
+                uint32_t *base = malloc((t->count ? t->count : 1) * sizeof(uint32_t)) orelse return;
+                int k = 0;
+                if (!app->filter[0])
+                {
+                        memcpy(base, app->order, n * sizeof(uint32_t));
+                        k = n;
+                }
+                else
+                {
+                        for (int r = 0; r < t->count; r++)
+                                if (!(t->flags[r] & ENTRY_GONE))
+                                        base[k++] = (uint32_t)r;
+                        entries_sort(t, app->sort, base, k);
+                }
+                app->filter_base = base;
+                app->filter_base_count = k;
+                app->filter_rows = t->count;
+        }
+        (app_reserve_order(app, app->filter_base_count)) orelse return;
+        uint8_t *hit = malloc(app->filter_rows + 1) orelse return;
+        defer free(hit);
+
+        /* Selections are carried over by row, when there are any. */
+        bool *row_sel = NULL;
+        defer free(row_sel);
+        if (n > 0 && memchr(s->selections, true, n))
+        {
+                row_sel = calloc(t->count + 1, sizeof(bool)) orelse return;
+                for (int i = 0; i < n; i++)
+                        row_sel[app->order[i]] = s->selections[i];
+        }
+        int sel_row = (s->selected_idx >= 0 && s->selected_idx < n) ? (int)app->order[s->selected_idx] : -1;
+
+        strcpy(app->filter, app->filter_query);
+        app->filter_narrow = app->filter[0] && grep_compile(&app->filter_pat, app->filter);
+        if (app->filter_narrow)
+                filter_scan(t, &app->filter_pat, 0, app->filter_rows, hit);
+
+        int k = 0;
+        for (int i = 0; i < app->filter_base_count; i++)
+        {
+                uint32_t row = app->filter_base[i];
+                (!(t->flags[row] & ENTRY_GONE)) orelse continue;
+                if (!app->filter_narrow || hit[row] || !strcmp(entry_name(t, row), ".."))
+                        app->order[k++] = row;
+        }
+        app->count = k;
+        ui_list_reserve(s, k);
+        app_merge_rows(app, app->filter_rows, t->count - app->filter_rows);
+
+        s->selected_idx = -1;
+        for (int i = 0; i < app->count; i++)
+        {
+                uint32_t row = app->order[i];
+                s->selections[i] = row_sel && row_sel[row];
+                if ((int)row == sel_row)
+                        s->selected_idx = i;
+        }
+        if (s->selected_idx < 0)
+                s->selected_idx = app->count > 1 && !strcmp(app_name(app, 0), "..") ? 1 : 0;
+
+        if (!app->filter[0])
+        {
+                free(app->filter_base);
+                app->filter_base = NULL;
+        }
+        app_drop_sort_cache(app);
+        app->last_hovered_idx = -1;
+}
+
+/* Closes the filter bar with the whole listing back in view. */
+static void app_filter_clear(AppState *app)
+{
+        app->filter_open = false;
+        app->filter_query[0] = '\0';
+        app_filter_apply(app);
+        free(app->filter_base);
+        app->filter_base = NULL;
+        app->filter[0] = '\0';
+}
+
+/* A tab's share of a refresh: removed rows leave its display order and added
+ * rows [base, base + n) are merged in. Selections and the cursor stay on their
+ * rows throughout. */
+static void app_apply_diff(AppState *app, DirLoad *ld, uint32_t base, int n)
+{
+        const EntryTable *t = dir_rows(app->dir);
+        UIListState *s = &app->list;
+
+        if (ld->removed_count > 0)
+        {
+                int k = 0, sel = -1;
+                for (int i = 0; i < app->count; i++)
+                {
+                        if (i == s->selected_idx)
+                                sel = k;
+                        if (t->flags[app->order[i]] & ENTRY_GONE)
+                                continue;
+                        app->order[k] = app->order[i];
+                        s->selections[k] = s->selections[i];
+                        k++;
+                }
+                app->count = k;
+                s->selected_idx = (sel >= k) ? k - 1 : sel;
+                app->last_hovered_idx = -1;
+        }
+
+        app_merge_rows(app, base, n);
+        app_drop_sort_cache(app);
+        if (ld->changed_count > 0 && sort_needs_meta(app->sort))
+                app_reorder(app, NULL);
+
+        /* Things that were just dropped or pasted here come up selected. */
+        if (app->list.drop_anim > 0.0f && app->drop_count > 0)
+        {
+                for (int i = 0; i < app->count; i++)
+                {
+                        (app->order[i] >= base) orelse continue;
+                        raw char p[PATH_MAX];
+                        snprintf(p, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
+                        for (int di = 0; di < app->drop_count; di++)
+                        {
+                                if (!strcmp(p, app->drop_paths[di]))
+                                {
+                                        s->selections[i] = true;
+                                        s->selected_idx = i;
+                                        break;
+                                }
+                        }
+                }
+        }
+}
+
+/* Patches a refresh into the listing in place: removed rows are marked gone,
+ * changed rows get their new metadata and added rows are appended, then every
+ * tab showing the directory catches up its display order. */
+static void dir_model_apply_diff(DirModel *m, DirLoad *ld, const EntryTable *added)
+{
+        (ld->diffed && ld->gen == m->gen) orelse return;
+        EntryTable *t = dir_rows_mut(m) orelse return;
+
+        for (int i = 0; i < ld->removed_count; i++)
+                t->flags[ld->removed[i]] |= ENTRY_GONE;
+        for (int i = 0; i < ld->changed_count; i++)
+        {
+                DirChange *c = &ld->changed[i];
+                t->flags[c->row] = (t->flags[c->row] & (ENTRY_DIR | ENTRY_META_QUEUED)) | (c->flags & ENTRY_EXEC);
+                t->size[c->row] = c->size;
+                t->mtime[c->row] = c->mtime;
+        }
+
+        /* Directory totals that took in what changed are off now. The walk
+         * of this listing only starts over for a directory row, added rows
+         * are walked on their own. */
+        if (ld->removed_count || ld->changed_count || added->count)
+        {
+                raw char path[PATH_MAX];
+                dir_size_invalidate(m->path, true);
+                for (int i = 0; i < ld->removed_count; i++)
+                {
+                        fs_join(path, m->path, entry_name(t, ld->removed[i]));
+                        dir_size_invalidate(path, t->flags[ld->removed[i]] & ENTRY_DIR);
+                }
+                for (int i = 0; i < ld->changed_count; i++)
+                {
+                        fs_join(path, m->path, entry_name(t, ld->changed[i].row));
+                        dir_size_invalidate(path, t->flags[ld->changed[i].row] & ENTRY_DIR);
+                }
+        }
+
+        uint32_t base = (uint32_t)t->count;
+        int n = entries_append(t, added) ? added->count : 0;
+        int live = t->count;
+        for (int v = 0; v < tab_count; v++)
+        {
+                (tabs[v]->in_use && tabs[v]->app.dir == m) orelse continue;
+                app_apply_diff(&tabs[v]->app, ld, base, n);
+                if (!tabs[v]->app.filter[0])
+                        live = tabs[v]->app.count;
+        }
+
+        /* Removed rows keep their arena space until they make up most of the
+         * table, then everything is renumbered in one go. */
+        int gone = t->count - live;
+        if (gone > 1024 && gone > live)
+        {
+                uint32_t *remap = malloc(t->count * sizeof(uint32_t)) orelse return;
+                dir_model_cancel_meta(m);
+                entries_compact(t, remap);
+                for (int v = 0; v < tab_count; v++)
+                {
+                        AppState *a = &tabs[v]->app;
+                        (tabs[v]->in_use && a->dir == m) orelse continue;
+                        for (int i = 0; i < a->count; i++)
+                                a->order[i] = remap[a->order[i]];
+                        free(a->filter_base);
+                        a->filter_base = NULL;
+                }
+                free(remap);
+                m->gen = ++dir_model_gen;
+        }
+}
+
+static void dir_model_apply_git(DirModel *m, DirLoad *ld)
+{
+        strcpy(m->git_branch, ld->git_branch);
+        EntryTable *t = dir_rows_mut(m) orelse return;
+        memset(t->git, 0, t->count * sizeof(t->git[0]));
+        (ld->git_count > 0) orelse return;
+
+        raw GitStatusEntry key;
+        for (int row = 0; row < t->count; row++)
+        {
+                memcpy(key.name, entry_name(t, row), t->name_len[row] + 1);
+                GitStatusEntry *g = bsearch(&key, ld->git, ld->git_count, sizeof(GitStatusEntry), cmp_git_entries);
+                (g) orelse continue;
+                t->git[row][0] = g->status[0];
+                t->git[row][1] = g->status[1];
+        }
+}
+
+/* Moves whatever the worker produced since the last frame into the directory.
+ * While streaming, batches are only merged once they are a sizeable fraction
+ * of what is already shown, which keeps the total merge work linear. */
+static bool dir_model_shown(const DirModel *m)
+{
+        for (int t = 0; t < tab_count; t++)
+                if (tabs[t]->in_use && tabs[t]->shown && tabs[t]->app.dir == m)
+                        return true;
+        return false;
+}
+
+/* A refresh is not swapped in under a drop or delete animation of a tab
+ * showing the directory, the rows it points at would move. */
+static bool dir_model_animating(const DirModel *m)
+{
+        for (int t = 0; t < tab_count; t++)
+        {
+                const AppState *a = &tabs[t]->app;
+                (tabs[t]->in_use && a->dir == m) orelse continue;
+                if ((a->list.drop_anim > 0.01f && a->list.drop_to_target) || (a->pop_is_out && a->pop_anim > 0.01f))
+                        return true;
+        }
+        return false;
+}
+
+static void dir_model_set_stamp(DirModel *m, const DirStamp *stamp)
+{
+        m->stamp = *stamp;
+        m->last_mtime = stamp->mtime;
+        m->last_mtime_ns = stamp->mtime_ns;
+}
+
+/* The directory could not be read again, every tab on it moves up to the
+ * nearest parent that still exists. Tabs off screen do so once they are shown
+ * again, or on waking up when they went to sleep meanwhile. */
+static void dir_model_lost(DirModel *m)
+{
+        m->lost = true;
+        for (int t = 0; t < tab_count; t++)
+        {
+                AppState *a = &tabs[t]->app;
+                if (tabs[t]->in_use && tabs[t]->shown && a->dir == m && !a->next_dir[0])
+                        strcpy(a->next_dir, ".");
+        }
+}
+
+void dir_model_pump_load(DirModel *m)
+{
+        DirLoad *ld = m->load;
+        ld orelse return;
+
+        EntryTable batch = {0};
+        defer entries_free(&batch);
+        int shown = dir_rows(m)->count;
+        pthread_mutex_lock(&ld->lock);
+        bool listed = ld->listed, done = ld->done, failed = ld->failed;
+        int pending = ld->batch.count;
+        bool hold = ld->refresh && !ld->swapped && !failed && dir_model_animating(m);
+        bool take = ld->refresh ? (listed && !ld->swapped && !hold) : (pending > 0 && (listed || shown < 1024 || pending * 4 >= shown));
+        if (take)
+        {
+                batch = ld->batch;
+                memset(&ld->batch, 0, sizeof(ld->batch));
+        }
+        pthread_mutex_unlock(&ld->lock);
+
+        if (take && ld->refresh)
+        {
+                dir_model_apply_diff(m, ld, &batch);
+                ld->swapped = true;
+        }
+        else if (take)
+        {
+                dir_model_append(m, &batch);
+        }
+
+        if (done && !hold)
+        {
+                if (failed)
+                {
+                        dir_model_lost(m);
+                }
+                else
+                {
+                        m->lost = false;
+                        dir_model_set_stamp(m, &ld->stamp);
+                }
+                dir_model_apply_git(m, ld);
+                m->load = NULL;
+                dir_load_release(ld);
+        }
+}
+
+static void listing_cache_drop(CachedListing *c)
+{
+        listing_cache_bytes -= c->bytes;
+        entries_free(&c->table);
+        free(c->order);
+        memset(c, 0, sizeof(*c));
+}
+
+static CachedListing *listing_cache_find(const char *path)
+{
+        for (int i = 0; i < LISTING_CACHE_SLOTS; i++)
+                if (listing_cache[i].path[0] && !strcmp(listing_cache[i].path, path))
+                        return &listing_cache[i];
+        return NULL;
+}
+
+/* Takes over the table and order of l, keeping them as the listing of l->path
+ * if they fit the budget and freeing them otherwise. */
+static void listing_cache_put(CachedListing *l)
+{
+        CachedListing *c = listing_cache_find(l->path);
+        if (c)
+                listing_cache_drop(c);
+
+        size_t bytes = entries_bytes(&l->table) + l->count * sizeof(uint32_t);
+        if (bytes > LISTING_CACHE_BYTES / 4)
+        {
+                entries_free(&l->table);
+                free(l->order);
+                return;
+        }
+        for (;;)
+        {
+                CachedListing *lru = NULL, *slot = NULL;
+                for (int i = 0; i < LISTING_CACHE_SLOTS; i++)
+                {
+                        if (!listing_cache[i].path[0])
+                                slot = &listing_cache[i];
+                        else if (!lru || listing_cache[i].used < lru->used)
+                                lru = &listing_cache[i];
+                }
+                if (slot && listing_cache_bytes + bytes <= LISTING_CACHE_BYTES)
+                {
+                        c = slot;
+                        break;
+                }
+                listing_cache_drop(lru);
+        }
+
+        *c = *l;
+        c->bytes = bytes;
+        c->used = ++listing_cache_tick;
+        listing_cache_bytes += bytes;
+}
+
+/* Listings of the directories open at exit, kept in ~/.cache so the next
+ * start paints them before the directory has been read. The file is mapped
+ * as a whole and a record only comes back through the listing cache while
+ * its stamp still matches, the refresh that follows every restore reads the
+ * directory again and replaces it.
+ *
+ * Header: "EXSN", version, record count, reserved, all u32.
+ * Record: SnapshotRecord, the path with its NUL, the order as u32 and the
+ *   rows in the flat form of entries_write_flat, each padded to 8 bytes. */
+#define SNAPSHOT_MAGIC "EXSN"
+#define SNAPSHOT_VERSION 1
+
+typedef struct
+{
+        char magic[4];
+        uint32_t version, count, reserved;
+} SnapshotHeader;
+
+typedef struct
+{
+        uint64_t size;
+        DirStamp stamp;
+        uint32_t count, cursor_row;
+        int32_t sort;
+        uint16_t path_len, reserved;
+        char git_branch[64];
+} SnapshotRecord;
+
+const uint8_t *snapshot_map = NULL;
+size_t snapshot_size = 0;
+
+static void snapshot_path(char *out, const char *home)
+{
+        snprintf(out, PATH_MAX, "%s/.cache/explore_snapshots.bin", home);
+}
+
+void snapshot_open(void)
+{
+        const char *home = getenv("HOME") orelse return;
+        raw char path[PATH_MAX];
+        snapshot_path(path, home);
+        snapshot_map = fs_map_file(path, &snapshot_size) orelse return;
+        const SnapshotHeader *h = (const SnapshotHeader *)snapshot_map;
+        bool ok = snapshot_size >= sizeof(*h) && !memcmp(h->magic, SNAPSHOT_MAGIC, 4) && h->version == SNAPSHOT_VERSION;
+        if (!ok)
+        {
+                fs_unmap_file(snapshot_map, snapshot_size);
+                snapshot_map = NULL;
+        }
+}
+
+static const SnapshotRecord *snapshot_find(const char *path)
+{
+        (snapshot_map) orelse return NULL;
+        const SnapshotHeader *h = (const SnapshotHeader *)snapshot_map;
+        size_t len = strlen(path), off = sizeof(*h);
+        for (uint32_t i = 0; i < h->count; i++)
+        {
+                const SnapshotRecord *r = (const SnapshotRecord *)(snapshot_map + off);
+                (snapshot_size - off >= sizeof(*r)) orelse return NULL;
+                bool sane = r->size % 8 == 0 && r->size <= snapshot_size - off && r->size >= sizeof(*r) + FLAT_PAD(r->path_len + 1);
+                (sane) orelse return NULL;
+                if (r->path_len == len && !memcmp(r + 1, path, len))
+                        return r;
+                off += r->size;
+        }
+        return NULL;
+}
+
+/* Moves the snapshot of path into the listing cache when it was taken at
+ * stamp. Nothing is decoded for a directory that changed since. */
+static bool snapshot_load(const char *path, const DirStamp *stamp)
+{
+        const SnapshotRecord *r = snapshot_find(path) orelse return false;
+        (!memcmp(&r->stamp, stamp, sizeof(DirStamp)) && r->sort >= 0 && r->sort < SORT_COUNT) orelse return false;
+        const uint8_t *p = (const uint8_t *)(r + 1) + FLAT_PAD(r->path_len + 1);
+        const uint8_t *end = (const uint8_t *)r + r->size;
+        size_t order_bytes = FLAT_PAD((size_t)r->count * sizeof(uint32_t));
+        ((size_t)(end - p) >= order_bytes) orelse return false;
+
+        CachedListing l = {0};
+        strcpy(l.path, path);
+        l.stamp = r->stamp;
+        l.count = (int)r->count;
+        l.sort = (SortMode)r->sort;
+        l.cursor_row = r->cursor_row;
+        memcpy(l.git_branch, r->git_branch, sizeof(l.git_branch) - 1);
+        l.order = malloc(order_bytes ? order_bytes : 1);
+        bool ok = l.order && entries_read_flat(&l.table, p + order_bytes, end - p - order_bytes);
+        if (ok)
+                memcpy(l.order, p, (size_t)l.count * sizeof(uint32_t));
+        for (int i = 0; ok && i < l.count; i++)
+                ok = l.order[i] < (uint32_t)l.table.count;
+        if (!ok)
+        {
+                entries_free(&l.table);
+                free(l.order);
+                return false;
+        }
+        listing_cache_put(&l);
+        return true;
+}
+
+static bool snapshot_put(FILE *f, const CachedListing *l)
+{
+        size_t bytes = entries_bytes(&l->table) + l->count * sizeof(uint32_t);
+        (l->count > 0 && bytes <= LISTING_CACHE_BYTES / 4) orelse return false;
+
+        SnapshotRecord r = {0};
+        size_t len = strlen(l->path);
+        size_t order_bytes = (size_t)l->count * sizeof(uint32_t);
+        r.size = sizeof(r) + FLAT_PAD(len + 1) + FLAT_PAD(order_bytes) + entries_flat_size(&l->table);
+        r.stamp = l->stamp;
+        r.count = (uint32_t)l->count;
+        r.cursor_row = l->cursor_row;
+        r.sort = l->sort;
+        r.path_len = (uint16_t)len;
+        strcpy(r.git_branch, l->git_branch);
+        fwrite(&r, sizeof(r), 1, f);
+        flat_put(f, l->path, len + 1);
+        flat_put(f, l->order, order_bytes);
+        entries_write_flat(&l->table, f);
+        return true;
+}
+
+/* One record per directory an open tab is in: what an awake tab shows when it
+ * is complete, else the listing cache, else the record from the last session
+ * as it was. Replaced through a rename like the layout. */
+void save_snapshots(void)
+{
+        defer
+        {
+                fs_unmap_file(snapshot_map, snapshot_size);
+                snapshot_map = NULL;
+        }
+        const char *home = getenv("HOME") orelse return;
+        raw char path[PATH_MAX], tmp[PATH_MAX];
+        snapshot_path(path, home);
+        snprintf(tmp, PATH_MAX, "%s.%d", path, getpid());
+        FILE *f = fopen(tmp, "wb") orelse return;
+
+        SnapshotHeader h = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, 0};
+        fwrite(&h, sizeof(h), 1, f);
+        for (int i = 0; i < tab_count; i++)
+        {
+                const AppState *app = &tabs[i]->app;
+                (tabs[i]->in_use && app->cwd[0]) orelse continue;
+                bool seen = false;
+                for (int j = 0; j < i && !seen; j++)
+                        seen = tabs[j]->in_use && !strcmp(tabs[j]->app.cwd, app->cwd);
+                (!seen) orelse continue;
+
+                const DirModel *m = app->dir;
+                const CachedListing *c = listing_cache_find(app->cwd);
+                const SnapshotRecord *old = snapshot_find(app->cwd);
+                if (m && !m->load && !m->refresh_due && !app->filter[0] && app->count > 0)
+                {
+                        CachedListing l = {0};
+                        strcpy(l.path, m->path);
+                        l.stamp = m->stamp;
+                        l.table = *dir_rows(m);
+                        l.order = app->order;
+                        l.count = app->count;
+                        l.sort = app->sort;
+                        int sel = app->list.selected_idx;
+                        l.cursor_row = (sel >= 0 && sel < app->count) ? app->order[sel] : UINT32_MAX;
+                        strcpy(l.git_branch, m->git_branch);
+                        h.count += snapshot_put(f, &l);
+                }
+                else if (c)
+                {
+                        h.count += snapshot_put(f, c);
+                }
+                else if (old)
+                {
+                        fwrite(old, old->size, 1, f);
+                        h.count++;
+                }
+        }
+        fseek(f, 0, SEEK_SET);
+        fwrite(&h, sizeof(h), 1, f);
+
+        bool ok = !ferror(f);
+        if (fclose(f) == 0 && ok)
+                rename(tmp, path);
+        else
+                unlink(tmp);
+}
+
+/* Directories visited, for the jump prompt to rank by frecency. Kept in
+ * ~/.cache as a fixed table of slots that every running instance maps shared.
+ * Writers hold an flock on the file, which goes away with a writer that dies,
+ * and mark the slot they change with an odd seq meanwhile. Readers take no
+ * lock and keep a slot only when seq was even and the same before and after
+ * they copied it.
+ *
+ * Header: FrecencyHeader. Slots: FrecencySlot, at the path's hash and up to
+ * FRECENCY_PROBE - 1 after it. */
+#define FRECENCY_MAGIC "EXFR"
+#define FRECENCY_VERSION 1
+#define FRECENCY_SLOTS 2048
+#define FRECENCY_PROBE 32
+#define FRECENCY_AGE_AT 10000
+
+typedef struct
+{
+        char magic[4];
+        uint32_t version, slots, reserved;
+        uint64_t total;
+} FrecencyHeader;
+
+typedef struct
+{
+        _Atomic uint32_t seq;
+        uint32_t visits;
+        int64_t last;
+        uint16_t len;
+        char path[494];
+} FrecencySlot;
+
+FrecencyHeader *frecency_map = NULL;
+int frecency_fd = -1;
+pthread_once_t frecency_once = PTHREAD_ONCE_INIT;
+/* flock() only keeps other processes out, visits from the pool of this one
+ * take turns on this first. */
+pthread_mutex_t frecency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline FrecencySlot *frecency_slots(void)
+{
+        return (FrecencySlot *)(frecency_map + 1);
+}
+
+/* Maps the table, laying it out first when the file is new or not one this
+ * version understands. */
+static void frecency_open(void)
+{
+        const char *home = getenv("HOME") orelse return;
+        raw char path[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s/.cache", home);
+        mkdir(path, 0755);
+        snprintf(path, PATH_MAX, "%s/.cache/explore_frecency.bin", home);
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        (fd >= 0) orelse return;
+        size_t size = sizeof(FrecencyHeader) + FRECENCY_SLOTS * sizeof(FrecencySlot);
+
+        flock(fd, LOCK_EX);
+        defer flock(fd, LOCK_UN);
+        raw struct stat st;
+        bool sized = fstat(fd, &st) == 0 && st.st_size == (off_t)size;
+        if (!sized && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+        {
+                close(fd);
+                return;
+        }
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+                close(fd);
+                return;
+        }
+        FrecencyHeader *h = p;
+        if (memcmp(h->magic, FRECENCY_MAGIC, 4) || h->version != FRECENCY_VERSION || h->slots != FRECENCY_SLOTS)
+        {
+                memset(p, 0, size);
+                *h = (FrecencyHeader){FRECENCY_MAGIC, FRECENCY_VERSION, FRECENCY_SLOTS, 0, 0};
+        }
+        frecency_map = h;
+        frecency_fd = fd;
+}
+
+/* A write to a slot between these two. The seq goes odd and back to even
+ * whatever it was left at, so a slot a writer died on is mended by the next. */
+static inline void frecency_write_begin(FrecencySlot *sl)
+{
+        atomic_store_explicit(&sl->seq, atomic_load_explicit(&sl->seq, memory_order_relaxed) | 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+}
+
+static inline void frecency_write_end(FrecencySlot *sl)
+{
+        atomic_store_explicit(&sl->seq, atomic_load_explicit(&sl->seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/* Visits weighed by how long ago the last one was. */
+static double frecency_score(uint32_t visits, int64_t last, int64_t now)
+{
+        int64_t age = now - last;
+        return visits * (age < 3600 ? 4.0 : age < 86400 ? 2.0 : age < 604800 ? 0.5 : 0.25);
+}
+
+/* Past FRECENCY_AGE_AT visits in all every count loses a tenth, so old habits
+ * fade and the ones that drop to nothing give their slot back. */
+static void frecency_age(void)
+{
+        FrecencySlot *slots = frecency_slots();
+        uint64_t total = 0;
+        for (int i = 0; i < FRECENCY_SLOTS; i++)
+        {
+                FrecencySlot *sl = &slots[i];
+                (sl->len) orelse continue;
+                frecency_write_begin(sl);
+                sl->visits = sl->visits * 9 / 10;
+                if (!sl->visits)
+                        sl->len = 0;
+                frecency_write_end(sl);
+                total += sl->visits;
+        }
+        frecency_map->total = total;
+}
+
+/* Counts a visit to path. A path new to the table takes a free slot near its
+ * hash, or the one there with the lowest score. */
+static void frecency_visit_job(void *arg)
+{
+        char *path = arg;
+        defer free(path);
+        pthread_once(&frecency_once, frecency_open);
+        (frecency_map) orelse return;
+        size_t len = strlen(path);
+        (len > 0 && len < sizeof(((FrecencySlot *)0)->path)) orelse return;
+
+        pthread_mutex_lock(&frecency_lock);
+        defer pthread_mutex_unlock(&frecency_lock);
+        flock(frecency_fd, LOCK_EX);
+        defer flock(frecency_fd, LOCK_UN);
+        int64_t now = time(NULL);
+        FrecencySlot *slots = frecency_slots(), *hit = NULL, *victim = NULL;
+        double victim_score = 0;
+        uint32_t h = dir_size_hash(path);
+        for (int i = 0; i < FRECENCY_PROBE && !hit; i++)
+        {
+                FrecencySlot *sl = &slots[(h + i) % FRECENCY_SLOTS];
+                if (sl->len == len && !memcmp(sl->path, path, len))
+                {
+                        hit = sl;
+                        break;
+                }
+                double score = sl->len ? frecency_score(sl->visits, sl->last, now) : -1.0;
+                if (!victim || score < victim_score)
+                {
+                        victim = sl;
+                        victim_score = score;
+                }
+        }
+
+        FrecencySlot *sl = hit ? hit : victim;
+        frecency_write_begin(sl);
+        if (!hit)
+        {
+                memcpy(sl->path, path, len + 1);
+                sl->len = (uint16_t)len;
+                sl->visits = 0;
+        }
+        sl->visits++;
+        sl->last = now;
+        frecency_write_end(sl);
+        if (++frecency_map->total > FRECENCY_AGE_AT)
+                frecency_age();
+}
+
+static void frecency_visit(const char *path)
+{
+        char *copy = strdup(path) orelse return;
+        fs_jobs_submit(frecency_visit_job, copy);
+}
+
+/* Copies a slot as it was between two writes, false while one is going on. */
+static bool frecency_read(const FrecencySlot *sl, FrecencySlot *out)
+{
+        for (int tries = 0; tries < 4; tries++)
+        {
+                uint32_t seq = atomic_load_explicit(&sl->seq, memory_order_acquire);
+                if (seq & 1)
+                        continue;
+                out->visits = sl->visits;
+                out->last = sl->last;
+                out->len = sl->len;
+                memcpy(out->path, sl->path, sizeof(out->path));
+                atomic_thread_fence(memory_order_acquire);
+                (atomic_load_explicit(&sl->seq, memory_order_relaxed) == seq) orelse continue;
+                if (out->len >= sizeof(out->path))
+                        out->len = 0;
+                out->path[out->len] = '\0';
+                return true;
+        }
+        return false;
+}
+
+/* Moves the listing the tab shows into the cache when it is complete and up to
+ * date. Only done for the last tab to leave a directory, the tab is left with
+ * an empty order. */
+static void app_stash_listing(AppState *app)
+{
+        DirModel *m = app->dir;
+        (!m->grep[0] && !m->load && !m->refresh_due && app->count > 0 && shared_entries_own(&m->rows)) orelse return;
+
+        CachedListing l = {0};
+        strcpy(l.path, m->path);
+        l.stamp = m->stamp;
+        l.table = m->rows->t;
+        l.order = app->order;
+        l.count = app->count;
+        l.sort = app->sort;
+        int sel = app->list.selected_idx;
+        l.cursor_row = (sel >= 0 && sel < app->count) ? app->order[sel] : UINT32_MAX;
+        strcpy(l.git_branch, m->git_branch);
+        listing_cache_put(&l);
+
+        memset(&m->rows->t, 0, sizeof(m->rows->t));
+        app->order = NULL;
+        app->order_cap = 0;
+        app->count = 0;
+}
+
+/* Fills the directory the tab just opened with its cached listing, or the
+ * snapshot of the last session, as long as it still carries the stamp it had
+ * when the listing was taken. */
+static bool app_restore_listing(AppState *app)
+{
+        DirModel *m = app->dir;
+        (!m->grep[0]) orelse return false;
+        CachedListing *c = listing_cache_find(m->path);
+        if (!c && snapshot_load(m->path, &m->stamp))
+                c = listing_cache_find(m->path);
+        (c) orelse return false;
+        if (memcmp(&c->stamp, &m->stamp, sizeof(DirStamp)) != 0)
+        {
+                listing_cache_drop(c);
+                return false;
+        }
+        EntryTable *t = dir_rows_mut(m) orelse return false;
+        (app_reserve_order(app, c->count) && entries_append(t, &c->table)) orelse return false;
+
+        int n = c->count;
+        memcpy(app->order, c->order, n * sizeof(uint32_t));
+        if (c->sort != app->sort)
+                entries_sort(t, app->sort, app->order, n);
+        app->count = n;
+        strcpy(m->git_branch, c->git_branch);
+        c->used = ++listing_cache_tick;
+
+        UIListState *s = &app->list;
+        ui_list_reserve(s, n);
+        memset(s->selections, 0, n * sizeof(bool));
+        s->selected_idx = 0;
+        for (int i = 0; i < n; i++)
+        {
+                if (app->order[i] == c->cursor_row)
+                {
+                        s->selected_idx = i;
+                        break;
+                }
+        }
+        return true;
+}
+
+static void app_cancel_prefetch(AppState *app, int k)
+{
+        Prefetch *p = &app->prefetch[k];
+        (p->load) orelse return;
+        atomic_store(&p->load->cancel, true);
+        dir_load_release(p->load);
+        p->load = NULL;
+        prefetch_running--;
+}
+
+static bool prefetch_in_flight(const char *path)
+{
+        for (int t = 0; t < tab_count; t++)
+                for (int k = 0; k < 2 && tabs[t]->in_use; k++)
+                        if (tabs[t]->app.prefetch[k].load && !strcmp(tabs[t]->app.prefetch[k].path, path))
+                                return true;
+        return false;
+}
+
+/* A finished prefetch goes into the listing cache in the tab's sort order. */
+static void app_finish_prefetch(AppState *app, int k)
+{
+        DirLoad *ld = app->prefetch[k].load;
+        pthread_mutex_lock(&ld->lock);
+        bool done = ld->done;
+        pthread_mutex_unlock(&ld->lock);
+        (done) orelse return;
+
+        if (!atomic_load(&ld->cancel))
+        {
+                CachedListing l = {0};
+                strcpy(l.path, ld->path);
+                l.stamp = ld->stamp;
+                l.table = ld->batch;
+                memset(&ld->batch, 0, sizeof(ld->batch));
+                entries_add(&l.table, "..", 2, ENTRY_DIR, 0, 0);
+                l.count = l.table.count;
+                l.order = malloc(l.count * sizeof(uint32_t));
+                if (l.order)
+                {
+                        for (int i = 0; i < l.count; i++)
+                                l.order[i] = (uint32_t)i;
+                        entries_sort(&l.table, app->sort, l.order, l.count);
+                        l.sort = app->sort;
+                        l.cursor_row = UINT32_MAX;
+                        listing_cache_put(&l);
+                }
+                else
+                {
+                        entries_free(&l.table);
+                }
+        }
+        app->prefetch[k].done = true;
+        app_cancel_prefetch(app, k);
+}
+
+/* Lists the directory under the cursor and the parent in the background once
+ * the cursor has rested on it for a moment, so entering either is served from
+ * the listing cache. Prefetches whose target moved on are cancelled. Returns
+ * when the next one is due, 0 for never. */
+long long app_update_prefetch(AppState *app, long long now)
+{
+        raw char want[2][PATH_MAX];
+        want[0][0] = want[1][0] = '\0';
+        int sel = app->list.selected_idx;
+        if (sel >= 0 && sel < app->count && app_is_dir(app, sel) && strcmp(app_name(app, sel), ".."))
+                fs_join(want[0], app->cwd, app_name(app, sel));
+        if (app->cwd[0] && strcmp(app->cwd, "/"))
+        {
+                strcpy(want[1], app->cwd);
+                char *slash = strrchr(want[1], '/');
+                if (slash == want[1])
+                        want[1][1] = '\0';
+                else if (slash)
+                        *slash = '\0';
+        }
+
+        long long due = 0;
+        for (int k = 0; k < 2; k++)
+        {
+                Prefetch *p = &app->prefetch[k];
+                if (p->load)
+                        app_finish_prefetch(app, k);
+                if (strcmp(p->path, want[k]))
+                {
+                        app_cancel_prefetch(app, k);
+                        strcpy(p->path, want[k]);
+                        p->due = now + PREFETCH_DELAY_MS;
+                        p->done = false;
+                }
+                (p->path[0] && !p->load && !p->done && !listing_cache_find(p->path) && !dir_model_find(p->path)) orelse continue;
+                if (now < p->due)
+                {
+                        if (!due || p->due < due)
+                                due = p->due;
+                        continue;
+                }
+
+                /* The directory on screen is listed first. Both that and
+                 * running prefetches wake the loop again when they finish. */
+                ((!app->dir || !app->dir->load) && prefetch_running < PREFETCH_MAX && !prefetch_in_flight(p->path)) orelse continue;
+
+                DirLoad *ld = calloc(1, sizeof(DirLoad)) orelse continue;
+                pthread_mutex_init(&ld->lock, NULL);
+                atomic_init(&ld->refs, 2);
+                ld->dfd = -1;
+                ld->limit = PREFETCH_MAX_ENTRIES;
+                strcpy(ld->path, p->path);
+                if (!fs_jobs_submit_idle(dir_prefetch_job, ld))
+                {
+                        dir_load_release(ld);
+                        dir_load_release(ld);
+                        continue;
+                }
+                p->load = ld;
+                prefetch_running++;
+        }
+        return due;
+}
+
+static void dir_model_unwatch(DirModel *m)
+{
+        (m->watched) orelse return;
+        m->watched = false;
+        for (DirModel *o = dir_models; o; o = o->next)
+                if (o->watched && o->watch_wd == m->watch_wd)
+                        return;
+        fs_watch_remove(m->watch_wd);
+}
+
+/* Coalesces change notifications: at most one refresh per
+ * REFRESH_INTERVAL_MS, and never while one is running. */
+void dir_model_schedule_refresh(DirModel *m, long long now)
+{
+        (!m->refresh_due) orelse return;
+        long long at = m->last_refresh + REFRESH_INTERVAL_MS;
+        m->refresh_due = at > now ? at : now;
+}
+
+/* Entries coming or going need a refresh. Writes only need the row stat'ed
+ * again, unless a tab sorts the listing by size or date. */
+void dir_model_on_change(DirModel *m, const FsWatchEvent *ev, long long now)
+{
+        if (ev->kind != FS_WATCH_CONTENT || dir_model_needs_meta(m))
+        {
+                dir_model_schedule_refresh(m, now);
+                if (ev->kind == FS_WATCH_OVERFLOW)
+                        m->stale_all = true;
+                return;
+        }
+        (ev->name[0] && !m->stale_all) orelse return;
+        for (int i = 0; i < m->stale_count; i++)
+                if (!strcmp(m->stale[i], ev->name))
+                        return;
+        if (m->stale_count == STALE_MAX)
+                m->stale_all = true;
+        else
+                snprintf(m->stale[m->stale_count++], sizeof(m->stale[0]), "%s", ev->name);
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+        return strcmp(a, b);
+}
+
+/* Rows written to are stat'ed again when next on screen, their old metadata
+ * stays visible until then. */
+void dir_model_apply_stale(DirModel *m)
+{
+        (m->stale_count > 0 || m->stale_all) orelse return;
+        EntryTable *t = dir_rows_mut(m) orelse return;
+        qsort(m->stale, m->stale_count, sizeof(m->stale[0]), cmp_names);
+        for (int row = 0; row < t->count; row++)
+        {
+                (!(t->flags[row] & (ENTRY_DIR | ENTRY_GONE | ENTRY_META_PENDING))) orelse continue;
+                if (m->stale_all || bsearch(entry_name(t, row), m->stale, m->stale_count, sizeof(m->stale[0]), cmp_names))
+                        t->flags[row] |= ENTRY_META_STALE;
+        }
+        m->stale_count = 0;
+        m->stale_all = false;
+}
+
+/* An empty directory model for path with its change tracking set up. Watches
+ * are per inode, models for two paths of one directory share it. */
+static DirModel *dir_model_new(const char *path)
+{
+        DirModel *m = calloc(1, sizeof(DirModel)) orelse return NULL;
+        m->rows = shared_entries_new() orelse
+        {
+                free(m);
+                return NULL;
+        };
+        strcpy(m->path, path);
+        m->gen = ++dir_model_gen;
+        m->watch_wd = fs_watch_add(path);
+        m->watched = m->watch_wd >= 0;
+        m->poll_interval = POLL_MIN_MS;
+        m->poll_due = now_ms() + POLL_MIN_MS;
+        m->next = dir_models;
+        dir_models = m;
+        return m;
+}
+
+/* Takes the tab off the directory it shows. The last tab to leave stashes the
+ * listing in the cache and stops everything running for the directory. */
+static void app_leave_dir(AppState *app)
+{
+        DirModel *m = app->dir;
+        (m) orelse return;
+        if (--m->refs == 0)
+        {
+                dir_model_cancel_meta(m);
+                dir_model_cancel_sizes(m);
+                app_stash_listing(app);
+                dir_model_cancel_load(m);
+                dir_model_unwatch(m);
+                for (DirModel **p = &dir_models; *p; p = &(*p)->next)
+                {
+                        if (*p == m)
+                        {
+                                *p = m->next;
+                                break;
+                        }
+                }
+                shared_entries_release(m->rows);
+                free(m);
+        }
+        app->dir = NULL;
+        app->count = 0;
+}
+
+/* Starts with the display order of another tab on the same directory, sorted
+ * afresh when the others only show part of it. */
+static void app_share_order(AppState *app)
+{
+        AppState *from = NULL;
+        for (int t = 0; t < tab_count && !from; t++)
+                if (tabs[t]->in_use && &tabs[t]->app != app && tabs[t]->app.dir == app->dir && !tabs[t]->app.filter[0])
+                        from = &tabs[t]->app;
+        if (!from)
+        {
+                app_merge_rows(app, 0, dir_rows(app->dir)->count);
+                app->list.selected_idx = 0;
+                app_check_sort_meta(app);
+                return;
+        }
+        (app_reserve_order(app, from->count)) orelse return;
+
+        int n = from->count;
+        memcpy(app->order, from->order, n * sizeof(uint32_t));
+        if (from->sort != app->sort)
+                entries_sort(dir_rows(app->dir), app->sort, app->order, n);
+        app->count = n;
+        ui_list_reserve(&app->list, n);
+        memset(app->list.selections, 0, n * sizeof(bool));
+        app->list.selected_idx = 0;
+        app_check_sort_meta(app);
+}
+
+/* Starts listing m on a worker, replacing whatever load was running. dfd is
+ * the directory when the caller has it open already, -1 has the job open it.
+ * The load is only submitted by the caller. */
+static DirLoad *dir_model_start_load(DirModel *m, int dfd, bool refresh)
+{
+        dir_model_cancel_meta(m);
+        dir_model_cancel_load(m);
+
+        DirLoad *ld = calloc(1, sizeof(DirLoad)) orelse
+        {
+                if (dfd >= 0)
+                        fs_vfs->close(dfd);
+                return NULL;
+        };
+        pthread_mutex_init(&ld->lock, NULL);
+        atomic_init(&ld->refs, 2);
+        ld->dfd = dfd;
+        ld->need_meta = dir_model_needs_meta(m);
+        strcpy(ld->path, m->path);
+        strcpy(ld->grep, m->grep);
+        ld->grep_skip = find_skip;
+        ld->refresh = refresh;
+        if (refresh)
+        {
+                ld->gen = m->gen;
+                ld->prev = shared_entries_ref(m->rows);
+        }
+        m->load = ld;
+        m->last_refresh = now_ms();
+        m->refresh_due = 0;
+        return ld;
+}
+
+/* Reads m again in the background. The old listing stays up until the new one
+ * is complete and is then diffed into every tab showing it at once, so any
+ * number of directories can be refreshing without the UI thread touching the
+ * disk for them. */
+static void dir_model_refresh(DirModel *m, int dfd)
+{
+        /* A search still running is not cut short, its results are looked
+         * at again once it is through. */
+        if (m->grep[0] && m->load && !m->load->refresh)
+        {
+                if (dfd >= 0)
+                        fs_vfs->close(dfd);
+                m->refresh_due = now_ms();
+                return;
+        }
+        DirLoad *ld = dir_model_start_load(m, dfd, true) orelse return;
+        fs_jobs_submit(dir_load_job, ld);
+}
+
+/* Lists the directory the tab just opened on a worker. It streams entries in
+ * as they are found, or shows its cached listing right away and is then
+ * refreshed like one that was open already. */
+static void app_list_dir(AppState *app, int dfd)
+{
+        DirModel *m = app->dir;
+        raw struct stat dir_st;
+        DirStamp stamp = {0};
+        bool stamped = fs_vfs->fstat(dfd, &dir_st) == 0;
+        if (stamped)
+                dir_stamp(&dir_st, &stamp);
+        dir_model_set_stamp(m, &stamp);
+
+        bool cached = stamped && app_restore_listing(app);
+        DirLoad *ld = dir_model_start_load(m, dfd, cached) orelse return;
+        if (!cached)
+                app_add_dot_dot(app);
+        if (!cached && app->count > 0)
+        {
+                ui_list_reserve(&app->list, app->count);
+                app->list.selected_idx = 0;
+        }
+        fs_jobs_submit(dir_load_job, ld);
+}
+
+/* Puts the list back to the top before the tab shows something else. */
+static void app_reset_view(AppState *app)
+{
+        app_filter_clear(app);
+        UIListMode mode = app->list.mode;
+        ui_list_reset(&app->list);
+        app->list.mode = mode;
+        app->list.drop_anim = 0.0f;
+        app->list.fly_anim = 0.0f;
+        app->list.pickup_anim = 0.0f;
+        app->list.is_dragging = false;
+        app->list.is_box_selecting = false;
+        app->list.carrying = false;
+        app->drop_count = 0;
+        app->last_hovered_idx = -1;
+        app_drop_sort_cache(app);
+        app_leave_dir(app);
+}
+
+/* Shows path in the tab. A directory another tab already shows is shared with
+ * it as it is, anything else is listed. Loading "." refreshes the directory
+ * for every tab showing it, ".." out of search results goes back to the
+ * directory searched. False while the directory is still being opened,
+ * asking again later picks up where this left off. */
+bool app_load_dir(AppState *app, const char *path)
+{
+        /* Only the first try waits, the ones after just look whether it
+         * got there, its completion wakes the main loop. */
+        const char *asked = path;
+        bool again = !strcmp(app->opening, path);
+        app->opening[0] = '\0';
+        raw char old_cwd[PATH_MAX];
+        strcpy(old_cwd, app->cwd);
+        if (app->dir && app->dir->grep[0] && !strcmp(path, ".."))
+                path = old_cwd;
+
+        int dfd = app_open_dir(app, path, again ? 0 : UI_FS_DEADLINE_MS);
+        if (dfd < 0 && errno == ETIMEDOUT)
+        {
+                snprintf(app->opening, PATH_MAX, "%s", asked);
+                return false;
+        }
+        (dfd >= 0) orelse return true;
+        bool dir_changed = !app->dir || strcmp(path, ".") != 0 || strcmp(old_cwd, app->cwd) != 0;
+        if (!dir_changed)
+        {
+                app->dir->lost = false;
+                dir_model_refresh(app->dir, dfd);
+                return true;
+        }
+
+        app_reset_view(app);
+        if (fs_vfs == &fs_posix)
+                frecency_visit(app->cwd);
+        DirModel *m = dir_model_find(app->cwd);
+        if (m)
+        {
+                fs_vfs->close(dfd);
+                m->refs++;
+                app->dir = m;
+                app_share_order(app);
+                return true;
+        }
+        app->dir = dir_model_new(app->cwd) orelse
+        {
+                fs_vfs->close(dfd);
+                return true;
+        };
+        app->dir->refs = 1;
+        app_list_dir(app, dfd);
+        return true;
+}
+
+/* Shows the files below the current directory that hold pattern, listed by
+ * their path from here. Every search gets a listing of its own. */
+static void app_load_grep(AppState *app, const char *pattern)
+{
+        int dfd = app_open_dir(app, ".", UI_FS_DEADLINE_MS);
+        (dfd >= 0) orelse return;
+        app_reset_view(app);
+        app->dir = dir_model_new(app->cwd) orelse
+        {
+                fs_vfs->close(dfd);
+                return;
+        };
+        snprintf(app->dir->grep, sizeof(app->dir->grep), "%s", pattern);
+        app->dir->refs = 1;
+        app_list_dir(app, dfd);
+}
+
+/* Puts the cursor on item i and scrolls it into the middle. */
+static void app_center_on(AppState *app, const UIListParams *params, int i)
+{
+        UIListState *s = &app->list;
+        int cols = s->mode == UI_MODE_GRID && (params->w - 1) / params->cell_w > 0 ? (params->w - 1) / params->cell_w : 1;
+        int cell_h = s->mode == UI_MODE_GRID ? params->cell_h : 1;
+        float top = (float)((i / cols) * cell_h - (params->h - cell_h) / 2);
+        s->selected_idx = i;
+        s->target_scroll = top > 0 ? top : 0;
+}
+
+/* Selects the row named select_name once the listing has it and scrolls it
+ * into the middle. Given up on once the listing is read without it. */
+static void app_apply_select(AppState *app, const UIListParams *params)
+{
+        (app->select_name[0] && app->dir && !app->next_dir[0]) orelse return;
+        for (int i = 0; i < app->count; i++)
+        {
+                (!strcmp(app_name(app, i), app->select_name)) orelse continue;
+                app_center_on(app, params, i);
+                app->select_name[0] = '\0';
+                return;
+        }
+        if (!app->dir->load)
+                app->select_name[0] = '\0';
+}
+
+static void recent_close(AppState *app)
+{
+        RecentPrompt *r = app->recent;
+        (r) orelse return;
+        for (int i = 0; i < r->count; i++)
+                free(r->dirs[i].path);
+        free(r->dirs);
+        free(r->shown);
+        free(r->list.selections);
+        free(r->list.active_box_selections);
+        free(r);
+        app->recent = NULL;
+}
+
+/* Opens the jump prompt on what the frecency table holds right now, less the
+ * directory the tab is in. */
+static void recent_open(AppState *app)
+{
+        pthread_once(&frecency_once, frecency_open);
+        RecentPrompt *r = calloc(1, sizeof(RecentPrompt)) orelse return;
+        r->dirs = malloc(FRECENCY_SLOTS * sizeof(RecentDir));
+        r->shown = malloc(FRECENCY_SLOTS * sizeof(RecentDir *));
+        if (!r->dirs || !r->shown)
+        {
+                free(r->dirs);
+                free(r->shown);
+                free(r);
+                return;
+        }
+        r->fresh = true;
+        app->recent = r;
+        (frecency_map) orelse return;
+
+        int64_t now = time(NULL);
+        const FrecencySlot *slots = frecency_slots();
+        raw FrecencySlot copy;
+        for (int i = 0; i < FRECENCY_SLOTS; i++)
+        {
+                (frecency_read(&slots[i], &copy) && copy.len && strcmp(copy.path, app->cwd)) orelse continue;
+                char *path = strdup(copy.path) orelse continue;
+                const char *slash = strrchr(path, '/');
+                RecentDir *d = &r->dirs[r->count++];
+                *d = (RecentDir){path, copy.len, slash && slash[1] ? (uint16_t)(slash + 1 - path) : 0, 0, frecency_score(copy.visits, copy.last, now)};
+        }
+}
+
+static int cmp_recent(const void *a, const void *b)
+{
+        const RecentDir *x = *(RecentDir *const *)a, *y = *(RecentDir *const *)b;
+        if (x->rank != y->rank)
+                return y->rank - x->rank;
+        if (x->frecency != y->frecency)
+                return y->frecency > x->frecency ? 1 : -1;
+        return x->len != y->len ? x->len - y->len : strcmp(x->path, y->path);
+}
+
+/* Keeps the directories the query fuzzy matches, ranked by how well it does
+ * plus a bonus growing with the log of their frecency. */
+static void recent_rank(RecentPrompt *r)
+{
+        (r->fresh || strcmp(r->query, r->ranked)) orelse return;
+        r->fresh = false;
+        strcpy(r->ranked, r->query);
+        r->fold = true;
+        for (int i = 0; r->query[i]; i++)
+                if (isupper((unsigned char)r->query[i]))
+                        r->fold = false;
+        for (int i = 0; i < (int)sizeof(r->needle); i++)
+                if (!(r->needle[i] = find_fold(r->query[i], r->fold)))
+                        break;
+
+        r->shown_count = 0;
+        for (int i = 0; i < r->count; i++)
+        {
+                RecentDir *d = &r->dirs[i];
+                FindEntry e = {d->path, d->len, d->name, true};
+                int score = find_score(r->needle, r->fold, &e, NULL);
+                (score != INT_MIN) orelse continue;
+                int bits = 0;
+                for (uint64_t v = (uint64_t)(d->frecency * 4); v; v >>= 1)
+                        bits++;
+                d->rank = score + bits * 8;
+                r->shown[r->shown_count++] = d;
+        }
+        qsort(r->shown, r->shown_count, sizeof(RecentDir *), cmp_recent);
+        r->list.selected_idx = 0;
+        r->list.target_scroll = 0;
+}
+
+/* Printable keys handle_input has a use for. Any other one starts a
+ * type-ahead prefix, which then takes every printable key until it times out. */
+static const char bound_keys[] = "/urRq12scp";
+
+/* First of the display order [lo, n) past the rows of group, by bisection. */
+static int app_group_end(const AppState *app, int lo, int group)
+{
+        const EntryTable *t = dir_rows(app->dir);
+        int hi = app->count;
+        while (lo < hi)
+        {
+                int mid = lo + (hi - lo) / 2;
+                if (entry_group(t, app->order[mid]) <= group)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+        return lo;
+}
+
+/* Where the first name starting with prefix is shown, -1 when none does.
+ * Sorted by name, directories and then files each are in strcmp order and
+ * bisected for an exact match. Anything else, or a prefix only matching in
+ * another case, takes a scan. */
+static int app_prefix_search(const AppState *app, const char *prefix)
+{
+        size_t len = strlen(prefix);
+        if (app->sort == SORT_NAME)
+        {
+                const EntryTable *t = dir_rows(app->dir);
+                int start = app_group_end(app, 0, 0);
+                for (int group = 1; group <= 2; group++)
+                {
+                        int lo = start, hi = app_group_end(app, start, group);
+                        start = hi;
+                        while (lo < hi)
+                        {
+                                int mid = lo + (hi - lo) / 2;
+                                if (strcmp(entry_name(t, app->order[mid]), prefix) < 0)
+                                        lo = mid + 1;
+                                else
+                                        hi = mid;
+                        }
+                        if (lo < start && !strncmp(entry_name(t, app->order[lo]), prefix, len))
+                                return lo;
+                }
+        }
+        for (int i = 0; i < app->count; i++)
+                if (!strncasecmp(app_name(app, i), prefix, len))
+                        return i;
+        return -1;
+}
+
+/* Adds c to the type-ahead prefix and moves the cursor to the first name
+ * starting with it. The same letter over and over steps through the names
+ * starting with it instead. */
+static void app_type_ahead(AppState *app, int c, const UIListParams *params)
+{
+        long long now = now_ms();
+        size_t len = now - app->jump_at < TYPE_AHEAD_MS ? strlen(app->jump) : 0;
+        app->jump_at = now;
+        (len + 1 < sizeof(app->jump)) orelse return;
+        app->jump[len] = (char)c;
+        app->jump[len + 1] = '\0';
+
+        int at = app_prefix_search(app, app->jump);
+        bool repeat = len > 0 && strspn(app->jump, app->jump + len) == len + 1;
+        if (repeat)
+        {
+                int from = app->list.selected_idx;
+                at = -1;
+                for (int k = 1; k <= app->count && at < 0; k++)
+                {
+                        int i = (from + k) % app->count;
+                        if (tolower((unsigned char)app_name(app, i)[0]) == tolower(c))
+                                at = i;
                 }
         }
+        if (at >= 0)
+                app_center_on(app, params, at);
 }
 
 void handle_input(AppState *app, int *key, const UIListParams *params)
@@ -936,11 +4665,51 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                 return;
         }
 
+        /* The finder and the jump and grep prompts take the keys while open,
+         * the filter bar only what is typed into it. */
+        if (app->find || app->recent || app->grep_prompt)
+                return;
+        if (app->filter_open && ((*key >= 32 && *key <= 126) || *key == KEY_BACKSPACE || *key == KEY_ESC))
+                return;
+
+        if (*key == 6) // Ctrl+F -> Find below here
+        {
+                finder_open(app);
+                *key = 0;
+                return;
+        }
+        if (*key == 15) // Ctrl+O -> Jump to a directory visited before
+        {
+                recent_open(app);
+                *key = 0;
+                return;
+        }
+        if (*key == 7) // Ctrl+G -> Search file contents below here
+        {
+                app->grep_prompt = true;
+                *key = 0;
+                return;
+        }
+        bool typing = now_ms() - app->jump_at < TYPE_AHEAD_MS;
+        if (*key > ' ' && *key <= '~' && (typing || !strchr(bound_keys, *key)) && app->count > 0)
+        {
+                app_type_ahead(app, *key, params);
+                *key = 0;
+                return;
+        }
+
+        if (*key == '/') // Filter the listing
+        {
+                app->filter_open = true;
+                *key = 0;
+                return;
+        }
+
         if (*key == 1) // Ctrl+A
         {
                 for (int i = 0; i < app->count; i++)
                 {
-                        if (strcmp(app->entries[i].name, "..") != 0)
+                        if (strcmp(app_name(app, i), "..") != 0)
                                 s->selections[i] = true;
                 }
                 *key = 0;
@@ -964,7 +4733,20 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
 
         // Toggle view with the '1' key
         if (*key == '1')
-                ui_list_set_mode(s, params, !s->mode);
+                ui_list_set_mode(s, params, s->mode == UI_MODE_GRID ? UI_MODE_LIST : UI_MODE_GRID);
+
+        if (*key == '2')
+        {
+                ui_list_set_mode(s, params, s->mode == UI_MODE_TREEMAP ? UI_MODE_LIST : UI_MODE_TREEMAP);
+                app_check_sort_meta(app);
+                *key = 0;
+        }
+
+        if (*key == 's' && !s->carrying && !s->is_dragging)
+        {
+                app_set_sort(app, (app->sort + 1) % SORT_COUNT);
+                *key = 0;
+        }
 
         if (*key == KEY_BACKSPACE)
                 strcpy(app->next_dir, "..");
@@ -975,6 +4757,12 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                 *key = 0;
         }
 
+        if (*key == 21) // Ctrl+U -> Directory sizes
+        {
+                dir_sizes_on = !dir_sizes_on;
+                *key = 0;
+        }
+
         if (*key == 4) // Ctrl+D -> Duplicate
         {
                 bool drag_multi = false;
@@ -987,7 +4775,7 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                 int dup_count = 0;
                 for (int i = 0; i < app->count; i++)
                         if ((drag_multi && s->selections[i]) || (!drag_multi && i == src))
-                                if (strcmp(app->entries[i].name, "..") != 0)
+                                if (strcmp(app_name(app, i), "..") != 0)
                                         dup_count++;
 
                 if (dup_count > 0)
@@ -1009,36 +4797,13 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                         {
                                 if ((drag_multi && s->selections[i]) || (!drag_multi && i == src))
                                 {
-                                        if (strcmp(app->entries[i].name, "..") != 0)
+                                        if (strcmp(app_name(app, i), "..") != 0)
                                         {
                                                 char src_path[PATH_MAX];
-                                                snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
-
-                                                char base_name[256];
-                                                strncpy(base_name, app->entries[i].name, 255);
-                                                base_name[255] = '\0';
-
-                                                char *dot = strrchr(base_name, '.');
-                                                char ext[256] = "";
-                                                if (dot && dot != base_name)
-                                                {
-                                                        strcpy(ext, dot);
-                                                        *dot = '\0';
-                                                }
+                                                snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
 
                                                 char dst_path[PATH_MAX];
-                                                char new_name[512];
-                                                int copy_num = 0;
-                                                struct stat st;
-                                                do
-                                                {
-                                                        if (copy_num == 0)
-                                                                snprintf(new_name, 512, "%s.copy%s", base_name, ext);
-                                                        else
-                                                                snprintf(new_name, 512, "%s.copy%d%s", base_name, copy_num, ext);
-                                                        snprintf(dst_path, PATH_MAX, "%s/%s", app->cwd, new_name);
-                                                        copy_num++;
-                                                } while (stat(dst_path, &st) == 0);
+                                                (copy_dest_path(app->cwd, app_name(app, i), dst_path)) orelse continue;
 
                                                 if (copy_path(src_path, dst_path))
                                                 {
@@ -1082,14 +4847,14 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                 {
                         if ((drag_multi && s->selections[i]) || (!drag_multi && i == src))
                         {
-                                if (strcmp(app->entries[i].name, "..") != 0)
+                                if (strcmp(app_name(app, i), "..") != 0)
                                 {
                                         if (global_clipboard_count >= global_clipboard_cap)
                                         {
                                                 global_clipboard_cap = global_clipboard_cap ? global_clipboard_cap * 2 : 256;
                                                 global_clipboard = realloc(global_clipboard, global_clipboard_cap * PATH_MAX) orelse break;
                                         }
-                                        snprintf(global_clipboard[global_clipboard_count++], PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
+                                        snprintf(global_clipboard[global_clipboard_count++], PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
                                 }
                         }
                 }
@@ -1120,32 +4885,8 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                                 char *base = strrchr(src_path, '/');
                                 base = base ? base + 1 : src_path;
 
-                                char base_name[256];
-                                strncpy(base_name, base, 255);
-                                base_name[255] = '\0';
-
-                                char *dot = strrchr(base_name, '.');
-                                char ext[256] = "";
-
-                                if (dot && dot != base_name)
-                                {
-                                        strcpy(ext, dot);
-                                        *dot = '\0';
-                                }
-
                                 char dst_path[PATH_MAX];
-                                char new_name[512];
-                                int copy_num = 0;
-                                struct stat st;
-                                do
-                                {
-                                        if (copy_num == 0)
-                                                snprintf(new_name, 512, "%s.copy%s", base_name, ext);
-                                        else
-                                                snprintf(new_name, 512, "%s.copy%d%s", base_name, copy_num, ext);
-                                        snprintf(dst_path, PATH_MAX, "%s/%s", app->cwd, new_name);
-                                        copy_num++;
-                                } while (stat(dst_path, &st) == 0);
+                                (copy_dest_path(app->cwd, base, dst_path)) orelse continue;
 
                                 if (copy_path(src_path, dst_path))
                                 {
@@ -1198,13 +4939,13 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                 *key = 0;
         }
 
-        if (*key == KEY_ENTER && app->count > 0 && s->selected_idx >= 0 && app->entries[s->selected_idx].is_dir)
+        if (*key == KEY_ENTER && app->count > 0 && s->selected_idx >= 0 && app_is_dir(app, s->selected_idx))
         {
                 raw char sel_path[PATH_MAX];
-                snprintf(sel_path, PATH_MAX, "%s/%s", app->cwd, app->entries[s->selected_idx].name);
+                snprintf(sel_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, s->selected_idx));
                 if (!is_item_carried(app, sel_path))
                 {
-                        strcpy(app->next_dir, app->entries[s->selected_idx].name);
+                        strcpy(app->next_dir, app_name(app, s->selected_idx));
                 }
                 *key = 0;
         }
@@ -1212,10 +4953,10 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
         if (*key == ' ' && s->carrying)
         {
                 int src = s->selected_idx != -1 ? s->selected_idx : app->last_hovered_idx;
-                if (src >= 0 && src < app->count && strcmp(app->entries[src].name, "..") != 0)
+                if (src >= 0 && src < app->count && strcmp(app_name(app, src), "..") != 0)
                 {
                         raw char src_path[PATH_MAX];
-                        snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app->entries[src].name);
+                        snprintf(src_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, src));
 
                         int found_idx = -1;
                         for (int i = 0; i < app->carried_count; i++)
@@ -1228,7 +4969,7 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                         UIRect r = ui_list_item_rect(s, src);
                         s->fly_origin_x = r.x;
                         s->fly_origin_y = r.y;
-                        app->fly_entry = app->entries[src];
+                        app_entry(app, src, &app->fly_entry);
                         s->fly_anim = 1.0f;
 
                         if (found_idx != -1)
@@ -1250,7 +4991,7 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                                         };
                                 }
                                 s->fly_is_pickup = true;
-                                app->carried[app->carried_count].entry = app->entries[src];
+                                app_entry(app, src, &app->carried[app->carried_count].entry);
                                 strcpy(app->carried[app->carried_count++].path, src_path);
                         }
                 }
@@ -1281,8 +5022,10 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
 
                         for (int i = 0; i < app->carried_count; i++)
                         {
+                                const char *base = strrchr(app->carried[i].path, '/');
+                                base = base ? base + 1 : app->carried[i].path;
                                 raw char new_path[PATH_MAX];
-                                snprintf(new_path, PATH_MAX, "%s/%s", app->cwd, app->carried[i].entry.name);
+                                snprintf(new_path, PATH_MAX, "%s/%s", app->cwd, base);
 
                                 (move_path(app->carried[i].path, new_path)) orelse continue;
 
@@ -1319,15 +5062,15 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                         {
                                 if ((drag_multi && s->selections[i]) || (!drag_multi && i == src))
                                 {
-                                        if (strcmp(app->entries[i].name, "..") != 0)
+                                        if (strcmp(app_name(app, i), "..") != 0)
                                         {
                                                 if (app->carried_count >= app->carried_cap)
                                                 {
                                                         app->carried_cap = app->carried_cap ? app->carried_cap * 2 : 256;
                                                         app->carried = realloc(app->carried, app->carried_cap * sizeof(CarriedFile)) orelse break;
                                                 }
-                                                app->carried[app->carried_count].entry = app->entries[i];
-                                                snprintf(app->carried[app->carried_count++].path, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
+                                                app_entry(app, i, &app->carried[app->carried_count].entry);
+                                                snprintf(app->carried[app->carried_count++].path, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
                                         }
                                 }
                         }
@@ -1340,7 +5083,7 @@ void handle_input(AppState *app, int *key, const UIListParams *params)
                                 {
                                         if ((drag_multi && s->selections[i]) || (!drag_multi && i == src))
                                         {
-                                                if (strcmp(app->entries[i].name, "..") != 0)
+                                                if (strcmp(app_name(app, i), "..") != 0)
                                                 {
                                                         UIRect br = ui_list_item_rect(s, i);
                                                 }
@@ -1356,8 +5099,8 @@ void app_process_drops(AppState *app)
 {
         UIListState *s = &app->list;
 
-        if (s->action_click_idx != -1 && app->entries[s->action_click_idx].is_dir)
-                strcpy(app->next_dir, app->entries[s->action_click_idx].name);
+        if (s->action_click_idx != -1 && app_is_dir(app, s->action_click_idx))
+                strcpy(app->next_dir, app_name(app, s->action_click_idx));
 
         (s->action_drop_src != -1) orelse return;
 
@@ -1380,10 +5123,10 @@ void app_process_drops(AppState *app)
         {
                 ((drag_multi && s->selections[i]) || (!drag_multi && i == src)) orelse continue;
 
-                strcmp(app->entries[i].name, "..") orelse continue;
+                strcmp(app_name(app, i), "..") orelse continue;
 
-                temp_carried[temp_carried_count].entry = app->entries[i];
-                snprintf(temp_carried[temp_carried_count].path, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
+                app_entry(app, i, &temp_carried[temp_carried_count].entry);
+                snprintf(temp_carried[temp_carried_count].path, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
 
                 if (app->drop_count >= app->drop_cap)
                 {
@@ -1394,12 +5137,12 @@ void app_process_drops(AppState *app)
                 temp_carried_count++;
         }
 
-        bool dst_valid = (dst != -1 && app->entries[dst].is_dir && strcmp(app->entries[dst].name, "."));
+        bool dst_valid = (dst != -1 && app_is_dir(app, dst) && strcmp(app_name(app, dst), "."));
         if (dst_valid)
         {
                 for (int i = 0; i < temp_carried_count; i++)
                 {
-                        if (dst == src || !strcmp(temp_carried[i].entry.name, app->entries[dst].name))
+                        if (dst == src || !strcmp(temp_carried[i].entry.name, app_name(app, dst)))
                         {
                                 dst_valid = false;
                                 break;
@@ -1429,8 +5172,10 @@ void app_process_drops(AppState *app)
 
         for (int i = 0; i < temp_carried_count; i++)
         {
+                const char *base = strrchr(temp_carried[i].path, '/');
+                base = base ? base + 1 : temp_carried[i].path;
                 raw char new_path[PATH_MAX];
-                snprintf(new_path, PATH_MAX, "%s/%s/%s", app->cwd, app->entries[dst].name, temp_carried[i].entry.name);
+                snprintf(new_path, PATH_MAX, "%s/%s/%s", app->cwd, app_name(app, dst), base);
 
                 (move_path(temp_carried[i].path, new_path)) orelse continue;
 
@@ -1461,10 +5206,13 @@ void app_render_ui(AppState *app, UIListParams *params, int key)
 
         ui_list_tick_animations(s, active_r.x, active_r.y);
 
+        int first, end;
+        ui_list_visible_range(s, &first, &end);
+
         UIItemResult *cached_items = NULL;
-        if (app->count > 0)
+        if (end > first)
         {
-                cached_items = malloc(app->count * sizeof(UIItemResult));
+                cached_items = malloc((end - first) * sizeof(UIItemResult));
                 if (!cached_items)
                 {
                         ui_list_end(s);
@@ -1472,29 +5220,35 @@ void app_render_ui(AppState *app, UIListParams *params, int key)
                 }
         }
 
-        for (int i = 0; i < app->count; i++)
+        for (int i = first; i < end; i++)
         {
-                if (!ui_list_do_item(s, i, &cached_items[i]))
+                if (!ui_list_do_item(s, i, &cached_items[i - first]))
                 {
-                        cached_items[i].w = -1;
+                        cached_items[i - first].w = -1;
                 }
-                else if (cached_items[i].hovered)
+                else if (cached_items[i - first].hovered)
                 {
                         app->last_hovered_idx = i;
                 }
         }
         ui_list_end(s);
+        if (cached_items)
+                app_request_meta(app, first, end, cached_items);
 
         for (int pass = 0; pass < 2; pass++)
         {
-                for (int i = 0; i < app->count; i++)
+                for (int i = first; i < end; i++)
                 {
-                        if (cached_items[i].w == -1)
+                        if (cached_items[i - first].w == -1)
                                 continue;
 
-                        UIItemResult item = cached_items[i];
+                        UIItemResult item = cached_items[i - first];
+                        raw FileEntry entry;
+                        app_entry(app, i, &entry);
+                        if (entry.is_dir)
+                                dir_model_fill_size(app->dir, app->order[i], &entry);
 
-                        if (strcmp(app->entries[i].name, "..") == 0)
+                        if (strcmp(app_name(app, i), "..") == 0)
                         {
                                 s->selections[i] = false;
                                 item.is_selected = false;
@@ -1504,7 +5258,7 @@ void app_render_ui(AppState *app, UIListParams *params, int key)
                         bool is_sel = (i == s->selected_idx);
 
                         raw char item_path[PATH_MAX];
-                        snprintf(item_path, PATH_MAX, "%s/%s", app->cwd, app->entries[i].name);
+                        snprintf(item_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, i));
 
                         int current_drag = s->is_dragging ? s->drag_idx : s->kb_drag_idx;
                         bool is_carried = is_item_carried(app, item_path);
@@ -1528,153 +5282,726 @@ void app_render_ui(AppState *app, UIListParams *params, int key)
                         bool draw_on_top = (is_ctx_target || is_pressed);
 
                         if (pass == 0 && !is_dropped && !draw_on_top)
-                                draw_item(app, &app->entries[i], &item, is_sel, is_ghost, false, is_popping, false, false);
+                                draw_item(app, &entry, i, &item, is_sel, is_ghost, false, is_popping, false, false);
 
                         if (pass == 1 && !is_dropped && draw_on_top)
-                                draw_item(app, &app->entries[i], &item, is_sel, is_ghost, false, is_popping, is_pressed, is_ctx_target);
+                                draw_item(app, &entry, i, &item, is_sel, is_ghost, false, is_popping, is_pressed, is_ctx_target);
 
                         int anim_x, anim_y;
                         if (pass == 1 && ui_list_get_anim_coords(s, item.x, item.y, is_dropped, is_carried || is_picked_up_mouse, &anim_x, &anim_y))
                         {
-                                draw_item_grid(app, &app->entries[i], anim_x, anim_y, 14, 7, is_sel, false, false, false, false, is_dropped, is_popping, false, false);
+                                draw_item_grid(app, &entry, anim_x, anim_y, 14, 7, is_sel, false, false, false, false, is_dropped, is_popping, false, false);
+                        }
+
+                        if (pass == 0 && item.right_clicked)
+                                ui_context_open(app, i);
+                }
+        }
+
+        if (cached_items)
+                free(cached_items);
+
+        if (ui_get_mouse().right_clicked &&
+            ui_get_mouse().x >= params->x && ui_get_mouse().x < params->x + params->w &&
+            ui_get_mouse().y >= params->y && ui_get_mouse().y < params->y + params->h)
+        {
+                ui_context_open(app, -1);
+        }
+
+        int footer_y = params->y + params->h;
+        ui_rect(0, footer_y, params->w, 1, clr_bar, false);
+        ui_text(1, footer_y, s->carrying ? " Arrows | Enter: Drop | Esc: Cancel | Q: Quit " : " 1: View | S: Sort | Space: Sel | Tab: Move | Esc/Q: Quit ", (Color){0}, clr_bar, false, false);
+
+        int target = ui_context_target();
+        bool is_empty = (target == -1);
+        bool is_dir = (!is_empty && app_is_dir(app, target));
+
+        const char *menu_options[10];
+        int menu_count = 0;
+
+        if (is_empty)
+        {
+                menu_options[menu_count++] = "New Folder";
+                menu_options[menu_count++] = "Close Tab";
+                menu_options[menu_count++] = "Cancel";
+        }
+        else
+        {
+                menu_options[menu_count++] = "Open";
+                if (is_dir)
+                        menu_options[menu_count++] = "View in New Tab";
+                menu_options[menu_count++] = "Rename";
+                menu_options[menu_count++] = "Delete";
+                menu_options[menu_count++] = "Cancel";
+        }
+
+        int selected_action = -1;
+        if (ui_context_do(app, menu_options, menu_count, &selected_action))
+        {
+                const char *action_name = menu_options[selected_action];
+                if (strcmp(action_name, "New Folder") == 0)
+                {
+                        char new_path[PATH_MAX];
+                        int iter = 0;
+                        while (1)
+                        {
+                                if (iter == 0)
+                                        snprintf(new_path, PATH_MAX, "%s/New Folder", app->cwd);
+                                else
+                                        snprintf(new_path, PATH_MAX, "%s/New Folder %d", app->cwd, iter);
+                                struct stat st;
+                                if (!fs_stat_path(new_path, &st, 0, UI_FS_DEADLINE_MS))
+                                {
+                                        (errno != ETIMEDOUT) orelse break;
+                                        fs_vfs->mkdir(new_path, 0777);
+                                        strcpy(app->next_dir, ".");
+                                        break;
+                                }
+                                iter++;
+                        }
+                }
+                else if (strcmp(action_name, "Close Tab") == 0)
+                {
+                        int tab_id = app_tab_id(app);
+                        dock.close_request_tab = tab_id;
+                }
+                else if (strcmp(action_name, "Open") == 0)
+                {
+                        raw char ctx_path[PATH_MAX];
+                        snprintf(ctx_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, target));
+                        if (is_dir && !is_item_carried(app, ctx_path))
+                                strcpy(app->next_dir, app_name(app, target));
+                }
+                else if (strcmp(action_name, "View in New Tab") == 0)
+                {
+                        raw char ctx_path[PATH_MAX];
+                        snprintf(ctx_path, PATH_MAX, "%s/%s", app->cwd, app_name(app, target));
+                        int nt = add_tab(ctx_path);
+                        if (nt >= 0)
+                        {
+                                int tab_id = app_tab_id(app);
+                                int count = ui_dock_leaf_count(&dock);
+                                for (int i = 0; i < count; i++)
+                                {
+                                        int leaf = ui_dock_leaf_nth(&dock, i);
+                                        int at;
+                                        bool act;
+                                        View v;
+                                        if (ui_dock_leaf_get(&dock, leaf, &v, &at, &act))
+                                        {
+                                                if (at == tab_id)
+                                                {
+                                                        ui_dock_add_tab_to_leaf(&dock, leaf, nt);
+                                                        break;
+                                                }
+                                        }
+                                }
                         }
+                }
+                else if (strcmp(action_name, "Delete") == 0)
+                {
+                        app_do_delete(app, target);
+                }
+        }
+
+        int fly_x, fly_y;
+        if (ui_list_get_fly_coords(s, &fly_x, &fly_y))
+        {
+                draw_item_grid(app, &app->fly_entry, fly_x, fly_y, 14, 7, false, false, false, false, false, false, false, false, false);
+        }
+
+        int current_drag = s->is_dragging ? s->drag_idx : s->kb_drag_idx;
+        bool is_carry_valid = s->carrying || (current_drag >= 0 && current_drag < app->count && strcmp(app_name(app, current_drag), ".."));
+
+        if (is_carry_valid && s->pickup_anim <= 0.01f)
+        {
+                int drag_count = s->carrying ? app->carried_count : 0;
+                if (!s->carrying && current_drag >= 0 && s->selections[current_drag])
+                        for (int i = 0; i < app->count; i++)
+                                if (s->selections[i])
+                                        drag_count++;
+
+                raw FileEntry ghost_entry;
+                if (s->carrying)
+                        ghost_entry = app->carried[0].entry;
+                else
+                        app_entry(app, current_drag, &ghost_entry);
+                draw_item_grid(app, &ghost_entry, (int)s->carry_x, (int)s->carry_y, 14, 7, false, false, true, false, false, false, false, false, false);
+                ui_draw_badge((int)s->carry_x + 10, (int)s->carry_y - 1, drag_count == 0 && !s->carrying ? 1 : drag_count);
+        }
+}
+
+AppTab **tabs = NULL;
+UIDockState dock;
+int tab_count = 0, tab_cap = 0;
+
+#define TREEMAP_MAX 256
+
+/* One rectangle of the treemap, in half-block pixels: a cell holds two rows of
+ * them, drawn with "▀" in the upper one's color over the lower one's. */
+typedef struct
+{
+        double weight;
+        int index; /* display index of the row, -1 for the rest lumped together */
+        const char *name;
+        bool is_dir;
+        int x0, y0, x1, y1;
+} TreemapItem;
+
+static int cmp_treemap_items(const void *a, const void *b)
+{
+        double wa = ((const TreemapItem *)a)->weight, wb = ((const TreemapItem *)b)->weight;
+        return (wa < wb) - (wa > wb);
+}
+
+/* Sorts items by weight and folds everything past TREEMAP_MAX into one. */
+static int treemap_sort(TreemapItem *items, int n)
+{
+        qsort(items, n, sizeof(TreemapItem), cmp_treemap_items);
+        (n > TREEMAP_MAX) orelse return n;
+        TreemapItem *rest = &items[TREEMAP_MAX - 1];
+        for (int i = TREEMAP_MAX; i < n; i++)
+                rest->weight += items[i].weight;
+        rest->index = -1;
+        rest->name = "…";
+        rest->is_dir = false;
+        return TREEMAP_MAX;
+}
+
+static double treemap_worst(double row_sum, double largest, double smallest, double side)
+{
+        double a = side * side * largest / (row_sum * row_sum), b = row_sum * row_sum / (side * side * smallest);
+        return a > b ? a : b;
+}
+
+/* Squarified layout of items, largest first, into x, y, w, h. Rows are laid
+ * along the shorter side and grown for as long as that keeps their
+ * rectangles closer to squares. */
+static void treemap_layout(TreemapItem *items, int n, double x, double y, double w, double h)
+{
+        double total = 0;
+        for (int i = 0; i < n; i++)
+                total += items[i].weight;
+        (total > 0 && w > 0 && h > 0) orelse return;
+        double scale = w * h / total;
+
+        for (int i = 0; i < n && w > 0.5 && h > 0.5;)
+        {
+                double side = w < h ? w : h, sum = 0, best = 0;
+                int end = i;
+                while (end < n)
+                {
+                        double area = items[end].weight * scale;
+                        (area > 0) orelse break;
+                        double worst = treemap_worst(sum + area, items[i].weight * scale, area, side);
+                        if (end > i && worst > best)
+                                break;
+                        best = worst;
+                        sum += area;
+                        end++;
+                }
+                (end > i) orelse break;
+
+                double thick = sum / side, off = 0;
+                for (int k = i; k < end; k++)
+                {
+                        double len = items[k].weight * scale / thick;
+                        double rx = w >= h ? x : x + off, ry = w >= h ? y + off : y;
+                        double rw = w >= h ? thick : len, rh = w >= h ? len : thick;
+                        items[k].x0 = (int)(rx + 0.5);
+                        items[k].y0 = (int)(ry + 0.5);
+                        items[k].x1 = (int)(rx + rw + 0.5);
+                        items[k].y1 = (int)(ry + rh + 0.5);
+                        off += len;
+                }
+                if (w >= h)
+                {
+                        x += thick;
+                        w -= thick;
+                }
+                else
+                {
+                        y += thick;
+                        h -= thick;
+                }
+                i = end;
+        }
+}
+
+static Color treemap_shade(Color c, float f)
+{
+        int r = (int)(c.r * f), g = (int)(c.g * f), b = (int)(c.b * f);
+        return (Color){r > 255 ? 255 : r, g > 255 ? 255 : g, b > 255 ? 255 : b};
+}
+
+/* Fills a rectangle with a darker right and bottom edge so neighbours of the
+ * same color stay apart. */
+static void treemap_paint(Color *px, int pw, const TreemapItem *it, Color c)
+{
+        Color edge = treemap_shade(c, 0.55f);
+        for (int y = it->y0; y < it->y1; y++)
+                for (int x = it->x0; x < it->x1; x++)
+                {
+                        bool is_edge = (x == it->x1 - 1 && it->x1 - it->x0 > 1) || (y == it->y1 - 1 && it->y1 - it->y0 > 1);
+                        px[y * pw + x] = is_edge ? edge : c;
+                }
+}
+
+/* Second level: the directories inside a walked one, plus whatever its own
+ * files add up to. Laid out subs are appended to out for their labels. */
+static void treemap_paint_subs(Color *px, int pw, DirSizeTarget *d, const TreemapItem *parent, Color c, TreemapItem *out, int *out_count)
+{
+        int x0 = parent->x0 + 1, x1 = parent->x1 - 1, y0 = ((parent->y0 + 1) / 2 + 1) * 2, y1 = parent->y1 - 1;
+        (x1 - x0 >= 4 && y1 - y0 >= 2) orelse return;
+
+        int count = 1;
+        for (DirSizeSubBlock *b = atomic_load(&d->subs); b; b = b->next)
+                count += atomic_load(&b->count);
+        TreemapItem *subs = malloc(count * sizeof(TreemapItem)) orelse return;
+        defer free(subs);
+        int n = 0;
+        long long rest = atomic_load(&d->bytes);
+        for (DirSizeSubBlock *b = atomic_load(&d->subs); b && n < count - 1; b = b->next)
+        {
+                for (int j = 0; j < atomic_load(&b->count) && n < count - 1; j++)
+                {
+                        long long bytes = atomic_load(&b->subs[j].bytes);
+                        rest -= bytes;
+                        if (bytes > 0)
+                                subs[n++] = (TreemapItem){.weight = (double)bytes, .index = 0, .name = b->subs[j].name, .is_dir = true};
+                }
+        }
+        if (rest > 0)
+                subs[n++] = (TreemapItem){.weight = (double)rest, .index = -1, .name = "", .is_dir = false};
+        n = treemap_sort(subs, n);
+        treemap_layout(subs, n, x0, y0, x1 - x0, y1 - y0);
+        for (int i = 0; i < n; i++)
+        {
+                treemap_paint(px, pw, &subs[i], treemap_shade(c, subs[i].is_dir ? (i % 2 ? 1.2f : 1.4f) : 0.8f));
+                if (subs[i].is_dir && *out_count < TREEMAP_MAX)
+                        out[(*out_count)++] = subs[i];
+        }
+}
+
+static uint32_t treemap_hash(const char *name)
+{
+        uint32_t h = 2166136261u;
+        for (; *name; name++)
+                h = (h ^ (unsigned char)*name) * 16777619u;
+        return h;
+}
+
+/* Writes name and size into out as far as they fit in cols cells, the name
+ * alone if both do not. */
+static void treemap_label(char *out, size_t size, const TreemapItem *it, int cols)
+{
+        raw char size_str[32];
+        format_size(size_str, (off_t)it->weight);
+        const char *size_txt = size_str;
+        while (*size_txt == ' ')
+                size_txt++;
+        int len = snprintf(out, size, "%s %s", it->name, size_txt);
+        if (len > cols)
+                snprintf(out, size, "%s", it->name);
+        for (int b = 0, cells = 0; out[b]; b++)
+        {
+                if ((out[b] & 0xC0) != 0x80 && cells++ == cols)
+                {
+                        out[b] = '\0';
+                        break;
+                }
+        }
+}
+
+/* The listing as nested rectangles sized by what is in them, directories
+ * grow in as their walk adds up. Clicking or Enter opens a directory, the
+ * arrows step through the rectangles from the largest down. */
+void app_render_treemap(AppState *app, UIListParams *params, int key)
+{
+        static const Color palette[] = {{70, 110, 170}, {160, 95, 60}, {75, 135, 85}, {135, 95, 155}, {165, 140, 60}, {60, 135, 145}};
+        UIListState *s = &app->list;
+        DirModel *m = app->dir;
+        const EntryTable *t = dir_rows(m);
+        int w = params->w, h = params->h, ph = h * 2;
+        (w > 0 && h > 0) orelse return;
+
+        TreemapItem *items = malloc((app->count + 1) * sizeof(TreemapItem));
+        defer free(items);
+        Color *px = malloc((size_t)w * ph * sizeof(Color));
+        defer free(px);
+        (items && px) orelse return;
+
+        int n = 0;
+        bool counting = m->load != NULL;
+        for (int i = 0; i < app->count; i++)
+        {
+                uint32_t row = app->order[i];
+                (strcmp(entry_name(t, row), "..")) orelse continue;
+                bool is_dir = t->flags[row] & ENTRY_DIR;
+                off_t bytes = t->size[row];
+                if (is_dir)
+                {
+                        DirSizeTarget *d = dir_model_size_target(m, row);
+                        bytes = d ? atomic_load(&d->bytes) : 0;
+                        counting |= !d || !atomic_load(&d->done);
+                }
+                if (bytes > 0)
+                        items[n++] = (TreemapItem){.weight = (double)bytes, .index = i, .name = entry_name(t, row), .is_dir = is_dir};
+        }
+        n = treemap_sort(items, n);
+        treemap_layout(items, n, 0, 0, w, ph);
+
+        Mouse mouse = ui_get_mouse();
+        int hover = -1;
+        if (!s->ignore_mouse && mouse.x >= params->x && mouse.x < params->x + w && mouse.y >= params->y && mouse.y < params->y + h)
+        {
+                int mx = mouse.x - params->x, my = (mouse.y - params->y) * 2;
+                for (int i = 0; i < n && hover < 0; i++)
+                        if (mx >= items[i].x0 && mx < items[i].x1 && my >= items[i].y0 && my < items[i].y1)
+                                hover = i;
+        }
+
+        int sel = -1;
+        for (int i = 0; i < n && sel < 0; i++)
+                if (items[i].index >= 0 && items[i].index == s->selected_idx)
+                        sel = i;
+        if ((key == KEY_RIGHT || key == KEY_DOWN) && n > 0)
+                sel = sel + 1 < n && items[sel + 1].index >= 0 ? sel + 1 : (sel < 0 ? 0 : sel);
+        else if ((key == KEY_LEFT || key == KEY_UP) && n > 0)
+                sel = sel > 0 ? sel - 1 : 0;
+        if (hover >= 0 && mouse.clicked)
+                sel = hover;
+        if (sel >= 0 && items[sel].index >= 0)
+        {
+                s->selected_idx = items[sel].index;
+                if (items[sel].is_dir && (key == KEY_ENTER || (hover == sel && mouse.clicked)))
+                        snprintf(app->next_dir, PATH_MAX, "%s", items[sel].name);
+        }
 
-                        if (pass == 0 && item.right_clicked)
-                                ui_context_open(app, i);
+        /* Colors go by name so rectangles keep theirs while totals shift. */
+        TreemapItem nested[TREEMAP_MAX];
+        int nested_count = 0;
+        for (int i = 0; i < w * ph; i++)
+                px[i] = (Color){20, 20, 20};
+        for (int i = 0; i < n; i++)
+        {
+                Color c = items[i].index < 0 ? (Color){60, 60, 60} : (items[i].is_dir ? palette[treemap_hash(items[i].name) % 6] : (Color){95, 95, 95});
+                if (i == hover || i == sel)
+                        c = treemap_shade(c, 1.35f);
+                treemap_paint(px, w, &items[i], c);
+                if (items[i].is_dir)
+                {
+                        DirSizeTarget *d = dir_model_size_target(m, app->order[items[i].index]);
+                        if (d)
+                                treemap_paint_subs(px, w, d, &items[i], c, nested, &nested_count);
                 }
         }
 
-        if (cached_items)
-                free(cached_items);
+        for (int y = 0; y < h; y++)
+        {
+                for (int x = 0; x < w; x++)
+                {
+                        Color top = px[y * 2 * w + x], bottom = px[(y * 2 + 1) * w + x];
+                        if (top.r == bottom.r && top.g == bottom.g && top.b == bottom.b)
+                                ui_rect(params->x + x, params->y + y, 1, 1, top, false);
+                        else
+                                ui_text(params->x + x, params->y + y, "▀", top, bottom, false, false);
+                }
+        }
 
-        if (ui_get_mouse().right_clicked &&
-            ui_get_mouse().x >= params->x && ui_get_mouse().x < params->x + params->w &&
-            ui_get_mouse().y >= params->y && ui_get_mouse().y < params->y + params->h)
+        /* Names go on the first cell row wholly inside each rectangle. */
+        raw char label[PATH_MAX];
+        for (int i = 0; i < n + nested_count; i++)
         {
-                ui_context_open(app, -1);
+                const TreemapItem *it = i < n ? &items[i] : &nested[i - n];
+                int ly = (it->y0 + 1) / 2, cols = it->x1 - it->x0 - 1;
+                (cols >= (i < n ? 3 : 6) && ly * 2 + 1 < it->y1) orelse continue;
+                treemap_label(label, sizeof(label), it, cols);
+                Color fg = i >= n ? (Color){200, 200, 200} : (i == sel || i == hover) ? (Color){255, 255, 255} : (Color){230, 230, 230};
+                ui_text(params->x + it->x0, params->y + ly, label, fg, px[ly * 2 * w + it->x0], i == sel, false);
         }
 
         int footer_y = params->y + params->h;
         ui_rect(0, footer_y, params->w, 1, clr_bar, false);
-        ui_text(1, footer_y, s->carrying ? " Arrows | Enter: Drop | Esc: Cancel | Q: Quit " : " 1: View | Space: Sel | Tab: Move | Esc/Q: Quit ", (Color){0}, clr_bar, false, false);
-
-        int target = ui_context_target();
-        bool is_empty = (target == -1);
-        bool is_dir = (!is_empty && app->entries[target].is_dir);
-
-        const char *menu_options[10];
-        int menu_count = 0;
+        ui_text(1, footer_y, " 2: List | Enter: Open | Bksp: Up ", (Color){0}, clr_bar, false, false);
+        int info = hover >= 0 ? hover : sel;
+        if (info >= 0 || counting)
+        {
+                raw char size_str[32];
+                format_size(size_str, info >= 0 ? (off_t)items[info].weight : 0);
+                snprintf(label, sizeof(label), "%s%s%s ", counting ? "counting… " : "", info >= 0 ? items[info].name : "", info >= 0 ? size_str : "");
+                int len = 0;
+                for (int b = 0; label[b]; b++)
+                        if ((label[b] & 0xC0) != 0x80)
+                                len++;
+                if (len < params->w - 38)
+                        ui_text(params->w - len - 1, footer_y, label, (Color){0}, clr_bar, false, false);
+        }
+}
 
-        if (is_empty)
+/* Opens a find result in the tab: a directory itself, a file in the directory
+ * holding it with the file selected once it is listed. */
+static void finder_pick(AppState *app, const FindEntry *e)
+{
+        raw char path[PATH_MAX];
+        fs_join(path, app->find->walk->root, e->path);
+        if (!e->is_dir)
         {
-                menu_options[menu_count++] = "New Folder";
-                menu_options[menu_count++] = "Close Tab";
-                menu_options[menu_count++] = "Cancel";
+                char *slash = strrchr(path, '/');
+                if (slash == path)
+                        slash[1] = '\0';
+                else if (slash)
+                        *slash = '\0';
+                snprintf(app->select_name, sizeof(app->select_name), "%s", e->path + e->name);
         }
-        else
+        snprintf(app->next_dir, PATH_MAX, "%s", path);
+        finder_close(app);
+}
+
+/* A path in a find result, what the query hit highlighted. Too long ones
+ * lose their start. */
+static void finder_draw_path(int x, int y, int w, const FindEntry *e, const bool *marks, Color bg)
+{
+        int cells = e->is_dir ? 1 : 0;
+        for (int i = 0; i < e->len; i++)
+                if ((e->path[i] & 0xC0) != 0x80)
+                        cells++;
+        int skip = 0;
+        if (cells > w)
         {
-                menu_options[menu_count++] = "Open";
-                if (is_dir)
-                        menu_options[menu_count++] = "View in New Tab";
-                menu_options[menu_count++] = "Rename";
-                menu_options[menu_count++] = "Delete";
-                menu_options[menu_count++] = "Cancel";
+                ui_text(x++, y, "…", (Color){140, 140, 140}, bg, false, false);
+                for (int drop = cells - w + 1; drop > 0 && skip < e->len;)
+                        if ((e->path[++skip] & 0xC0) != 0x80)
+                                drop--;
         }
 
-        int selected_action = -1;
-        if (ui_context_do(app, menu_options, menu_count, &selected_action))
+        /* Runs of one color, cut only where a character starts. */
+        raw char run[PATH_MAX];
+        int len = 0, style = -1;
+        for (int i = skip;; i++)
         {
-                const char *action_name = menu_options[selected_action];
-                if (strcmp(action_name, "New Folder") == 0)
-                {
-                        char new_path[PATH_MAX];
-                        int iter = 0;
-                        while (1)
-                        {
-                                if (iter == 0)
-                                        snprintf(new_path, PATH_MAX, "%s/New Folder", app->cwd);
-                                else
-                                        snprintf(new_path, PATH_MAX, "%s/New Folder %d", app->cwd, iter);
-                                struct stat st;
-                                if (stat(new_path, &st) != 0)
-                                {
-                                        mkdir(new_path, 0777);
-                                        strcpy(app->next_dir, ".");
-                                        break;
-                                }
-                                iter++;
-                        }
-                }
-                else if (strcmp(action_name, "Close Tab") == 0)
-                {
-                        int tab_id = (int)((AppTab *)app - tabs);
-                        dock.close_request_tab = tab_id;
-                }
-                else if (strcmp(action_name, "Open") == 0)
-                {
-                        raw char ctx_path[PATH_MAX];
-                        snprintf(ctx_path, PATH_MAX, "%s/%s", app->cwd, app->entries[target].name);
-                        if (is_dir && !is_item_carried(app, ctx_path))
-                                strcpy(app->next_dir, app->entries[target].name);
-                }
-                else if (strcmp(action_name, "View in New Tab") == 0)
-                {
-                        raw char ctx_path[PATH_MAX];
-                        snprintf(ctx_path, PATH_MAX, "%s/%s", app->cwd, app->entries[target].name);
-                        int nt = add_tab(ctx_path);
-                        if (nt >= 0)
-                        {
-                                int tab_id = (int)((AppTab *)app - tabs);
-                                int count = ui_dock_leaf_count(&dock);
-                                for (int i = 0; i < count; i++)
-                                {
-                                        int leaf = ui_dock_leaf_nth(&dock, i);
-                                        int at;
-                                        bool act;
-                                        View v;
-                                        if (ui_dock_leaf_get(&dock, leaf, &v, &at, &act))
-                                        {
-                                                if (at == tab_id)
-                                                {
-                                                        ui_dock_add_tab_to_leaf(&dock, leaf, nt);
-                                                        break;
-                                                }
-                                        }
-                                }
-                        }
-                }
-                else if (strcmp(action_name, "Delete") == 0)
+                bool at_end = i == e->len, starts = at_end || (e->path[i] & 0xC0) != 0x80;
+                int next = at_end ? -1 : marks[i] ? 0 : i < e->name ? 1 : 2;
+                if (starts && next != style && len > 0)
                 {
-                        app_do_delete(app, target);
+                        run[len] = '\0';
+                        Color fg = style == 0 ? (Color){255, 170, 60} : style == 1 ? (Color){140, 140, 140} : e->is_dir ? clr_folder : clr_text;
+                        ui_text(x, y, run, fg, bg, style == 0, false);
+                        for (int b = 0; b < len; b++)
+                                if ((run[b] & 0xC0) != 0x80)
+                                        x++;
+                        len = 0;
                 }
+                if (starts)
+                        style = next;
+                (!at_end) orelse break;
+                run[len++] = e->path[i];
         }
+        if (e->is_dir)
+                ui_text(x, y, "/", clr_folder, bg, false, false);
+}
 
-        int fly_x, fly_y;
-        if (ui_list_get_fly_coords(s, &fly_x, &fly_y))
+/* The filter bar above the listing. What is typed narrows the listing down to
+ * the names holding it, arrows, Enter and the rest still work on the listing.
+ * Esc closes it with everything back in view, as does Backspace once it is
+ * empty. True when it took the key. */
+static bool app_filter_bar(AppState *app, UIListParams *params, int key)
+{
+        if (key == KEY_ESC || (key == KEY_BACKSPACE && !app->filter_query[0]))
         {
-                draw_item_grid(app, &app->fly_entry, fly_x, fly_y, 14, 7, false, false, false, false, false, false, false, false, false);
+                app_filter_clear(app);
+                params->item_count = app->count;
+                return true;
+        }
+        bool typed = (key >= 32 && key <= 126) || key == KEY_BACKSPACE;
+        int x = params->x, y = params->y;
+        int shown_w = 14;
+        ui_rect(x, y, params->w, 1, (Color){45, 45, 45}, false);
+        ui_text(x + 1, y, "Filter:", (Color){140, 140, 140}, (Color){45, 45, 45}, false, false);
+        ui_text_input(x + 8, y, params->w - 8 - shown_w, app->filter_query, sizeof(app->filter_query), typed ? key : 0, true);
+        params->y++;
+        if (params->h > 1)
+                params->h--;
+
+        if (strcmp(app->filter, app->filter_query))
+        {
+                app_filter_apply(app);
+                app_center_on(app, params, app->list.selected_idx);
         }
+        params->item_count = app->count;
+        raw char shown[32];
+        snprintf(shown, sizeof(shown), "%d shown", app->count);
+        ui_text(x + params->w - (int)strlen(shown) - 1, y, shown, (Color){100, 100, 100}, (Color){45, 45, 45}, false, false);
+        return typed;
+}
 
-        int current_drag = s->is_dragging ? s->drag_idx : s->kb_drag_idx;
-        bool is_carry_valid = s->carrying || (current_drag >= 0 && current_drag < app->count && strcmp(app->entries[current_drag].name, ".."));
+/* The bar a content search is typed into, above the listing. Enter runs it,
+ * Tab leaves hidden and ignored trees out or back in, Esc closes. True when
+ * it took the key. */
+static bool app_grep_prompt(AppState *app, UIListParams *params, int key)
+{
+        if (key == KEY_ESC || key == 7)
+        {
+                app->grep_prompt = false;
+                return true;
+        }
+        if (key == '\t')
+        {
+                find_skip = !find_skip;
+                key = 0;
+        }
+        int x = params->x, y = params->y;
+        ui_rect(x, y, params->w, 1, (Color){45, 45, 45}, false);
+        ui_text(x + 1, y, "Grep:", (Color){140, 140, 140}, (Color){45, 45, 45}, false, false);
+        const char *scope = find_skip ? "Tab: Show Hidden " : "Tab: Skip Hidden ";
+        int scope_w = (int)strlen(scope) + 1;
+        ui_text_input(x + 6, y, params->w - 6 - scope_w, app->grep_query, sizeof(app->grep_query), key == KEY_ENTER ? 0 : key, true);
+        ui_text(x + params->w - scope_w, y, scope, (Color){100, 100, 100}, (Color){45, 45, 45}, false, false);
+        params->y++;
+        if (params->h > 1)
+                params->h--;
+
+        if (key == KEY_ENTER && app->grep_query[0])
+        {
+                app->grep_prompt = false;
+                app_load_grep(app, app->grep_query);
+                params->item_count = app->count;
+        }
+        return key != 0;
+}
 
-        if (is_carry_valid && s->pickup_anim <= 0.01f)
+/* The finder in place of the listing: the query on top, the best matches
+ * under it. Enter or a click opens one, Tab leaves hidden and ignored trees
+ * out or back in, Esc closes. */
+void app_render_finder(AppState *app, UIListParams *params, int key)
+{
+        Finder *f = app->find;
+        if (key == KEY_ESC || key == 6)
         {
-                int drag_count = s->carrying ? app->carried_count : 0;
-                if (!s->carrying && current_drag >= 0 && s->selections[current_drag])
-                        for (int i = 0; i < app->count; i++)
-                                if (s->selections[i])
-                                        drag_count++;
+                finder_close(app);
+                return;
+        }
+        if (key == '\t')
+        {
+                find_skip = !find_skip;
+                finder_restart(f, f->walk->root);
+                key = 0;
+        }
+        FindWalk *w = f->walk;
+        bool nav = key >= KEY_UP && key <= KEY_SHIFT_PAGE_DOWN;
+        int x = params->x, y = params->y;
+        ui_rect(x, y, params->w, 1, (Color){45, 45, 45}, false);
+        ui_text(x + 1, y, "Find:", (Color){140, 140, 140}, (Color){45, 45, 45}, false, false);
+        ui_text_input(x + 6, y, params->w - 6, f->query, sizeof(f->query), nav || key == KEY_ENTER ? 0 : key, true);
+
+        finder_rank(f);
+        if (f->heap_dirty)
+        {
+                memcpy(f->shown, f->heap, f->heap_count * sizeof(FindHit));
+                qsort(f->shown, f->heap_count, sizeof(FindHit), cmp_find_hits);
+                f->shown_count = f->heap_count;
+                f->heap_dirty = false;
+        }
 
-                FileEntry *ghost_entry = s->carrying ? &app->carried[0].entry : &app->entries[current_drag];
-                draw_item_grid(app, ghost_entry, (int)s->carry_x, (int)s->carry_y, 14, 7, false, false, true, false, false, false, false, false, false);
-                ui_draw_badge((int)s->carry_x + 10, (int)s->carry_y - 1, drag_count == 0 && !s->carrying ? 1 : drag_count);
+        UIListParams lp = {x, y + 1, params->w, params->h - 1 > 0 ? params->h - 1 : 1, f->shown_count, params->w, 1, clr_bg, {30, 30, 30}, clr_bar};
+        UIListState *s = &f->list;
+        if (s->selected_idx >= f->shown_count)
+                s->selected_idx = f->shown_count - 1;
+        if (s->selected_idx < 0 && f->shown_count > 0)
+                s->selected_idx = 0;
+        ui_list_begin(s, &lp, nav ? key : 0);
+        int first, end;
+        ui_list_visible_range(s, &first, &end);
+        int pick = key == KEY_ENTER ? s->selected_idx : -1;
+        raw bool marks[PATH_MAX];
+        for (int i = first; i < end; i++)
+        {
+                raw UIItemResult item;
+                (ui_list_do_item(s, i, &item)) orelse continue;
+                if (item.clicked)
+                        pick = i;
+                FindEntry *e = find_entry(w, f->shown[i].entry);
+                Color bg = i == s->selected_idx ? clr_sel_bg : item.hovered ? (Color){35, 35, 35} : clr_bg;
+                ui_rect(item.x, item.y, item.w - 1, 1, bg, false);
+                memset(marks, 0, e->len);
+                if (f->needle[0])
+                        find_score(f->needle, f->fold, e, marks);
+                finder_draw_path(item.x + 1, item.y, item.w - 3, e, marks, bg);
         }
+        ui_list_end(s);
+
+        int footer_y = params->y + params->h;
+        ui_rect(0, footer_y, params->w, 1, clr_bar, false);
+        ui_text(1, footer_y, find_skip ? " Enter: Open | Tab: Show Hidden | Esc: Close " : " Enter: Open | Tab: Skip Hidden | Esc: Close ", (Color){0}, clr_bar, false, false);
+        raw char info[96];
+        int len = snprintf(info, sizeof(info), "%s%d of %d ", atomic_load(&w->done) ? "" : "walking… ", f->match_count, atomic_load(&w->count));
+        if (len < params->w - 48)
+                ui_text(params->w - len, footer_y, info, (Color){0}, clr_bar, false, false);
+
+        if (pick >= 0 && pick < f->shown_count)
+                finder_pick(app, find_entry(w, f->shown[pick].entry));
 }
 
-AppTab tabs[MAX_TABS];
-UIDockState dock;
-int tab_count = 0;
+/* The jump prompt in place of the listing: the query on top, the visited
+ * directories matching it under it, best first. Enter or a click goes to
+ * one, Esc closes. */
+void app_render_recent(AppState *app, UIListParams *params, int key)
+{
+        RecentPrompt *r = app->recent;
+        if (key == KEY_ESC || key == 15)
+        {
+                recent_close(app);
+                return;
+        }
+        bool nav = key >= KEY_UP && key <= KEY_SHIFT_PAGE_DOWN;
+        int x = params->x, y = params->y;
+        ui_rect(x, y, params->w, 1, (Color){45, 45, 45}, false);
+        ui_text(x + 1, y, "Jump:", (Color){140, 140, 140}, (Color){45, 45, 45}, false, false);
+        ui_text_input(x + 6, y, params->w - 6, r->query, sizeof(r->query), nav || key == KEY_ENTER ? 0 : key, true);
+        recent_rank(r);
+
+        UIListParams lp = {x, y + 1, params->w, params->h - 1 > 0 ? params->h - 1 : 1, r->shown_count, params->w, 1, clr_bg, {30, 30, 30}, clr_bar};
+        UIListState *s = &r->list;
+        if (s->selected_idx >= r->shown_count)
+                s->selected_idx = r->shown_count - 1;
+        if (s->selected_idx < 0 && r->shown_count > 0)
+                s->selected_idx = 0;
+        ui_list_begin(s, &lp, nav ? key : 0);
+        int first, end;
+        ui_list_visible_range(s, &first, &end);
+        int pick = key == KEY_ENTER ? s->selected_idx : -1;
+        raw bool marks[PATH_MAX];
+        for (int i = first; i < end; i++)
+        {
+                raw UIItemResult item;
+                (ui_list_do_item(s, i, &item)) orelse continue;
+                if (item.clicked)
+                        pick = i;
+                const RecentDir *d = r->shown[i];
+                FindEntry e = {d->path, d->len, d->name, d->len > 1};
+                Color bg = i == s->selected_idx ? clr_sel_bg : item.hovered ? (Color){35, 35, 35} : clr_bg;
+                ui_rect(item.x, item.y, item.w - 1, 1, bg, false);
+                memset(marks, 0, e.len);
+                if (r->needle[0])
+                        find_score(r->needle, r->fold, &e, marks);
+                finder_draw_path(item.x + 1, item.y, item.w - 3, &e, marks, bg);
+        }
+        ui_list_end(s);
+
+        int footer_y = params->y + params->h;
+        ui_rect(0, footer_y, params->w, 1, clr_bar, false);
+        ui_text(1, footer_y, " Enter: Go | Esc: Close ", (Color){0}, clr_bar, false, false);
+        raw char info[64];
+        int len = snprintf(info, sizeof(info), "%d of %d ", r->shown_count, r->count);
+        if (len < params->w - 26)
+                ui_text(params->w - len, footer_y, info, (Color){0}, clr_bar, false, false);
+
+        if (pick >= 0 && pick < r->shown_count)
+        {
+                snprintf(app->next_dir, PATH_MAX, "%s", r->shown[pick]->path);
+                recent_close(app);
+        }
+}
 
 const char *tab_title_from_cwd(const char *cwd)
 {
@@ -1686,51 +6013,246 @@ const char *tab_title_from_cwd(const char *cwd)
         return base + 1;
 }
 
-int add_tab(const char *dir)
+/* Index of a new zeroed tab that is not in use yet, -1 when out of memory. */
+static int tab_append(void)
+{
+        if (tab_count == tab_cap)
+        {
+                int cap = tab_cap ? tab_cap * 2 : 8;
+                AppTab **grown = realloc(tabs, cap * sizeof(AppTab *)) orelse return -1;
+                tabs = grown;
+                tab_cap = cap;
+        }
+        tabs[tab_count] = calloc(1, sizeof(AppTab)) orelse return -1;
+        return tab_count++;
+}
+
+/* Same, reusing the index of a closed tab if there is one. */
+static int tab_alloc(void)
 {
-        for (int i = 0; i < MAX_TABS; i++)
+        for (int i = 0; i < tab_count; i++)
         {
-                if (!tabs[i].in_use)
+                if (!tabs[i]->in_use)
                 {
-                        memset(&tabs[i], 0, sizeof(AppTab));
-                        tabs[i].in_use = true;
-                        tabs[i].app.last_hovered_idx = -1;
-                        ui_list_reset(&tabs[i].app.list);
-                        snprintf(tabs[i].app.trash_dir, PATH_MAX, "/tmp/prism_trash_%d_%d", getpid(), i);
-                        mkdir(tabs[i].app.trash_dir, 0777);
-                        app_load_dir(&tabs[i].app, dir);
-                        if (i >= tab_count)
-                                tab_count = i + 1;
+                        memset(tabs[i], 0, sizeof(AppTab));
                         return i;
                 }
         }
-        return -1;
+        return tab_append();
+}
+
+/* Marks tab i in use with an empty view. Its trash directory is only
+ * created once it is awake. */
+static void tab_init(int i)
+{
+        tabs[i]->in_use = true;
+        tabs[i]->app.last_hovered_idx = -1;
+        ui_list_reset(&tabs[i]->app.list);
+        snprintf(tabs[i]->app.trash_dir, PATH_MAX, "/tmp/prism_trash_%d_%d", getpid(), i);
+}
+
+int add_tab(const char *dir)
+{
+        int i = tab_alloc();
+        (i >= 0) orelse return -1;
+        tab_init(i);
+        fs_vfs->mkdir(tabs[i]->app.trash_dir, 0777);
+        if (!app_load_dir(&tabs[i]->app, dir))
+                snprintf(tabs[i]->app.next_dir, PATH_MAX, "%s", dir);
+        return i;
+}
+
+/* Frees everything of the tab that is rebuilt when it shows a directory
+ * again, down to its share of the listing. */
+static void app_release(AppState *app)
+{
+        finder_close(app);
+        recent_close(app);
+        app->select_name[0] = '\0';
+        app_cancel_prefetch(app, 0);
+        app_cancel_prefetch(app, 1);
+        app_filter_clear(app);
+        app_leave_dir(app);
+        free(app->order);
+        app->order = NULL;
+        app->order_cap = 0;
+        for (int m = 0; m < SORT_COUNT; m++)
+        {
+                free(app->sort_cache[m].order);
+                app->sort_cache[m] = (SortCache){NULL, -1, 0};
+        }
+        free(app->carried);
+        app->carried = NULL;
+        app->carried_count = app->carried_cap = 0;
+        free(app->drop_paths);
+        app->drop_paths = NULL;
+        app->drop_count = app->drop_cap = 0;
+        free(app->pop_paths);
+        app->pop_paths = NULL;
+        app->pop_count = app->pop_cap = 0;
+        app->pop_anim = 0.0f;
+        free(app->list.selections);
+        free(app->list.active_box_selections);
+        app->list.selections = app->list.active_box_selections = NULL;
+        app->list.selections_cap = 0;
+}
+
+/* A tab off screen that is not in the middle of something can go to sleep. */
+static bool tab_can_sleep(const AppTab *tab)
+{
+        const AppState *app = &tab->app;
+        return tab->in_use && !tab->asleep && !tab->shown && !app->next_dir[0] && !app->find && !app->recent && !app->grep_prompt && !app->filter_open &&
+               !(app->dir && app->dir->grep[0]) && app->carried_count == 0 &&
+               !app->list.carrying && !app->list.is_dragging && app->list.drop_anim <= 0.0f && app->pop_anim <= 0.0f;
+}
+
+/* The listing usually goes to the listing cache on the way out, which is
+ * where waking up finds it again. The trash directory stays while it holds
+ * something to undo. */
+static void tab_sleep(AppTab *tab)
+{
+        app_release(&tab->app);
+        tab->app.prefetch[0].path[0] = tab->app.prefetch[1].path[0] = '\0';
+        fs_vfs->rmdir(tab->app.trash_dir);
+        tab->asleep = true;
+}
+
+static void tab_wake(AppTab *tab)
+{
+        AppState *app = &tab->app;
+        float scroll = app->list.target_scroll;
+        tab->asleep = false;
+        fs_vfs->mkdir(app->trash_dir, 0777);
+        if (!app_load_dir(app, app->cwd))
+                strcpy(app->next_dir, app->cwd);
+        app->list.target_scroll = app->list.current_scroll = scroll;
 }
 
 void close_tab(int t)
 {
-        if (t < 0 || !tabs[t].in_use)
+        if (t < 0 || t >= tab_count || !tabs[t]->in_use)
                 return;
-        rm_rf(tabs[t].app.trash_dir);
-        free(tabs[t].app.entries);
-        free(tabs[t].app.carried);
-        free(tabs[t].app.drop_paths);
-        free(tabs[t].app.pop_paths);
-        free(tabs[t].app.list.selections);
-        free(tabs[t].app.list.active_box_selections);
-        tabs[t].in_use = false;
+        rm_rf(tabs[t]->app.trash_dir);
+        app_release(&tabs[t]->app);
+        tabs[t]->in_use = false;
         ui_dock_remove_tab(&dock, t);
 }
 
+/* The layout file, all fields in host byte order:
+ *
+ *   "EXLY" u16 version
+ *   i16 root, i16 active_leaf, u8 node_count
+ *   per node:  i16 index, kind, parent, first, second, active_tab, tab_count
+ *              f32 split_frac, i16 tabs[tab_count]
+ *   u16 tab_count
+ *   per tab:   u8 in_use, mode, sort; if in use f32 scroll, u16 len, cwd[len]
+ *
+ * Anything that does not parse, including other versions, falls back to the
+ * default layout. */
+#define LAYOUT_MAGIC "EXLY"
+#define LAYOUT_VERSION 1
+#define LAYOUT_MAX_BYTES (1 << 20)
+
+typedef struct
+{
+        const uint8_t *p, *end;
+        bool ok;
+} LayoutReader;
+
+static void layout_read(LayoutReader *r, void *out, size_t n)
+{
+        if (!r->ok || (size_t)(r->end - r->p) < n)
+        {
+                r->ok = false;
+                memset(out, 0, n);
+                return;
+        }
+        memcpy(out, r->p, n);
+        r->p += n;
+}
+
 typedef struct
 {
-        UIDockState dock;
-        int tab_count;
-        char cwds[MAX_TABS][PATH_MAX];
-        UIListMode modes[MAX_TABS];
-        float scrolls[MAX_TABS];
-} LayoutSave;
+        bool in_use;
+        uint8_t mode, sort;
+        float scroll;
+        char cwd[PATH_MAX];
+} LayoutTab;
+
+static bool layout_read_dock(LayoutReader *r, UIDockState *d)
+{
+        ui_dock_init(d);
+        d->nodes[0].in_use = false;
+
+        raw int16_t hdr[2];
+        raw uint8_t node_count;
+        layout_read(r, hdr, sizeof(hdr));
+        layout_read(r, &node_count, 1);
+        for (int k = 0; k < node_count && r->ok; k++)
+        {
+                raw int16_t rec[7];
+                raw float frac;
+                layout_read(r, rec, sizeof(rec));
+                layout_read(r, &frac, sizeof(frac));
+                int i = rec[0];
+                (r->ok && i >= 0 && i < UI_DOCK_MAX_NODES && !d->nodes[i].in_use && rec[6] >= 0 && rec[6] <= UI_DOCK_MAX_TABS) orelse return false;
+
+                UIDockNode *n = &d->nodes[i];
+                n->in_use = true;
+                n->kind = rec[1] == UI_DOCK_NODE_SPLIT_H ? UI_DOCK_NODE_SPLIT_H : UI_DOCK_NODE_LEAF;
+                n->parent = rec[2];
+                n->first = rec[3];
+                n->second = rec[4];
+                n->active_tab = rec[5];
+                n->tab_count = rec[6];
+                n->split_frac = frac > 0.05f && frac < 0.95f ? frac : 0.5f;
+                for (int t = 0; t < n->tab_count; t++)
+                {
+                        raw int16_t id;
+                        layout_read(r, &id, sizeof(id));
+                        n->tabs[t] = id;
+                }
+        }
+        (r->ok) orelse return false;
+
+        d->root = hdr[0];
+        d->active_leaf = hdr[1];
+        bool in_range = d->root >= 0 && d->root < UI_DOCK_MAX_NODES && d->active_leaf >= 0 && d->active_leaf < UI_DOCK_MAX_NODES;
+        (in_range && d->nodes[d->root].in_use && d->nodes[d->active_leaf].in_use && d->nodes[d->active_leaf].kind == UI_DOCK_NODE_LEAF) orelse return false;
+
+        /* Every node in use has to hang off root exactly once, with parent
+         * pointing back up, or the recursive walks over the tree go round in
+         * circles. */
+        raw int stack[UI_DOCK_MAX_NODES];
+        bool seen[UI_DOCK_MAX_NODES] = {0};
+        int top = 0, reached = 0, in_use = 0;
+        (d->nodes[d->root].parent == -1) orelse return false;
+        stack[top++] = d->root;
+        seen[d->root] = true;
+        while (top > 0)
+        {
+                int i = stack[--top];
+                const UIDockNode *n = &d->nodes[i];
+                reached++;
+                (n->kind == UI_DOCK_NODE_SPLIT_H) orelse continue;
+                int kids[2] = {n->first, n->second};
+                for (int c = 0; c < 2; c++)
+                {
+                        int k = kids[c];
+                        bool ok = k >= 0 && k < UI_DOCK_MAX_NODES && !seen[k];
+                        (ok && d->nodes[k].in_use && d->nodes[k].parent == i) orelse return false;
+                        seen[k] = true;
+                        stack[top++] = k;
+                }
+        }
+        for (int i = 0; i < UI_DOCK_MAX_NODES; i++)
+                in_use += d->nodes[i].in_use;
+        return reached == in_use;
+}
 
+/* Puts back the dock and the tabs of the last session. Tabs come back asleep
+ * with only cwd, sort, view mode and scroll; the ones a leaf shows are loaded
+ * as the first frame draws them, the rest when they are first activated. */
 bool load_layout(void)
 {
         const char *home = getenv("HOME");
@@ -1741,91 +6263,171 @@ bool load_layout(void)
         FILE *f = fopen(path, "rb");
         if (!f)
                 return false;
-
-        LayoutSave s;
-        if (fread(&s, sizeof(s), 1, f) != 1)
+        uint8_t *buf = malloc(LAYOUT_MAX_BYTES) orelse
         {
                 fclose(f);
                 return false;
-        }
+        };
+        defer free(buf);
+        size_t size = fread(buf, 1, LAYOUT_MAX_BYTES, f);
         fclose(f);
 
-        if (s.tab_count < 0 || s.tab_count > MAX_TABS)
-                return false;
+        LayoutReader r = {buf, buf + size, true};
+        raw char magic[4];
+        raw uint16_t version;
+        layout_read(&r, magic, sizeof(magic));
+        layout_read(&r, &version, sizeof(version));
+        (r.ok && !memcmp(magic, LAYOUT_MAGIC, 4) && version == LAYOUT_VERSION) orelse return false;
+
+        raw UIDockState d;
+        (layout_read_dock(&r, &d)) orelse return false;
+
+        raw uint16_t ntabs;
+        layout_read(&r, &ntabs, sizeof(ntabs));
+        LayoutTab *lt = calloc(ntabs ? ntabs : 1, sizeof(LayoutTab)) orelse return false;
+        defer free(lt);
+        for (int i = 0; i < ntabs && r.ok; i++)
+        {
+                raw uint8_t rec[3];
+                layout_read(&r, rec, sizeof(rec));
+                (rec[0]) orelse continue;
+                raw uint16_t len;
+                layout_read(&r, &lt[i].scroll, sizeof(float));
+                layout_read(&r, &len, sizeof(len));
+                (len > 0 && len < PATH_MAX) orelse return false;
+                layout_read(&r, lt[i].cwd, len);
+                lt[i].in_use = lt[i].cwd[0] == '/' && rec[1] <= UI_MODE_TREEMAP && rec[2] < SORT_COUNT;
+                lt[i].mode = rec[1];
+                lt[i].sort = rec[2];
+        }
+        (r.ok) orelse return false;
 
-        dock = s.dock;
-        dock.dragging_tab = -1;
-        dock.drag_src_leaf = -1;
-        dock.pending_tab = -1;
-        dock.pending_leaf = -1;
-        dock.close_request_tab = -1;
-        dock.add_request_leaf = -1;
+        /* Leaves only keep tabs that made it, an emptied leaf starts out with
+         * nothing in it like after closing its last tab. */
+        for (int i = 0; i < UI_DOCK_MAX_NODES; i++)
+        {
+                UIDockNode *n = &d.nodes[i];
+                (n->in_use && n->kind == UI_DOCK_NODE_LEAF) orelse continue;
+                int kept = 0;
+                for (int t = 0; t < n->tab_count; t++)
+                        if (n->tabs[t] >= 0 && n->tabs[t] < ntabs && lt[n->tabs[t]].in_use)
+                                n->tabs[kept++] = n->tabs[t];
+                n->tab_count = kept;
+                if (ui_dock_leaf_find_tab(n, n->active_tab) < 0)
+                        n->active_tab = kept > 0 ? n->tabs[0] : -1;
+        }
 
-        tab_count = s.tab_count;
-        for (int i = 0; i < tab_count; i++)
+        for (int i = 0; i < ntabs; i++)
         {
-                if (s.cwds[i][0] != '\0')
-                {
-                        memset(&tabs[i], 0, sizeof(AppTab));
-                        tabs[i].in_use = true;
-                        tabs[i].app.last_hovered_idx = -1;
-                        ui_list_reset(&tabs[i].app.list);
-                        snprintf(tabs[i].app.trash_dir, PATH_MAX, "/tmp/prism_trash_%d_%d", getpid(), i);
-                        mkdir(tabs[i].app.trash_dir, 0777);
-                        app_load_dir(&tabs[i].app, s.cwds[i]);
-                        tabs[i].app.list.mode = s.modes[i];
-                        tabs[i].app.list.target_scroll = s.scrolls[i];
-                        tabs[i].app.list.current_scroll = s.scrolls[i];
-                }
+                (tab_append() == i) orelse return false;
+                (lt[i].in_use) orelse continue;
+                tab_init(i);
+                AppTab *tab = tabs[i];
+                strcpy(tab->app.cwd, lt[i].cwd);
+                tab->app.sort = lt[i].sort;
+                tab->app.list.mode = lt[i].mode;
+                tab->app.list.target_scroll = lt[i].scroll;
+                tab->app.list.current_scroll = lt[i].scroll;
+                tab->asleep = true;
         }
+        dock = d;
         return true;
 }
 
+/* Written next to the old file and renamed over it, a crash halfway leaves
+ * the previous layout in place. */
 void save_layout(void)
 {
         const char *home = getenv("HOME");
         if (!home)
                 return;
-        char path[PATH_MAX];
+        char path[PATH_MAX], tmp[PATH_MAX];
         snprintf(path, PATH_MAX, "%s/.cache", home);
         mkdir(path, 0755);
         snprintf(path, PATH_MAX, "%s/.cache/explore_layout.bin", home);
+        snprintf(tmp, PATH_MAX, "%s.%d", path, getpid());
 
-        FILE *f = fopen(path, "wb");
+        FILE *f = fopen(tmp, "wb");
         if (!f)
                 return;
 
-        LayoutSave s;
-        memset(&s, 0, sizeof(s));
-        s.dock = dock;
-        s.tab_count = tab_count;
-
-        for (int i = 0; i < tab_count; i++)
+        uint16_t version = LAYOUT_VERSION;
+        fwrite(LAYOUT_MAGIC, 4, 1, f);
+        fwrite(&version, sizeof(version), 1, f);
+
+        int16_t hdr[2] = {(int16_t)dock.root, (int16_t)dock.active_leaf};
+        uint8_t node_count = 0;
+        for (int i = 0; i < UI_DOCK_MAX_NODES; i++)
+                node_count += dock.nodes[i].in_use;
+        fwrite(hdr, sizeof(hdr), 1, f);
+        fwrite(&node_count, 1, 1, f);
+        for (int i = 0; i < UI_DOCK_MAX_NODES; i++)
         {
-                if (tabs[i].in_use)
+                const UIDockNode *n = &dock.nodes[i];
+                (n->in_use) orelse continue;
+                int16_t rec[7] = {(int16_t)i, (int16_t)n->kind, (int16_t)n->parent, (int16_t)n->first, (int16_t)n->second, (int16_t)n->active_tab, (int16_t)n->tab_count};
+                fwrite(rec, sizeof(rec), 1, f);
+                fwrite(&n->split_frac, sizeof(float), 1, f);
+                for (int t = 0; t < n->tab_count; t++)
                 {
-                        strncpy(s.cwds[i], tabs[i].app.cwd, PATH_MAX);
-                        s.modes[i] = tabs[i].app.list.mode;
-                        s.scrolls[i] = tabs[i].app.list.target_scroll;
+                        int16_t id = (int16_t)n->tabs[t];
+                        fwrite(&id, sizeof(id), 1, f);
                 }
         }
 
-        fwrite(&s, sizeof(s), 1, f);
-        fclose(f);
+        uint16_t ntabs = (uint16_t)tab_count;
+        fwrite(&ntabs, sizeof(ntabs), 1, f);
+        for (int i = 0; i < ntabs; i++)
+        {
+                const AppState *app = &tabs[i]->app;
+                uint8_t rec[3] = {tabs[i]->in_use, (uint8_t)app->list.mode, (uint8_t)app->sort};
+                fwrite(rec, sizeof(rec), 1, f);
+                (tabs[i]->in_use) orelse continue;
+                uint16_t len = (uint16_t)strlen(app->cwd);
+                fwrite(&app->list.target_scroll, sizeof(float), 1, f);
+                fwrite(&len, sizeof(len), 1, f);
+                fwrite(app->cwd, len, 1, f);
+        }
+
+        bool ok = !ferror(f);
+        if (fclose(f) == 0 && ok)
+                rename(tmp, path);
+        else
+                unlink(tmp);
 }
 
 int main(int argc, char **argv)
 {
         const char *start_dir = argc > 1 ? argv[1] : ".";
+        eager_stat = getenv("EAGER_STAT") != NULL;
+
+        /* Another filesystem backend only stands in for what is browsed. The
+         * layout and snapshots describe the real disk, so they are left
+         * alone. */
+        const char *vfs = getenv("EXPLORE_VFS");
+        if (vfs)
+        {
+                fs_vfs = memfs_create(vfs) orelse
+                {
+                        fprintf(stderr, "explore: unknown EXPLORE_VFS '%s'\n", vfs);
+                        return 1;
+                };
+                if (argc <= 1)
+                        start_dir = "/";
+        }
+        bool persist = fs_vfs == &fs_posix;
 
         term_init() orelse return 1;
         defer term_restore();
         defer ui_action_clear();
+        term_watch_fd(fs_jobs_wake_fd());
+        term_watch_fd(fs_watch_fd());
 
-        memset(tabs, 0, sizeof(tabs));
         ui_dock_init(&dock);
+        if (persist)
+                snapshot_open();
 
-        if (!load_layout())
+        if (!persist || !load_layout())
         {
                 int t0 = add_tab(start_dir);
                 int t1 = add_tab(start_dir);
@@ -1836,26 +6438,39 @@ int main(int argc, char **argv)
                 else
                         ui_dock_add_tab_to_leaf(&dock, 0, t1);
         }
-        else
+        else if (dock.nodes[dock.active_leaf].active_tab < 0)
         {
-                int active_leaf = dock.active_leaf;
-                if (active_leaf >= 0 && active_leaf < UI_DOCK_MAX_NODES)
+                int t = add_tab(start_dir);
+                if (t >= 0)
+                        ui_dock_add_tab_to_leaf(&dock, dock.active_leaf, t);
+        }
+        else if (argc > 1)
+        {
+                /* A directory given on the command line opens in the active
+                 * tab instead of the one it had, relative to where we run. */
+                int tab_id = dock.nodes[dock.active_leaf].active_tab;
+                if (tab_id >= 0 && tab_id < tab_count && tabs[tab_id]->in_use)
                 {
-                        int tab_id = dock.nodes[active_leaf].active_tab;
-                        if (tab_id >= 0 && tab_id < MAX_TABS && tabs[tab_id].in_use)
-                        {
-                                app_load_dir(&tabs[tab_id].app, start_dir);
-                                tabs[tab_id].app.list.target_scroll = 0;
-                                tabs[tab_id].app.list.current_scroll = 0;
-                        }
+                        AppTab *tab = tabs[tab_id];
+                        tab->asleep = false;
+                        tab->app.cwd[0] = '\0';
+                        fs_vfs->mkdir(tab->app.trash_dir, 0777);
+                        if (!app_load_dir(&tab->app, start_dir))
+                                snprintf(tab->app.next_dir, PATH_MAX, "%s", start_dir);
+                        tab->app.list.target_scroll = 0;
+                        tab->app.list.current_scroll = 0;
                 }
         }
 
         defer
         {
-                save_layout();
+                if (persist)
+                {
+                        save_layout();
+                        save_snapshots();
+                }
                 for (int i = 0; i < tab_count; i++)
-                        if (tabs[i].in_use)
+                        if (tabs[i]->in_use)
                                 close_tab(i);
         }
 
@@ -1865,27 +6480,89 @@ int main(int argc, char **argv)
         while (!quit)
         {
                 bool animating = false;
+                long long now = now_ms(), wake_at = 0;
+                for (DirModel *m = dir_models; m; m = m->next)
+                {
+                        if (!m->watched && now >= m->poll_due)
+                        {
+                                long long sec = m->last_mtime, ns = m->last_mtime_ns;
+                                get_dir_mtime(m->path, &sec, &ns);
+                                if (sec != m->last_mtime || ns != m->last_mtime_ns)
+                                {
+                                        m->last_mtime = sec;
+                                        m->last_mtime_ns = ns;
+                                        dir_model_schedule_refresh(m, now);
+                                        m->poll_interval = POLL_MIN_MS;
+                                }
+                                else if (m->poll_interval < POLL_MAX_MS)
+                                {
+                                        m->poll_interval *= 2;
+                                }
+                                m->poll_due = now + m->poll_interval;
+                        }
+                        if (!m->watched && (!wake_at || m->poll_due < wake_at))
+                                wake_at = m->poll_due;
+                }
+                /* Every directory on screen that changed is refreshed on the
+                 * pool at once, hidden ones wait until they are shown. */
+                for (DirModel *m = dir_models; m; m = m->next)
+                {
+                        (m->refresh_due && !m->load && dir_model_shown(m)) orelse continue;
+                        if (now >= m->refresh_due)
+                                dir_model_refresh(m, -1);
+                        else if (!wake_at || m->refresh_due < wake_at)
+                                wake_at = m->refresh_due;
+                }
+                /* Directory sizes are walked for listings on screen once they
+                 * are read, and again after they change. */
+                for (DirModel *m = dir_models; m; m = m->next)
+                {
+                        bool want = dir_model_wants_sizes(m);
+                        if (m->sizes && (!want || m->sizes_dirty || m->sizes->gen != m->gen || m->sizes->rows > dir_rows(m)->count))
+                                dir_model_cancel_sizes(m);
+                        else if (m->sizes && m->sizes->rows < dir_rows(m)->count)
+                                dir_model_extend_sizes(m);
+                        if (want && !m->sizes && !m->load)
+                                dir_model_start_sizes(m);
+                }
                 for (int i = 0; i < tab_count; i++)
                 {
-                        if (!tabs[i].in_use)
+                        if (!tabs[i]->in_use || tabs[i]->asleep)
                                 continue;
-                        AppState *a = &tabs[i].app;
+                        AppState *a = &tabs[i]->app;
 
-                        long long sec, ns;
-                        get_dir_mtime(a->cwd, &sec, &ns);
-                        if (sec != a->last_mtime || ns != a->last_mtime_ns)
-                        {
-                                a->last_mtime = sec;
-                                a->last_mtime_ns = ns;
-                                if (a->next_dir[0] == '\0')
-                                        strcpy(a->next_dir, ".");
-                        }
+                        long long prefetch_at = app_update_prefetch(a, now);
+                        if (prefetch_at && (!wake_at || prefetch_at < wake_at))
+                                wake_at = prefetch_at;
 
-                        if (a->next_dir[0] || ui_list_is_animating(&a->list) || a->pop_anim > 0.0f)
+                        if ((tabs[i]->shown && a->next_dir[0] && strcmp(a->next_dir, a->opening)) || ui_list_is_animating(&a->list) || a->pop_anim > 0.0f)
+                                animating = true;
+                        if (a->find && tabs[i]->shown && finder_busy(a->find))
                                 animating = true;
                 }
-                int timeout = (animating || ui_dock_is_animating(&dock)) ? term_anim_timeout : 1000;
+                /* Without animations, timers or background work there is
+                 * nothing to wake up for. */
+                term_set_animating(animating || ui_dock_is_animating(&dock));
+                int timeout = wake_at ? (int)(wake_at > now ? wake_at - now : 0) : -1;
                 int key = term_poll(first_frame ? 0 : timeout);
+                if (term_quit)
+                        break;
+
+                fs_jobs_drain_wake();
+                raw FsWatchEvent ev;
+                while (fs_watch_next(&ev))
+                {
+                        for (DirModel *m = dir_models; m; m = m->next)
+                                if (m->watched && (m->watch_wd == ev.wd || ev.kind == FS_WATCH_OVERFLOW))
+                                        dir_model_on_change(m, &ev, now_ms());
+                }
+                for (DirModel *m = dir_models; m; m = m->next)
+                {
+                        dir_model_pump_load(m);
+                        dir_model_pump_meta(m);
+                        dir_model_apply_stale(m);
+                        dir_model_pump_sizes(m);
+                }
 
                 ui_set_view(NULL);
                 ui_suppress_mouse(false);
@@ -1898,10 +6575,11 @@ int main(int argc, char **argv)
 #define TAB_BAR_H 1
 
                 bool any_drag = false;
-                for (int i = 0; i < MAX_TABS; i++)
+                for (int i = 0; i < tab_count; i++)
                 {
-                        if (tabs[i].in_use && tabs[i].app.list.is_dragging)
+                        if (tabs[i]->in_use && tabs[i]->app.list.is_dragging)
                                 any_drag = true;
+                        tabs[i]->shown = false;
                 }
 
                 int leaf_count = ui_dock_leaf_count(&dock);
@@ -1913,10 +6591,15 @@ int main(int argc, char **argv)
                         bool active = false;
                         if (!ui_dock_leaf_get(&dock, leaf, &view, &at, &active))
                                 continue;
-                        if (at < 0 || !tabs[at].in_use)
+                        if (at < 0 || at >= tab_count || !tabs[at]->in_use)
                                 continue;
+                        tabs[at]->shown = true;
+                        if (tabs[at]->asleep)
+                                tab_wake(tabs[at]);
 
-                        AppState *app = &tabs[at].app;
+                        AppState *app = &tabs[at]->app;
+                        if (app->dir && app->dir->lost && !app->next_dir[0])
+                                strcpy(app->next_dir, ".");
                         UIListState *s = &app->list;
                         s->external_drag = any_drag;
                         int vw = view.w;
@@ -1932,9 +6615,12 @@ int main(int argc, char **argv)
                         if (active)
                                 handle_input(app, &key, &params);
 
-                        if (app->next_dir[0] && (s->drop_anim <= 0.01f || !s->drop_to_target) && (!app->pop_is_out || app->pop_anim <= 0.01f))
+                        /* A directory that is slow to open is asked for again
+                         * every frame until it is there, the tab stays usable
+                         * meanwhile. */
+                        if (app->next_dir[0] && (s->drop_anim <= 0.01f || !s->drop_to_target) && (!app->pop_is_out || app->pop_anim <= 0.01f) &&
+                            app_load_dir(app, app->next_dir))
                         {
-                                app_load_dir(app, app->next_dir);
                                 app->next_dir[0] = '\0';
                                 first_frame = true;
                                 key = 0;
@@ -1949,7 +6635,19 @@ int main(int argc, char **argv)
                                         app->pop_anim = 0.0f;
                         }
 
-                        app_render_ui(app, &params, active ? key : 0);
+                        if (app->grep_prompt && app_grep_prompt(app, &params, active ? key : 0))
+                                key = 0;
+                        if (app->filter_open && app_filter_bar(app, &params, active ? key : 0))
+                                key = 0;
+                        app_apply_select(app, &params);
+                        if (app->find)
+                                app_render_finder(app, &params, active ? key : 0);
+                        else if (app->recent)
+                                app_render_recent(app, &params, active ? key : 0);
+                        else if (s->mode == UI_MODE_TREEMAP)
+                                app_render_treemap(app, &params, active ? key : 0);
+                        else
+                                app_render_ui(app, &params, active ? key : 0);
 
                         if (app->quit)
                         {
@@ -1961,32 +6659,44 @@ int main(int argc, char **argv)
                 ui_set_view(NULL);
                 ui_suppress_mouse(false);
 
-                for (int i = 0; i < MAX_TABS; i++)
+                for (int i = 0; i < tab_count; i++)
                 {
-                        if (tabs[i].in_use)
-                                app_process_drops(&tabs[i].app);
+                        if (tabs[i]->in_use && !tabs[i]->asleep)
+                                app_process_drops(&tabs[i]->app);
+                        if (tab_can_sleep(tabs[i]))
+                                tab_sleep(tabs[i]);
                 }
 
-                UITab ui_tabs[MAX_TABS] = {0};
-                char titles[MAX_TABS][PATH_MAX + 100];
-                for (int i = 0; i < MAX_TABS; i++)
+                UITab *ui_tabs = calloc(tab_count ? tab_count : 1, sizeof(UITab));
+                defer free(ui_tabs);
+                char (*titles)[PATH_MAX + 100] = malloc((tab_count ? tab_count : 1) * sizeof(*titles));
+                defer free(titles);
+                for (int i = 0; i < tab_count && ui_tabs && titles; i++)
                 {
-                        if (tabs[i].in_use)
+                        if (tabs[i]->in_use)
                         {
-                                if (tabs[i].app.git_branch[0])
-                                        snprintf(titles[i], sizeof(titles[i]), "%s  [git: %s] ", tabs[i].app.cwd, tabs[i].app.git_branch);
+                                raw char sort[32];
+                                sort[0] = '\0';
+                                if (tabs[i]->app.sort != SORT_NAME)
+                                        snprintf(sort, sizeof(sort), "  [sort: %s]", sort_mode_names[tabs[i]->app.sort]);
+                                DirModel *dm = tabs[i]->app.dir;
+                                if (dm && dm->grep[0])
+                                        snprintf(titles[i], sizeof(titles[i]), "%s  [grep: %.64s%s]%s ", tabs[i]->app.cwd, dm->grep, dm->load ? "…" : "", sort);
+                                else if (dm && dm->git_branch[0])
+                                        snprintf(titles[i], sizeof(titles[i]), "%s  [git: %s]%s ", tabs[i]->app.cwd, dm->git_branch, sort);
                                 else
-                                        snprintf(titles[i], sizeof(titles[i]), "%s ", tabs[i].app.cwd);
+                                        snprintf(titles[i], sizeof(titles[i]), "%s%s ", tabs[i]->app.cwd, sort);
 
                                 ui_tabs[i] = (UITab){
-                                    .label = tab_title_from_cwd(tabs[i].app.cwd),
+                                    .label = tab_title_from_cwd(tabs[i]->app.cwd),
                                     .title = titles[i],
                                     .active = false,
                                     .closable = true,
                                 };
                         }
                 }
-                ui_dock_draw(&dock, ui_tabs, MAX_TABS, clr_bar, clr_bg, clr_bar, clr_bg);
+                if (ui_tabs && titles)
+                        ui_dock_draw(&dock, ui_tabs, tab_count, clr_bar, clr_bg, clr_bar, clr_bg);
 
                 int close_id = ui_dock_take_close_request(&dock);
                 if (close_id >= 0)
@@ -2002,8 +6712,8 @@ int main(int argc, char **argv)
                         int src_tab = -1;
                         bool active = false;
                         const char *dir = ".";
-                        if (ui_dock_leaf_get(&dock, add_leaf, &leaf_view, &src_tab, &active) && src_tab >= 0 && tabs[src_tab].in_use)
-                                dir = tabs[src_tab].app.cwd;
+                        if (ui_dock_leaf_get(&dock, add_leaf, &leaf_view, &src_tab, &active) && src_tab >= 0 && tabs[src_tab]->in_use)
+                                dir = tabs[src_tab]->app.cwd;
                         int nt = add_tab(dir);
                         if (nt >= 0)
                                 ui_dock_add_tab_to_leaf(&dock, add_leaf, nt);
@@ -0,0 +1,1113 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <spawn.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/stat.h>
+#include <linux/io_uring.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#endif
+
+extern char **environ;
+
+/* Directory iteration on an already opened directory fd. On Linux this reads
+ * getdents64 records straight into a large buffer, elsewhere it wraps a
+ * fdopendir() stream on a dup of the fd. The caller keeps ownership of dfd.
+ * Other backends keep their place in vfs_pos and the name in vfs_name. */
+typedef struct
+{
+        int fd;
+#ifdef __linux__
+        int pos, len;
+        _Alignas(8) char buf[64 * 1024];
+#else
+        DIR *dir;
+#endif
+        size_t vfs_pos;
+        char vfs_name[256];
+} FsDirIter;
+
+/* Everything done to the filesystem being browsed goes through fs_vfs, POSIX
+ * unless another backend is put in before anything is opened. Our own files
+ * under ~/.cache and git always use the real one. Each call behaves like its
+ * POSIX namesake, fds included. */
+typedef struct
+{
+        const char *name;
+        int (*open_dir)(const char *path);
+        int (*open_file)(const char *path, int flags, mode_t mode);
+        int (*close)(int fd);
+        ssize_t (*read)(int fd, void *buf, size_t n);
+        ssize_t (*write)(int fd, const void *buf, size_t n);
+        int (*fstat)(int fd, struct stat *st);
+        int (*fstatat)(int dfd, const char *name, struct stat *st, int flags);
+        int (*stat)(const char *path, struct stat *st);
+        bool (*dir_begin)(FsDirIter *it, int dfd);
+        bool (*dir_next)(FsDirIter *it, const char **name, unsigned char *type);
+        void (*dir_end)(FsDirIter *it);
+        int (*mkdir)(const char *path, mode_t mode);
+        int (*rmdir)(const char *path);
+        int (*unlink)(const char *path);
+        int (*rename)(const char *src, const char *dst);
+        int (*chmod)(const char *path, mode_t mode);
+        bool (*fd_path)(int fd, char *out);
+} FsVfs;
+
+#ifdef __linux__
+struct fs_dirent64
+{
+        unsigned long long d_ino;
+        long long d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+};
+#endif
+
+/* Fault injection for trying things against a slow mount without having
+ * one: FS_DELAY=ms makes every filesystem call here take ms longer,
+ * FS_DELAY=ms:/prefix only the ones on paths below /prefix. */
+static int fs_fault_ms = -1;
+static char fs_fault_prefix[PATH_MAX];
+static pthread_once_t fs_fault_once = PTHREAD_ONCE_INIT;
+
+static void fs_fault_init(void)
+{
+        const char *spec = getenv("FS_DELAY");
+        fs_fault_ms = spec ? atoi(spec) : 0;
+        const char *colon = spec ? strchr(spec, ':') : NULL;
+        if (colon)
+                snprintf(fs_fault_prefix, PATH_MAX, "%s", colon + 1);
+}
+
+static void fs_fault_path(const char *path)
+{
+        pthread_once(&fs_fault_once, fs_fault_init);
+        (fs_fault_ms > 0) orelse return;
+        (!fs_fault_prefix[0] || !strncmp(path, fs_fault_prefix, strlen(fs_fault_prefix))) orelse return;
+        usleep(fs_fault_ms * 1000);
+}
+
+/* Calls on an fd are matched by the path the fd was opened with. */
+static void fs_fault_fd(int fd)
+{
+        pthread_once(&fs_fault_once, fs_fault_init);
+        (fs_fault_ms > 0) orelse return;
+        raw char path[PATH_MAX];
+        path[0] = '\0';
+#ifdef __linux__
+        raw char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = readlink(link, path, sizeof(path) - 1);
+        path[n > 0 ? n : 0] = '\0';
+#endif
+        fs_fault_path(path);
+}
+
+static int fs_posix_open_dir(const char *path)
+{
+        return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int fs_posix_open_file(const char *path, int flags, mode_t mode)
+{
+        return open(path, flags | O_CLOEXEC, mode);
+}
+
+static bool fs_posix_dir_begin(FsDirIter *it, int dfd)
+{
+        it->fd = dfd;
+#ifdef __linux__
+        it->pos = it->len = 0;
+        return lseek(dfd, 0, SEEK_SET) == 0;
+#else
+        int dup_fd = dup(dfd);
+        (dup_fd >= 0) orelse return false;
+        it->dir = fdopendir(dup_fd);
+        if (!it->dir)
+        {
+                close(dup_fd);
+                return false;
+        }
+        rewinddir(it->dir);
+        return true;
+#endif
+}
+
+static bool fs_posix_dir_next(FsDirIter *it, const char **name, unsigned char *type)
+{
+#ifdef __linux__
+        while (1)
+        {
+                if (it->pos >= it->len)
+                {
+                        long n = syscall(SYS_getdents64, it->fd, it->buf, sizeof(it->buf));
+                        (n > 0) orelse return false;
+                        it->len = (int)n;
+                        it->pos = 0;
+                }
+                struct fs_dirent64 *d = (struct fs_dirent64 *)(it->buf + it->pos);
+                it->pos += d->d_reclen;
+                if (d->d_name[0] == '.' && d->d_name[1] == '\0')
+                        continue;
+                *name = d->d_name;
+                *type = d->d_type;
+                return true;
+        }
+#else
+        while (1)
+        {
+                struct dirent *d = readdir(it->dir);
+                (d != NULL) orelse return false;
+                if (d->d_name[0] == '.' && d->d_name[1] == '\0')
+                        continue;
+                *name = d->d_name;
+                *type = d->d_type;
+                return true;
+        }
+#endif
+}
+
+static void fs_posix_dir_end(FsDirIter *it)
+{
+#ifndef __linux__
+        if (it->dir)
+                closedir(it->dir);
+        it->dir = NULL;
+#else
+        (void)it;
+#endif
+}
+
+static bool fs_posix_fd_path(int fd, char *out)
+{
+#if defined(__linux__)
+        raw char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = readlink(link, out, PATH_MAX - 1);
+        (n > 0 && out[0] == '/') orelse return false;
+        out[n] = '\0';
+        return true;
+#elif defined(F_GETPATH)
+        return fcntl(fd, F_GETPATH, out) == 0;
+#else
+        return false;
+#endif
+}
+
+const FsVfs fs_posix = {
+    "posix",
+    fs_posix_open_dir,
+    fs_posix_open_file,
+    close,
+    read,
+    write,
+    fstat,
+    fstatat,
+    stat,
+    fs_posix_dir_begin,
+    fs_posix_dir_next,
+    fs_posix_dir_end,
+    mkdir,
+    rmdir,
+    unlink,
+    rename,
+    chmod,
+    fs_posix_fd_path,
+};
+
+const FsVfs *fs_vfs = &fs_posix;
+
+int fs_open_dir(const char *path)
+{
+        fs_fault_path(path);
+        return fs_vfs->open_dir(path);
+}
+
+bool fs_dir_begin(FsDirIter *it, int dfd)
+{
+        fs_fault_fd(dfd);
+        return fs_vfs->dir_begin(it, dfd);
+}
+
+/* Returns the next entry other than "." (".." is reported). type is a DT_*
+ * value, DT_UNKNOWN when the filesystem does not fill it in. */
+bool fs_dir_next(FsDirIter *it, const char **name, unsigned char *type)
+{
+        return fs_vfs->dir_next(it, name, type);
+}
+
+void fs_dir_end(FsDirIter *it)
+{
+        fs_vfs->dir_end(it);
+}
+
+/* stat() relative to dfd, falling back to lstat() semantics for dangling links. */
+bool fs_stat_at(int dfd, const char *name, struct stat *st)
+{
+        fs_fault_fd(dfd);
+        if (fs_vfs->fstatat(dfd, name, st, 0) == 0)
+                return true;
+        return fs_vfs->fstatat(dfd, name, st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* The path an open fd refers to, without asking the filesystem again. */
+bool fs_fd_path(int fd, char *out)
+{
+        return fs_vfs->fd_path(fd, out);
+}
+
+/* Batched fs_stat_at(). tag is left alone for the caller to map results back. */
+typedef struct
+{
+        const char *name;
+        struct stat st;
+        bool ok;
+        int tag;
+} FsStatReq;
+
+#ifdef __linux__
+/* One io_uring per worker thread, used to push a whole batch of statx calls to
+ * the kernel at once. Falls back to plain fstatat when the kernel or a seccomp
+ * filter does not allow it. */
+#define FS_RING_SIZE 256
+
+typedef struct
+{
+        int fd;
+        bool failed;
+        unsigned *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        struct statx *stx;
+} FsRing;
+
+static _Thread_local FsRing fs_ring = {.fd = -1};
+
+static bool fs_ring_setup(FsRing *r)
+{
+        (r->fd < 0 && !r->failed) orelse return r->fd >= 0;
+        r->failed = true;
+
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = (int)syscall(__NR_io_uring_setup, FS_RING_SIZE, &p);
+        (fd >= 0) orelse return false;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+        {
+                close(fd);
+                return false;
+        }
+
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+        char *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        r->stx = malloc(p.sq_entries * sizeof(struct statx));
+        if (ring == MAP_FAILED || sqes == MAP_FAILED || !r->stx)
+        {
+                if (ring != MAP_FAILED)
+                        munmap(ring, ring_size);
+                if (sqes != MAP_FAILED)
+                        munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+                free(r->stx);
+                close(fd);
+                return false;
+        }
+
+        r->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+        r->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+        r->sq_array = (unsigned *)(ring + p.sq_off.array);
+        r->cq_head = (unsigned *)(ring + p.cq_off.head);
+        r->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+        r->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+        r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+        r->sqes = sqes;
+        r->fd = fd;
+        r->failed = false;
+        return true;
+}
+
+static void fs_statx_to_stat(const struct statx *x, struct stat *st)
+{
+        memset(st, 0, sizeof(*st));
+        st->st_mode = x->stx_mode;
+        st->st_nlink = x->stx_nlink;
+        st->st_uid = x->stx_uid;
+        st->st_gid = x->stx_gid;
+        st->st_size = x->stx_size;
+        st->st_blocks = x->stx_blocks;
+        st->st_ino = x->stx_ino;
+        st->st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+        st->st_mtim.tv_sec = x->stx_mtime.tv_sec;
+        st->st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+        st->st_ctim.tv_sec = x->stx_ctime.tv_sec;
+        st->st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+}
+
+/* Submits reqs in waves of up to FS_RING_SIZE statx ops. Returns false if the
+ * ring can not be used, results filled in so far are kept. */
+static bool fs_stat_many_uring(int dfd, FsStatReq *reqs, int count, int flags)
+{
+        FsRing *r = &fs_ring;
+        (fs_ring_setup(r)) orelse return false;
+
+        for (int base = 0; base < count; base += FS_RING_SIZE)
+        {
+                int n = count - base < FS_RING_SIZE ? count - base : FS_RING_SIZE;
+                unsigned tail = *r->sq_tail;
+                for (int i = 0; i < n; i++)
+                {
+                        unsigned slot = (tail + i) & *r->sq_mask;
+                        struct io_uring_sqe *sqe = &r->sqes[slot];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->opcode = IORING_OP_STATX;
+                        sqe->fd = dfd;
+                        sqe->addr = (unsigned long long)(uintptr_t)reqs[base + i].name;
+                        sqe->len = STATX_BASIC_STATS;
+                        sqe->statx_flags = flags;
+                        sqe->off = (unsigned long long)(uintptr_t)&r->stx[i];
+                        sqe->user_data = i;
+                        r->sq_array[slot] = slot;
+                }
+                atomic_store_explicit((_Atomic unsigned *)r->sq_tail, tail + n, memory_order_release);
+
+                int reaped = 0, to_submit = n;
+                while (reaped < n)
+                {
+                        int rc = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, n - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+                        if (rc < 0 && errno != EINTR)
+                        {
+                                r->failed = true;
+                                return false;
+                        }
+                        if (rc > 0)
+                                to_submit -= rc;
+
+                        unsigned head = *r->cq_head;
+                        unsigned cq_tail = atomic_load_explicit((_Atomic unsigned *)r->cq_tail, memory_order_acquire);
+                        for (; head != cq_tail; head++, reaped++)
+                        {
+                                struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+                                FsStatReq *q = &reqs[base + cqe->user_data];
+                                if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+                                        r->failed = true;
+                                q->ok = cqe->res == 0;
+                                if (q->ok)
+                                        fs_statx_to_stat(&r->stx[cqe->user_data], &q->st);
+                                else if (cqe->res != -EINVAL)
+                                        q->ok = fstatat(dfd, q->name, &q->st, AT_SYMLINK_NOFOLLOW) == 0;
+                        }
+                        atomic_store_explicit((_Atomic unsigned *)r->cq_head, head, memory_order_release);
+                }
+                (!r->failed) orelse return false;
+        }
+        return true;
+}
+#endif
+
+/* Stats count names relative to dfd, through io_uring where available. */
+void fs_stat_many(int dfd, FsStatReq *reqs, int count)
+{
+#ifdef __linux__
+        fs_fault_fd(dfd);
+        if (count > 1 && fs_vfs == &fs_posix && fs_stat_many_uring(dfd, reqs, count, 0))
+                return;
+#endif
+        for (int i = 0; i < count; i++)
+                reqs[i].ok = fs_stat_at(dfd, reqs[i].name, &reqs[i].st);
+}
+
+/* fs_stat_many() without following symlinks, for walks that must not leave
+ * the tree or loop. */
+void fs_lstat_many(int dfd, FsStatReq *reqs, int count)
+{
+#ifdef __linux__
+        fs_fault_fd(dfd);
+        if (count > 1 && fs_vfs == &fs_posix && fs_stat_many_uring(dfd, reqs, count, AT_SYMLINK_NOFOLLOW))
+                return;
+#endif
+        for (int i = 0; i < count; i++)
+                reqs[i].ok = fs_vfs->fstatat(dfd, reqs[i].name, &reqs[i].st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+/* Maps a whole file read-only, NULL if it is missing or empty. The mapping
+ * stays valid when the file is replaced by a rename. */
+const void *fs_map_file(const char *path, size_t *size)
+{
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        (fd >= 0) orelse return NULL;
+        raw struct stat st;
+        bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+        void *p = ok ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        (p != MAP_FAILED) orelse return NULL;
+        *size = st.st_size;
+        return p;
+}
+
+void fs_unmap_file(const void *p, size_t size)
+{
+        if (p)
+                munmap((void *)p, size);
+}
+
+/* Joins path onto base unless path is already absolute. */
+void fs_join(char *out, const char *base, const char *path)
+{
+        if (path[0] == '/' || !base[0])
+                snprintf(out, PATH_MAX, "%s", path);
+        else if (!strcmp(base, "/"))
+                snprintf(out, PATH_MAX, "/%s", path);
+        else
+                snprintf(out, PATH_MAX, "%s/%s", base, path);
+}
+
+/* Runs argv without a shell and returns a stream of its stdout, stderr is
+ * discarded. Close with fs_pclose(). */
+FILE *fs_popen(char *const argv[], pid_t *pid)
+{
+        raw int fds[2];
+        (pipe(fds) == 0) orelse return NULL;
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_addclose(&fa, fds[0]);
+        posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&fa, fds[1]);
+        posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+        /* Callers block signals (workers all of them), children must not
+         * inherit that. */
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        raw sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+        int rc = posix_spawnp(pid, argv[0], &fa, &attr, argv, environ);
+        posix_spawn_file_actions_destroy(&fa);
+        posix_spawnattr_destroy(&attr);
+        close(fds[1]);
+        if (rc != 0)
+        {
+                close(fds[0]);
+                return NULL;
+        }
+
+        FILE *f = fdopen(fds[0], "r");
+        if (!f)
+        {
+                close(fds[0]);
+                waitpid(*pid, NULL, 0);
+        }
+        return f;
+}
+
+void fs_pclose(FILE *f, pid_t pid)
+{
+        fclose(f);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+                ;
+}
+
+/* Background job pool. Jobs run on a handful of detached worker threads and
+ * report back to the UI thread through fs_jobs_notify(), which makes the fd
+ * from fs_jobs_wake_fd() readable so term_poll returns. */
+typedef void (*FsJobFn)(void *arg);
+
+/* A set of jobs someone waits on with fs_group_wait(). */
+typedef struct
+{
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        int pending;
+} FsJobGroup;
+
+typedef struct FsJob
+{
+        FsJobFn fn;
+        void *arg;
+        FsJobGroup *group;
+        struct FsJob *next;
+} FsJob;
+
+static pthread_mutex_t fs_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fs_jobs_cond = PTHREAD_COND_INITIALIZER;
+static FsJob *fs_jobs_head, *fs_jobs_tail;
+static FsJob *fs_idle_head, *fs_idle_tail;
+static int fs_jobs_threads;
+/* Read and write end of the wakeup channel, both the same eventfd on Linux. */
+static int fs_wake[2] = {-1, -1};
+
+static void fs_job_run(FsJob *job)
+{
+        job->fn(job->arg);
+        FsJobGroup *g = job->group;
+        free(job);
+        if (g)
+        {
+                pthread_mutex_lock(&g->lock);
+                if (--g->pending == 0)
+                        pthread_cond_broadcast(&g->cond);
+                pthread_mutex_unlock(&g->lock);
+        }
+}
+
+static void *fs_jobs_worker(void *unused)
+{
+        (void)unused;
+        while (1)
+        {
+                pthread_mutex_lock(&fs_jobs_lock);
+                while (!fs_jobs_head && !fs_idle_head)
+                        pthread_cond_wait(&fs_jobs_cond, &fs_jobs_lock);
+                FsJob *job;
+                if (fs_jobs_head)
+                {
+                        job = fs_jobs_head;
+                        fs_jobs_head = job->next;
+                        if (!fs_jobs_head)
+                                fs_jobs_tail = NULL;
+                }
+                else
+                {
+                        job = fs_idle_head;
+                        fs_idle_head = job->next;
+                        if (!fs_idle_head)
+                                fs_idle_tail = NULL;
+                }
+                pthread_mutex_unlock(&fs_jobs_lock);
+
+                fs_job_run(job);
+        }
+        return NULL;
+}
+
+static void fs_jobs_init(void)
+{
+#ifdef __linux__
+        if (fs_wake[0] < 0)
+                fs_wake[0] = fs_wake[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+        if (fs_wake[0] < 0 && pipe(fs_wake) == 0)
+        {
+                for (int i = 0; i < 2; i++)
+                {
+                        fcntl(fs_wake[i], F_SETFL, O_NONBLOCK);
+                        fcntl(fs_wake[i], F_SETFD, FD_CLOEXEC);
+                }
+        }
+
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int want = ncpu < 4 ? 4 : (ncpu > 16 ? 16 : (int)ncpu);
+
+        /* Workers must never take SIGWINCH & co, the UI thread relies on them
+         * interrupting its poll. */
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for (; fs_jobs_threads < want; fs_jobs_threads++)
+        {
+                pthread_t th;
+                (pthread_create(&th, NULL, fs_jobs_worker, NULL) == 0) orelse break;
+                pthread_detach(th);
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static bool fs_jobs_push(FsJobFn fn, void *arg, FsJobGroup *g, bool idle)
+{
+        FsJob *job = malloc(sizeof(FsJob)) orelse return false;
+        job->fn = fn;
+        job->arg = arg;
+        job->group = g;
+        job->next = NULL;
+
+        pthread_mutex_lock(&fs_jobs_lock);
+        if (!fs_jobs_threads)
+                fs_jobs_init();
+        FsJob **head = idle ? &fs_idle_head : &fs_jobs_head, **tail = idle ? &fs_idle_tail : &fs_jobs_tail;
+        if (*tail)
+                (*tail)->next = job;
+        else
+                *head = job;
+        *tail = job;
+        pthread_cond_signal(&fs_jobs_cond);
+        pthread_mutex_unlock(&fs_jobs_lock);
+        return true;
+}
+
+void fs_jobs_submit(FsJobFn fn, void *arg)
+{
+        fs_jobs_push(fn, arg, NULL, false);
+}
+
+/* Like fs_jobs_submit(), but the job only starts once no regular job is
+ * waiting. Returns false if it could not be queued. */
+bool fs_jobs_submit_idle(FsJobFn fn, void *arg)
+{
+        return fs_jobs_push(fn, arg, NULL, true);
+}
+
+int fs_jobs_count(void)
+{
+        pthread_mutex_lock(&fs_jobs_lock);
+        if (!fs_jobs_threads)
+                fs_jobs_init();
+        int n = fs_jobs_threads;
+        pthread_mutex_unlock(&fs_jobs_lock);
+        return n;
+}
+
+void fs_group_init(FsJobGroup *g)
+{
+        pthread_mutex_init(&g->lock, NULL);
+        pthread_cond_init(&g->cond, NULL);
+        g->pending = 0;
+}
+
+/* Runs fn(arg) on the pool as part of g, or right here if that fails. */
+void fs_group_submit(FsJobGroup *g, FsJobFn fn, void *arg)
+{
+        pthread_mutex_lock(&g->lock);
+        g->pending++;
+        pthread_mutex_unlock(&g->lock);
+        if (fs_jobs_push(fn, arg, g, false))
+                return;
+
+        fn(arg);
+        pthread_mutex_lock(&g->lock);
+        g->pending--;
+        pthread_mutex_unlock(&g->lock);
+}
+
+/* Waits for every job of g and tears g down. Jobs of g still sitting in the
+ * queue are run by the caller, so waiting from inside a worker can not starve
+ * the pool. */
+void fs_group_wait(FsJobGroup *g)
+{
+        while (1)
+        {
+                pthread_mutex_lock(&fs_jobs_lock);
+                FsJob *job = NULL, *prev = NULL;
+                for (FsJob *j = fs_jobs_head; j; prev = j, j = j->next)
+                {
+                        if (j->group == g)
+                        {
+                                job = j;
+                                break;
+                        }
+                }
+                if (job)
+                {
+                        if (prev)
+                                prev->next = job->next;
+                        else
+                                fs_jobs_head = job->next;
+                        if (fs_jobs_tail == job)
+                                fs_jobs_tail = prev;
+                }
+                pthread_mutex_unlock(&fs_jobs_lock);
+                (job) orelse break;
+                fs_job_run(job);
+        }
+
+        pthread_mutex_lock(&g->lock);
+        while (g->pending > 0)
+                pthread_cond_wait(&g->cond, &g->lock);
+        pthread_mutex_unlock(&g->lock);
+        pthread_mutex_destroy(&g->lock);
+        pthread_cond_destroy(&g->cond);
+}
+
+int fs_jobs_wake_fd(void)
+{
+        pthread_mutex_lock(&fs_jobs_lock);
+        if (!fs_jobs_threads)
+                fs_jobs_init();
+        pthread_mutex_unlock(&fs_jobs_lock);
+        return fs_wake[0];
+}
+
+void fs_jobs_notify(void)
+{
+        uint64_t one = 1;
+        if (fs_wake[1] >= 0)
+                write(fs_wake[1], &one, fs_wake[0] == fs_wake[1] ? sizeof(one) : 1);
+}
+
+void fs_jobs_drain_wake(void)
+{
+        raw char buf[256];
+        while (fs_wake[0] >= 0 && read(fs_wake[0], buf, sizeof(buf)) > 0)
+                ;
+}
+
+/* Stats and directory opens for the UI thread. The call runs on the pool and
+ * the caller waits at most timeout_ms for it, failing with ETIMEDOUT past
+ * that. Stat results, late ones included, go into a small table shared by
+ * every caller and are reused while younger than max_age_ms. Only one stat
+ * per path is in flight, a hung mount ties up one worker per path it is
+ * asked about rather than the UI. */
+#define FS_STAT_SLOTS 256
+#define FS_STAT_PROBE 8
+#define FS_STAT_TTL_MS 1000
+
+typedef struct
+{
+        char path[PATH_MAX];
+        struct stat st;
+        int err; /* 0, an errno, EINPROGRESS while the stat runs */
+        bool late; /* a caller gave up on it, its result wakes the UI thread */
+        long long at;
+} FsStatSlot;
+
+static FsStatSlot *fs_stat_slots;
+static pthread_mutex_t fs_meta_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fs_meta_cond = PTHREAD_COND_INITIALIZER;
+
+static long long fs_now_ms(void)
+{
+        raw struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Waits on fs_meta_cond until deadline, false once it has passed. */
+static bool fs_meta_wait(long long deadline)
+{
+        long long left = deadline - fs_now_ms();
+        (left > 0) orelse return false;
+        raw struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += left / 1000;
+        ts.tv_nsec += (left % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&fs_meta_cond, &fs_meta_lock, &ts);
+        return true;
+}
+
+typedef struct
+{
+        char path[PATH_MAX];
+        unsigned slot;
+} FsStatJob;
+
+static void fs_stat_job(void *arg)
+{
+        FsStatJob *j = arg;
+        raw struct stat st;
+        fs_fault_path(j->path);
+        int err = fs_vfs->stat(j->path, &st) == 0 ? 0 : errno;
+
+        pthread_mutex_lock(&fs_meta_lock);
+        FsStatSlot *s = &fs_stat_slots[j->slot];
+        bool late = false;
+        if (s->err == EINPROGRESS && !strcmp(s->path, j->path))
+        {
+                s->st = st;
+                s->err = err;
+                s->at = fs_now_ms();
+                late = s->late;
+                pthread_cond_broadcast(&fs_meta_cond);
+        }
+        pthread_mutex_unlock(&fs_meta_lock);
+        free(j);
+        if (late)
+                fs_jobs_notify();
+}
+
+bool fs_stat_path(const char *path, struct stat *st, int max_age_ms, int timeout_ms)
+{
+        unsigned h = 2166136261u;
+        for (const char *p = path; *p; p++)
+                h = (h ^ (unsigned char)*p) * 16777619u;
+        h %= FS_STAT_SLOTS;
+        long long now = fs_now_ms();
+
+        pthread_mutex_lock(&fs_meta_lock);
+        if (!fs_stat_slots)
+                fs_stat_slots = calloc(FS_STAT_SLOTS, sizeof(FsStatSlot));
+        FsStatJob *job = fs_stat_slots ? malloc(sizeof(FsStatJob)) : NULL;
+        if (!job)
+        {
+                pthread_mutex_unlock(&fs_meta_lock);
+                fs_fault_path(path);
+                return fs_vfs->stat(path, st) == 0;
+        }
+
+        /* A path lives in one of the FS_STAT_PROBE slots from its hash on. A
+         * new one takes the oldest of them with no stat running, a running
+         * one may have a caller waiting on it. With all of them running the caller
+         * times out right away, that many stats are hung already. */
+        FsStatSlot *s = NULL, *spare = NULL;
+        for (int i = 0; i < FS_STAT_PROBE && !s; i++)
+        {
+                FsStatSlot *c = &fs_stat_slots[(h + i) % FS_STAT_SLOTS];
+                if (!strcmp(c->path, path))
+                        s = c;
+                else if (c->err != EINPROGRESS && (!spare || c->at < spare->at))
+                        spare = c;
+        }
+        if (!s && !spare)
+        {
+                pthread_mutex_unlock(&fs_meta_lock);
+                free(job);
+                errno = ETIMEDOUT;
+                return false;
+        }
+        bool mine = s != NULL;
+        s = s ? s : spare;
+        if (!mine || (s->err != EINPROGRESS && now - s->at > max_age_ms))
+        {
+                strcpy(s->path, path);
+                s->err = EINPROGRESS;
+                s->late = false;
+                strcpy(job->path, path);
+                job->slot = (unsigned)(s - fs_stat_slots);
+                fs_jobs_submit(fs_stat_job, job);
+                job = NULL;
+        }
+        free(job);
+
+        long long deadline = now + timeout_ms;
+        while (s->err == EINPROGRESS && fs_meta_wait(deadline))
+                ;
+        int err = s->err == EINPROGRESS ? ETIMEDOUT : s->err;
+        if (s->err == EINPROGRESS)
+                s->late = true;
+        if (!err)
+                *st = s->st;
+        pthread_mutex_unlock(&fs_meta_lock);
+        errno = err;
+        return !err;
+}
+
+/* An open that misses its deadline stays parked under its path, asking for
+ * the same path again picks it up instead of starting another one and its
+ * completion wakes the UI thread to do so. The parking spot and the job each
+ * hold a reference, whoever is last closes an fd nobody took. */
+#define FS_OPEN_PARKED 8
+
+typedef struct
+{
+        char path[PATH_MAX];
+        int fd, err, refs;
+        bool done;
+} FsOpenJob;
+
+static FsOpenJob *fs_open_parked[FS_OPEN_PARKED];
+
+static void fs_open_job_release(FsOpenJob *j)
+{
+        (--j->refs == 0) orelse return;
+        if (j->fd >= 0)
+                fs_vfs->close(j->fd);
+        free(j);
+}
+
+static void fs_open_job(void *arg)
+{
+        FsOpenJob *j = arg;
+        int fd = fs_open_dir(j->path);
+        int err = fd < 0 ? errno : 0;
+
+        pthread_mutex_lock(&fs_meta_lock);
+        j->fd = fd;
+        j->err = err;
+        j->done = true;
+        pthread_cond_broadcast(&fs_meta_cond);
+        fs_open_job_release(j);
+        pthread_mutex_unlock(&fs_meta_lock);
+        fs_jobs_notify();
+}
+
+static void fs_open_park(FsOpenJob *j)
+{
+        int slot = -1;
+        for (int i = 0; i < FS_OPEN_PARKED && slot < 0; i++)
+                if (!fs_open_parked[i] || fs_open_parked[i]->done)
+                        slot = i;
+        if (slot < 0)
+        {
+                fs_open_job_release(j);
+                return;
+        }
+        if (fs_open_parked[slot])
+                fs_open_job_release(fs_open_parked[slot]);
+        fs_open_parked[slot] = j;
+}
+
+/* fs_open_dir() with a deadline, see above. A retry does not wait at all. */
+int fs_open_dir_within(const char *path, int timeout_ms)
+{
+        pthread_mutex_lock(&fs_meta_lock);
+        FsOpenJob *j = NULL;
+        int slot = -1;
+        for (int i = 0; i < FS_OPEN_PARKED && !j; i++)
+        {
+                if (fs_open_parked[i] && !strcmp(fs_open_parked[i]->path, path))
+                {
+                        j = fs_open_parked[i];
+                        slot = i;
+                }
+        }
+        if (j)
+        {
+                timeout_ms = 0;
+        }
+        else
+        {
+                j = calloc(1, sizeof(FsOpenJob)) orelse
+                {
+                        pthread_mutex_unlock(&fs_meta_lock);
+                        return fs_open_dir(path);
+                };
+                strcpy(j->path, path);
+                j->fd = -1;
+                j->refs = 2;
+                fs_jobs_submit(fs_open_job, j);
+        }
+
+        long long deadline = fs_now_ms() + timeout_ms;
+        while (!j->done && fs_meta_wait(deadline))
+                ;
+        int fd = -1, err = ETIMEDOUT;
+        if (j->done)
+        {
+                fd = j->fd;
+                err = j->err;
+                j->fd = -1;
+                if (slot >= 0)
+                        fs_open_parked[slot] = NULL;
+                fs_open_job_release(j);
+        }
+        else if (slot < 0)
+        {
+                fs_open_park(j);
+        }
+        pthread_mutex_unlock(&fs_meta_lock);
+        errno = err;
+        return fd;
+}
+
+/* Directory change notification through one shared inotify instance. Watches
+ * are per inode, so two fs_watch_add() calls on the same directory return the
+ * same id. Where inotify is missing or out of watches fs_watch_add() fails and
+ * the caller has to poll. */
+enum
+{
+        FS_WATCH_ENTRIES,  /* something was created, removed or renamed */
+        FS_WATCH_CONTENT,  /* name was written to or had its attributes changed */
+        FS_WATCH_SELF,     /* the directory itself went away */
+        FS_WATCH_OVERFLOW, /* events were lost, any directory may have changed */
+};
+
+typedef struct
+{
+        int wd, kind;
+        const char *name;
+} FsWatchEvent;
+
+#ifdef __linux__
+static int fs_watch_ifd = -2;
+static int fs_watch_pos, fs_watch_len;
+static _Alignas(struct inotify_event) char fs_watch_buf[16 * 1024];
+#endif
+
+/* The fd to wait on for events, -1 if there is none. */
+int fs_watch_fd(void)
+{
+#ifdef __linux__
+        if (fs_watch_ifd == -2)
+                fs_watch_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        return fs_watch_ifd;
+#else
+        return -1;
+#endif
+}
+
+int fs_watch_add(const char *path)
+{
+#ifdef __linux__
+        (fs_vfs == &fs_posix && fs_watch_fd() >= 0) orelse return -1;
+        uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        return inotify_add_watch(fs_watch_ifd, path, mask);
+#else
+        (void)path;
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+void fs_watch_remove(int wd)
+{
+#ifdef __linux__
+        if (fs_watch_ifd >= 0 && wd >= 0)
+                inotify_rm_watch(fs_watch_ifd, wd);
+#else
+        (void)wd;
+#endif
+}
+
+/* Returns the next pending event, false once there are none. ev->name points
+ * into an internal buffer that the next call may overwrite. */
+bool fs_watch_next(FsWatchEvent *ev)
+{
+#ifdef __linux__
+        (fs_watch_ifd >= 0) orelse return false;
+        while (1)
+        {
+                if (fs_watch_pos >= fs_watch_len)
+                {
+                        fs_watch_pos = 0;
+                        fs_watch_len = (int)read(fs_watch_ifd, fs_watch_buf, sizeof(fs_watch_buf));
+                        if (fs_watch_len < 0 && errno == EINTR)
+                                continue;
+                        (fs_watch_len > 0) orelse return false;
+                }
+                struct inotify_event *ie = (struct inotify_event *)(fs_watch_buf + fs_watch_pos);
+                fs_watch_pos += sizeof(struct inotify_event) + ie->len;
+
+                /* IN_IGNORED just confirms a removed watch. */
+                (!(ie->mask & IN_IGNORED)) orelse continue;
+                ev->wd = ie->wd;
+                ev->name = ie->len ? ie->name : "";
+                if (ie->mask & IN_Q_OVERFLOW)
+                        ev->kind = FS_WATCH_OVERFLOW;
+                else if (ie->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                        ev->kind = FS_WATCH_SELF;
+                else if (ie->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+                        ev->kind = FS_WATCH_ENTRIES;
+                else
+                        ev->kind = FS_WATCH_CONTENT;
+                return true;
+        }
+#else
+        (void)ev;
+        return false;
+#endif
+}
@@ -0,0 +1,739 @@
+/* An in-memory filesystem behind FsVfs, for benchmarking listing, sorting and
+ * drawing of huge trees without touching a disk, and for seeing how the
+ * explorer copes with calls that are slow or fail. Picked at startup with
+ *
+ *   EXPLORE_VFS=mem[:files=N,dirs=N,depth=N,delay=MS,errors=N]
+ *
+ * "/" gets files files and dirs directories, each of those the same again
+ * until depth levels down, plus an empty /tmp for the trash. The tree is the
+ * same on every run. delay adds MS to every call that looks up a path or
+ * opens a directory, errors=N makes every Nth of those fail with EIO. Files
+ * read back as zeros. */
+#define MEMFS_FD_BASE (1 << 28)
+#define MEMFS_NONE UINT32_MAX
+#define MEMFS_EPOCH 1700000000LL
+
+typedef struct
+{
+        uint32_t parent, name_off;
+        uint32_t dir;  /* index into MemFs.dirs, MEMFS_NONE for files */
+        uint32_t slot; /* position in the parent's kids */
+        uint16_t name_len, mode;
+        bool alive;
+        off_t size;
+        int64_t mtime_ns;
+} MemNode;
+
+typedef struct
+{
+        uint32_t *kids;
+        uint32_t count, cap;
+} MemDir;
+
+typedef struct
+{
+        uint32_t node;
+        bool used;
+        off_t pos;
+} MemHandle;
+
+typedef struct
+{
+        pthread_mutex_t lock;
+        MemNode *nodes;
+        uint32_t node_count, node_cap;
+        MemDir *dirs;
+        uint32_t dir_count, dir_cap;
+        char *names;
+        size_t names_len, names_cap;
+
+        /* Open addressing on (parent, name). Renamed and removed nodes leave
+         * stale slots behind that never match, a rehash drops them. */
+        uint32_t *hash;
+        uint32_t hash_cap, hash_used;
+
+        MemHandle *fds;
+        int fd_cap;
+
+        int files, dirs_per, depth, delay_ms, errors;
+        atomic_uint calls;
+} MemFs;
+
+static MemFs memfs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int64_t memfs_now_ns(void)
+{
+        raw struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool memfs_grow(void **p, uint32_t *cap, uint32_t need, size_t size)
+{
+        (need > *cap) orelse return true;
+        uint32_t n = *cap ? *cap : 64;
+        while (n < need)
+                n *= 2;
+        void *grown = realloc(*p, (size_t)n * size) orelse return false;
+        *p = grown;
+        *cap = n;
+        return true;
+}
+
+static uint32_t memfs_hash_key(uint32_t parent, const char *name, int len)
+{
+        uint32_t h = 2166136261u ^ parent;
+        for (int i = 0; i < len; i++)
+                h = (h ^ (unsigned char)name[i]) * 16777619u;
+        return h;
+}
+
+static bool memfs_is_dir(uint32_t id)
+{
+        return memfs.nodes[id].dir != MEMFS_NONE;
+}
+
+static uint32_t memfs_find(uint32_t parent, const char *name, int len)
+{
+        (memfs.hash_cap) orelse return MEMFS_NONE;
+        uint32_t mask = memfs.hash_cap - 1;
+        for (uint32_t i = memfs_hash_key(parent, name, len) & mask;; i = (i + 1) & mask)
+        {
+                uint32_t id = memfs.hash[i];
+                (id != MEMFS_NONE) orelse return MEMFS_NONE;
+                const MemNode *n = &memfs.nodes[id];
+                if (n->alive && n->parent == parent && n->name_len == len && !memcmp(memfs.names + n->name_off, name, len))
+                        return id;
+        }
+}
+
+static void memfs_hash_put(uint32_t id)
+{
+        const MemNode *n = &memfs.nodes[id];
+        uint32_t mask = memfs.hash_cap - 1;
+        uint32_t i = memfs_hash_key(n->parent, memfs.names + n->name_off, n->name_len) & mask;
+        while (memfs.hash[i] != MEMFS_NONE)
+                i = (i + 1) & mask;
+        memfs.hash[i] = id;
+        memfs.hash_used++;
+}
+
+/* Keeps the table at most half full, counting stale slots. */
+static bool memfs_hash_reserve(void)
+{
+        (memfs.hash_used + 1 > memfs.hash_cap / 2) orelse return true;
+        uint32_t cap = memfs.hash_cap ? memfs.hash_cap : 1024;
+        while (memfs.node_count + 1 > cap / 4)
+                cap *= 2;
+        uint32_t *hash = malloc((size_t)cap * sizeof(uint32_t)) orelse return false;
+        memset(hash, 0xff, (size_t)cap * sizeof(uint32_t));
+        free(memfs.hash);
+        memfs.hash = hash;
+        memfs.hash_cap = cap;
+        memfs.hash_used = 0;
+        for (uint32_t id = 1; id < memfs.node_count; id++)
+                if (memfs.nodes[id].alive)
+                        memfs_hash_put(id);
+        return true;
+}
+
+static bool memfs_set_name(MemNode *n, const char *name, int len)
+{
+        (len > 0 && len < 256) orelse return false;
+        size_t need = memfs.names_len + len + 1;
+        if (need > memfs.names_cap)
+        {
+                size_t cap = memfs.names_cap ? memfs.names_cap : 64 * 1024;
+                while (cap < need)
+                        cap *= 2;
+                (cap <= UINT32_MAX) orelse return false;
+                char *grown = realloc(memfs.names, cap) orelse return false;
+                memfs.names = grown;
+                memfs.names_cap = cap;
+        }
+        n->name_off = (uint32_t)memfs.names_len;
+        n->name_len = (uint16_t)len;
+        memcpy(memfs.names + memfs.names_len, name, len);
+        memfs.names[memfs.names_len + len] = '\0';
+        memfs.names_len = need;
+        return true;
+}
+
+static bool memfs_attach(uint32_t id, uint32_t parent)
+{
+        MemDir *d = &memfs.dirs[memfs.nodes[parent].dir];
+        (memfs_grow((void **)&d->kids, &d->cap, d->count + 1, sizeof(uint32_t)) && memfs_hash_reserve()) orelse return false;
+        memfs.nodes[id].parent = parent;
+        memfs.nodes[id].slot = d->count;
+        d->kids[d->count++] = id;
+        memfs_hash_put(id);
+        memfs.nodes[parent].mtime_ns = memfs_now_ns();
+        return true;
+}
+
+static void memfs_detach(uint32_t id)
+{
+        MemNode *n = &memfs.nodes[id];
+        MemDir *d = &memfs.dirs[memfs.nodes[n->parent].dir];
+        uint32_t last = d->kids[--d->count];
+        d->kids[n->slot] = last;
+        memfs.nodes[last].slot = n->slot;
+        memfs.nodes[n->parent].mtime_ns = memfs_now_ns();
+}
+
+static uint32_t memfs_add(uint32_t parent, const char *name, int len, uint16_t mode, off_t size, int64_t mtime_ns)
+{
+        (memfs_grow((void **)&memfs.nodes, &memfs.node_cap, memfs.node_count + 1, sizeof(MemNode))) orelse return MEMFS_NONE;
+        uint32_t id = memfs.node_count;
+        MemNode *n = &memfs.nodes[id];
+        *n = (MemNode){.parent = parent, .dir = MEMFS_NONE, .mode = mode, .alive = true, .size = size, .mtime_ns = mtime_ns};
+        (memfs_set_name(n, name, len)) orelse return MEMFS_NONE;
+        if (S_ISDIR(mode))
+        {
+                (memfs_grow((void **)&memfs.dirs, &memfs.dir_cap, memfs.dir_count + 1, sizeof(MemDir))) orelse return MEMFS_NONE;
+                memfs.dirs[memfs.dir_count] = (MemDir){0};
+                n->dir = memfs.dir_count++;
+        }
+        memfs.node_count++;
+        if (id == 0)
+                return id;
+        (memfs_attach(id, parent)) orelse
+        {
+                n->alive = false;
+                return MEMFS_NONE;
+        };
+        return id;
+}
+
+/* Walks path from base, or from the root when it is absolute. */
+static uint32_t memfs_lookup(uint32_t base, const char *path)
+{
+        uint32_t id = path[0] == '/' ? 0 : base;
+        for (const char *p = path; *p;)
+        {
+                while (*p == '/')
+                        p++;
+                const char *end = strchr(p, '/');
+                int len = end ? (int)(end - p) : (int)strlen(p);
+                (len > 0) orelse break;
+                if (!memfs_is_dir(id))
+                {
+                        errno = ENOTDIR;
+                        return MEMFS_NONE;
+                }
+                if (len == 2 && p[0] == '.' && p[1] == '.')
+                        id = memfs.nodes[id].parent;
+                else if (!(len == 1 && p[0] == '.'))
+                        id = memfs_find(id, p, len);
+                if (id == MEMFS_NONE)
+                {
+                        errno = ENOENT;
+                        return MEMFS_NONE;
+                }
+                p += len;
+        }
+        return id;
+}
+
+/* The directory path would be created in, with name and len set to its last
+ * component. */
+static uint32_t memfs_lookup_parent(const char *path, const char **name, int *len)
+{
+        const char *slash = strrchr(path, '/');
+        *name = slash ? slash + 1 : path;
+        *len = (int)strlen(*name);
+        if (*len == 0 || !strcmp(*name, ".") || !strcmp(*name, ".."))
+        {
+                errno = EBUSY;
+                return MEMFS_NONE;
+        }
+        raw char dir[PATH_MAX];
+        size_t dir_len = slash ? (size_t)(slash - path) : 0;
+        (dir_len < PATH_MAX) orelse return MEMFS_NONE;
+        memcpy(dir, path, dir_len);
+        dir[dir_len] = '\0';
+        uint32_t id = memfs_lookup(0, slash == path ? "/" : dir);
+        if (id != MEMFS_NONE && !memfs_is_dir(id))
+        {
+                errno = ENOTDIR;
+                return MEMFS_NONE;
+        }
+        return id;
+}
+
+static uint32_t memfs_fd_node(int fd)
+{
+        int i = fd - MEMFS_FD_BASE;
+        if (i < 0 || i >= memfs.fd_cap || !memfs.fds[i].used)
+        {
+                errno = EBADF;
+                return MEMFS_NONE;
+        }
+        return memfs.fds[i].node;
+}
+
+static int memfs_fd_new(uint32_t id)
+{
+        int i = 0;
+        while (i < memfs.fd_cap && memfs.fds[i].used)
+                i++;
+        if (i == memfs.fd_cap)
+        {
+                int cap = memfs.fd_cap ? memfs.fd_cap * 2 : 64;
+                MemHandle *grown = realloc(memfs.fds, cap * sizeof(MemHandle)) orelse
+                {
+                        errno = EMFILE;
+                        return -1;
+                };
+                memset(grown + memfs.fd_cap, 0, (cap - memfs.fd_cap) * sizeof(MemHandle));
+                memfs.fds = grown;
+                memfs.fd_cap = cap;
+        }
+        memfs.fds[i] = (MemHandle){id, true, 0};
+        return MEMFS_FD_BASE + i;
+}
+
+static void memfs_fill_stat(uint32_t id, struct stat *st)
+{
+        const MemNode *n = &memfs.nodes[id];
+        memset(st, 0, sizeof(*st));
+        st->st_mode = n->mode;
+        st->st_nlink = 1;
+        st->st_ino = id + 1;
+        st->st_dev = 0x6d656d;
+        st->st_size = n->size;
+        st->st_blocks = (n->size + 511) / 512;
+        st->st_mtime = n->mtime_ns / 1000000000;
+        st->st_ctime = st->st_mtime;
+#ifdef __APPLE__
+        st->st_mtimespec.tv_nsec = n->mtime_ns % 1000000000;
+        st->st_ctimespec.tv_nsec = n->mtime_ns % 1000000000;
+#else
+        st->st_mtim.tv_nsec = n->mtime_ns % 1000000000;
+        st->st_ctim.tv_nsec = n->mtime_ns % 1000000000;
+#endif
+}
+
+/* Every call that looks something up goes through here: the injected delay
+ * and error first, then the lock. */
+static bool memfs_enter(void)
+{
+        if (memfs.delay_ms > 0)
+                usleep(memfs.delay_ms * 1000);
+        if (memfs.errors > 0 && atomic_fetch_add(&memfs.calls, 1) % memfs.errors == (unsigned)memfs.errors - 1)
+        {
+                errno = EIO;
+                return false;
+        }
+        pthread_mutex_lock(&memfs.lock);
+        return true;
+}
+
+static void memfs_leave(void)
+{
+        pthread_mutex_unlock(&memfs.lock);
+}
+
+static int memfs_open_dir(const char *path)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, path);
+        (id != MEMFS_NONE) orelse return -1;
+        if (!memfs_is_dir(id))
+        {
+                errno = ENOTDIR;
+                return -1;
+        }
+        return memfs_fd_new(id);
+}
+
+static int memfs_open_file(const char *path, int flags, mode_t mode)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, path);
+        if (id == MEMFS_NONE && (flags & O_CREAT) && errno == ENOENT)
+        {
+                const char *name;
+                int len;
+                uint32_t parent = memfs_lookup_parent(path, &name, &len);
+                (parent != MEMFS_NONE) orelse return -1;
+                id = memfs_add(parent, name, len, S_IFREG | (mode & 0777), 0, memfs_now_ns());
+                if (id == MEMFS_NONE)
+                {
+                        errno = ENOSPC;
+                        return -1;
+                }
+        }
+        else if (id == MEMFS_NONE)
+        {
+                return -1;
+        }
+        else if ((flags & O_CREAT) && (flags & O_EXCL))
+        {
+                errno = EEXIST;
+                return -1;
+        }
+        if (memfs_is_dir(id))
+        {
+                errno = EISDIR;
+                return -1;
+        }
+        if (flags & O_TRUNC)
+                memfs.nodes[id].size = 0;
+        return memfs_fd_new(id);
+}
+
+static int memfs_close(int fd)
+{
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        (memfs_fd_node(fd) != MEMFS_NONE) orelse return -1;
+        memfs.fds[fd - MEMFS_FD_BASE].used = false;
+        return 0;
+}
+
+static ssize_t memfs_read(int fd, void *buf, size_t n)
+{
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(fd);
+        (id != MEMFS_NONE) orelse return -1;
+        MemHandle *h = &memfs.fds[fd - MEMFS_FD_BASE];
+        off_t left = memfs.nodes[id].size - h->pos;
+        size_t k = left <= 0 ? 0 : ((size_t)left < n ? (size_t)left : n);
+        memset(buf, 0, k);
+        h->pos += k;
+        return (ssize_t)k;
+}
+
+static ssize_t memfs_write(int fd, const void *buf, size_t n)
+{
+        (void)buf;
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(fd);
+        (id != MEMFS_NONE) orelse return -1;
+        MemHandle *h = &memfs.fds[fd - MEMFS_FD_BASE];
+        h->pos += n;
+        MemNode *node = &memfs.nodes[id];
+        if (h->pos > node->size)
+                node->size = h->pos;
+        node->mtime_ns = memfs_now_ns();
+        return (ssize_t)n;
+}
+
+static int memfs_fstat(int fd, struct stat *st)
+{
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(fd);
+        (id != MEMFS_NONE) orelse return -1;
+        memfs_fill_stat(id, st);
+        return 0;
+}
+
+static int memfs_fstatat(int dfd, const char *name, struct stat *st, int flags)
+{
+        (void)flags;
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t base = name[0] == '/' ? 0 : memfs_fd_node(dfd);
+        (base != MEMFS_NONE) orelse return -1;
+        uint32_t id = memfs_lookup(base, name);
+        (id != MEMFS_NONE) orelse return -1;
+        memfs_fill_stat(id, st);
+        return 0;
+}
+
+static int memfs_stat(const char *path, struct stat *st)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, path);
+        (id != MEMFS_NONE) orelse return -1;
+        memfs_fill_stat(id, st);
+        return 0;
+}
+
+/* Entries come out last to first and ".." at the end, so removing the entry
+ * just returned, which moves the last one into its place, skips nothing. */
+static bool memfs_dir_begin(FsDirIter *it, int dfd)
+{
+        (memfs_enter()) orelse return false;
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(dfd);
+        (id != MEMFS_NONE) orelse return false;
+        it->fd = dfd;
+        it->vfs_pos = memfs.dirs[memfs.nodes[id].dir].count + 1;
+        return true;
+}
+
+static bool memfs_dir_next(FsDirIter *it, const char **name, unsigned char *type)
+{
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(it->fd);
+        (id != MEMFS_NONE && it->vfs_pos > 0) orelse return false;
+        const MemDir *d = &memfs.dirs[memfs.nodes[id].dir];
+        if (it->vfs_pos > d->count + 1)
+                it->vfs_pos = d->count + 1;
+        if (--it->vfs_pos == 0)
+        {
+                strcpy(it->vfs_name, "..");
+                *type = DT_DIR;
+        }
+        else
+        {
+                const MemNode *n = &memfs.nodes[d->kids[it->vfs_pos - 1]];
+                memcpy(it->vfs_name, memfs.names + n->name_off, n->name_len + 1);
+                *type = n->dir != MEMFS_NONE ? DT_DIR : DT_REG;
+        }
+        *name = it->vfs_name;
+        return true;
+}
+
+static void memfs_dir_end(FsDirIter *it)
+{
+        (void)it;
+}
+
+static int memfs_mkdir(const char *path, mode_t mode)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        const char *name;
+        int len;
+        uint32_t parent = memfs_lookup_parent(path, &name, &len);
+        (parent != MEMFS_NONE) orelse return -1;
+        if (memfs_find(parent, name, len) != MEMFS_NONE)
+        {
+                errno = EEXIST;
+                return -1;
+        }
+        if (memfs_add(parent, name, len, S_IFDIR | (mode & 0777), 4096, memfs_now_ns()) == MEMFS_NONE)
+        {
+                errno = ENOSPC;
+                return -1;
+        }
+        return 0;
+}
+
+static void memfs_drop(uint32_t id)
+{
+        MemNode *n = &memfs.nodes[id];
+        memfs_detach(id);
+        n->alive = false;
+        if (n->dir != MEMFS_NONE)
+        {
+                free(memfs.dirs[n->dir].kids);
+                memfs.dirs[n->dir] = (MemDir){0};
+        }
+}
+
+static int memfs_remove(const char *path, bool dir)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, path);
+        (id != MEMFS_NONE) orelse return -1;
+        int err = 0;
+        if (id == 0)
+                err = EBUSY;
+        else if (dir && !memfs_is_dir(id))
+                err = ENOTDIR;
+        else if (!dir && memfs_is_dir(id))
+                err = EISDIR;
+        else if (dir && memfs.dirs[memfs.nodes[id].dir].count > 0)
+                err = ENOTEMPTY;
+        if (err)
+        {
+                errno = err;
+                return -1;
+        }
+        memfs_drop(id);
+        return 0;
+}
+
+static int memfs_rmdir(const char *path)
+{
+        return memfs_remove(path, true);
+}
+
+static int memfs_unlink(const char *path)
+{
+        return memfs_remove(path, false);
+}
+
+static int memfs_rename(const char *src, const char *dst)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, src);
+        (id != MEMFS_NONE) orelse return -1;
+        const char *name;
+        int len;
+        uint32_t parent = memfs_lookup_parent(dst, &name, &len);
+        (parent != MEMFS_NONE) orelse return -1;
+
+        int err = id == 0 ? EBUSY : 0;
+        for (uint32_t p = parent; p != 0 && !err; p = memfs.nodes[p].parent)
+                if (p == id)
+                        err = EINVAL;
+        uint32_t old = memfs_find(parent, name, len);
+        if (old == id)
+                return 0;
+        if (!err && old != MEMFS_NONE)
+        {
+                if (memfs_is_dir(old) && !memfs_is_dir(id))
+                        err = EISDIR;
+                else if (!memfs_is_dir(old) && memfs_is_dir(id))
+                        err = ENOTDIR;
+                else if (memfs_is_dir(old) && memfs.dirs[memfs.nodes[old].dir].count > 0)
+                        err = ENOTEMPTY;
+        }
+        if (err)
+        {
+                errno = err;
+                return -1;
+        }
+
+        if (old != MEMFS_NONE)
+                memfs_drop(old);
+        memfs_detach(id);
+        bool ok = memfs_set_name(&memfs.nodes[id], name, len) && memfs_attach(id, parent);
+        if (!ok)
+        {
+                memfs.nodes[id].alive = false;
+                errno = ENOSPC;
+                return -1;
+        }
+        return 0;
+}
+
+static int memfs_chmod(const char *path, mode_t mode)
+{
+        (memfs_enter()) orelse return -1;
+        defer memfs_leave();
+        uint32_t id = memfs_lookup(0, path);
+        (id != MEMFS_NONE) orelse return -1;
+        MemNode *n = &memfs.nodes[id];
+        n->mode = (n->mode & S_IFMT) | (mode & 07777);
+        return 0;
+}
+
+static bool memfs_fd_path(int fd, char *out)
+{
+        pthread_mutex_lock(&memfs.lock);
+        defer memfs_leave();
+        uint32_t id = memfs_fd_node(fd);
+        (id != MEMFS_NONE) orelse return false;
+
+        /* Built back to front from the node up to the root. */
+        raw char buf[PATH_MAX];
+        size_t pos = PATH_MAX - 1;
+        buf[pos] = '\0';
+        for (; id != 0; id = memfs.nodes[id].parent)
+        {
+                const MemNode *n = &memfs.nodes[id];
+                (pos > (size_t)n->name_len + 1) orelse return false;
+                pos -= n->name_len;
+                memcpy(buf + pos, memfs.names + n->name_off, n->name_len);
+                buf[--pos] = '/';
+        }
+        if (pos == PATH_MAX - 1)
+                buf[--pos] = '/';
+        memcpy(out, buf + pos, PATH_MAX - pos);
+        return true;
+}
+
+static const FsVfs memfs_vfs = {
+    "mem",
+    memfs_open_dir,
+    memfs_open_file,
+    memfs_close,
+    memfs_read,
+    memfs_write,
+    memfs_fstat,
+    memfs_fstatat,
+    memfs_stat,
+    memfs_dir_begin,
+    memfs_dir_next,
+    memfs_dir_end,
+    memfs_mkdir,
+    memfs_rmdir,
+    memfs_unlink,
+    memfs_rename,
+    memfs_chmod,
+    memfs_fd_path,
+};
+
+static uint32_t memfs_mix(uint32_t x)
+{
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        return x ^ (x >> 16);
+}
+
+/* Sizes and times come from the node number, so every run builds the same
+ * tree. */
+static bool memfs_fill(uint32_t dir, int level)
+{
+        static const char *exts[] = {".c", ".h", ".txt", ".md", ".png", ".tar.gz", ""};
+        raw char name[64];
+        for (int i = 0; i < memfs.files; i++)
+        {
+                uint32_t r = memfs_mix(memfs.node_count);
+                int len = snprintf(name, sizeof(name), "file%07d%s", i, exts[r % 7]);
+                int64_t mtime = (MEMFS_EPOCH - (int64_t)(r % (365 * 86400))) * 1000000000;
+                (memfs_add(dir, name, len, S_IFREG | 0644, (off_t)(memfs_mix(r) % (1 << 24)), mtime) != MEMFS_NONE) orelse return false;
+        }
+        (level < memfs.depth) orelse return true;
+        for (int i = 0; i < memfs.dirs_per; i++)
+        {
+                int len = snprintf(name, sizeof(name), "dir%04d", i);
+                uint32_t sub = memfs_add(dir, name, len, S_IFDIR | 0755, 4096, MEMFS_EPOCH * 1000000000);
+                (sub != MEMFS_NONE && memfs_fill(sub, level + 1)) orelse return false;
+        }
+        return true;
+}
+
+/* Builds the tree spec asks for, NULL if spec is not a mem: spec or the
+ * tree does not fit in memory. */
+const FsVfs *memfs_create(const char *spec)
+{
+        (!strncmp(spec, "mem", 3) && (spec[3] == '\0' || spec[3] == ':')) orelse return NULL;
+        memfs.files = 1000;
+        memfs.dirs_per = 10;
+        memfs.depth = 2;
+        for (const char *p = spec[3] ? spec + 4 : spec + 3; *p;)
+        {
+                const char *eq = strchr(p, '=');
+                (eq) orelse return NULL;
+                int value = atoi(eq + 1);
+                int key_len = (int)(eq - p);
+                if (key_len == 5 && !strncmp(p, "files", 5))
+                        memfs.files = value;
+                else if (key_len == 4 && !strncmp(p, "dirs", 4))
+                        memfs.dirs_per = value;
+                else if (key_len == 5 && !strncmp(p, "depth", 5))
+                        memfs.depth = value;
+                else if (key_len == 5 && !strncmp(p, "delay", 5))
+                        memfs.delay_ms = value;
+                else if (key_len == 6 && !strncmp(p, "errors", 6))
+                        memfs.errors = value;
+                else
+                        return NULL;
+                const char *comma = strchr(eq, ',');
+                p = comma ? comma + 1 : eq + strlen(eq);
+        }
+        (memfs.files >= 0 && memfs.dirs_per >= 0 && memfs.depth >= 0) orelse return NULL;
+
+        (memfs_add(0, "/", 1, S_IFDIR | 0755, 4096, MEMFS_EPOCH * 1000000000) == 0) orelse return NULL;
+        (memfs_add(0, "tmp", 3, S_IFDIR | 01777, 4096, MEMFS_EPOCH * 1000000000) != MEMFS_NONE) orelse return NULL;
+        (memfs_fill(0, 0)) orelse return NULL;
+        return &memfs_vfs;
+}
@@ -14,6 +14,9 @@
 
 #ifdef __linux__
 #include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #endif
 
 #define KEY_UP 1000
@@ -64,7 +67,8 @@ typedef struct
 typedef enum
 {
         UI_MODE_GRID,
-        UI_MODE_LIST
+        UI_MODE_LIST,
+        UI_MODE_TREEMAP
 } UIListMode;
 
 typedef struct
@@ -200,6 +204,7 @@ UIHistory global_history;
 Mouse term_mouse;
 int term_width, term_height, term_anim_timeout = 16;
 float term_dt_scale = 1.0f;
+bool term_quit; /* SIGTERM, SIGINT or SIGHUP arrived, the app should exit */
 
 static struct termios orig_termios;
 static volatile int resize_flag = 1;
@@ -210,6 +215,9 @@ static bool mouse_suppressed = false;
 static Cell *canvas, *last_canvas;
 static int fd_m = -1, fd_touch = -1, raw_mx, raw_my, color_mode;
 static bool is_evdev;
+static int extra_fds[8], extra_fd_count;
+static int ep_fd = -1, sig_fd = -1, tick_fd = -1;
+static bool tick_on;
 static int touch_min_x, touch_max_x, touch_min_y, touch_max_y;
 static char out_buf[1024 * 1024];
 static UIContextState global_ctx;
@@ -361,6 +369,14 @@ static int rgb_to_ansi16(Color c, bool is_bg)
 
 void term_restore(void)
 {
+#ifdef __linux__
+        if (ep_fd >= 0)
+                close(ep_fd);
+        if (sig_fd >= 0)
+                close(sig_fd);
+        if (tick_fd >= 0)
+                close(tick_fd);
+#endif
         tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
         printf("\033]22;text\007"); /* Restore the default terminal text cursor */
         printf("\033%%@\033[0m\033[2J\033[H\033[?25h\033[?7h\033[?1006l\033[?1015l\033[?1003l");
@@ -467,19 +483,124 @@ int term_init(void)
         term_dt_scale = 60.0f / (target_fps < 24 ? 60 : target_fps);
 
         signal(SIGWINCH, on_resize);
+
+#ifdef __linux__
+        /* A single epoll set waits on the tty, the input devices, everything
+         * passed to term_watch_fd(), a timerfd that only ticks while something
+         * animates and a signalfd for resizes and termination. When idle
+         * nothing in it fires. Anything failing here leaves the poll() path. */
+        raw sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGWINCH);
+        sigaddset(&sigs, SIGTERM);
+        sigaddset(&sigs, SIGINT);
+        sigaddset(&sigs, SIGHUP);
+        ep_fd = epoll_create1(EPOLL_CLOEXEC);
+        tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        sigprocmask(SIG_BLOCK, &sigs, NULL);
+        sig_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+        int in_fds[] = {STDIN_FILENO, sig_fd, tick_fd, fd_m, fd_touch};
+        for (int i = 0; i < 5 && ep_fd >= 0; i++)
+        {
+                raw struct epoll_event ev = {.events = EPOLLIN, .data.fd = in_fds[i]};
+                if (in_fds[i] >= 0 && epoll_ctl(ep_fd, EPOLL_CTL_ADD, in_fds[i], &ev) == 0)
+                        continue;
+                if (i < 3)
+                {
+                        close(ep_fd);
+                        ep_fd = -1;
+                }
+        }
+        if (ep_fd < 0)
+        {
+                sigprocmask(SIG_UNBLOCK, &sigs, NULL);
+                if (sig_fd >= 0)
+                        close(sig_fd);
+                if (tick_fd >= 0)
+                        close(tick_fd);
+                sig_fd = tick_fd = -1;
+        }
+#endif
         return 1;
 }
 
-int term_poll(int timeout_ms)
+/* Lets term_poll return early when fd becomes readable, used for wakeups from
+ * background work. The caller drains the fd itself. */
+void term_watch_fd(int fd)
+{
+        if (fd >= 0 && extra_fd_count < (int)(sizeof(extra_fds) / sizeof(extra_fds[0])))
+                extra_fds[extra_fd_count++] = fd;
+#ifdef __linux__
+        raw struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        if (fd >= 0 && ep_fd >= 0)
+                epoll_ctl(ep_fd, EPOLL_CTL_ADD, fd, &ev);
+#endif
+}
+
+/* Animation frames are paced by term_anim_timeout while on is set, otherwise
+ * term_poll only wakes up for input, watched fds or its timeout. */
+void term_set_animating(bool on)
 {
-        raw struct pollfd fds[3];
+        (on != tick_on) orelse return;
+        tick_on = on;
+#ifdef __linux__
+        if (tick_fd >= 0)
+        {
+                long ns = on ? term_anim_timeout * 1000000L : 0;
+                raw struct itimerspec its = {{ns / 1000000000L, ns % 1000000000L}, {ns / 1000000000L, ns % 1000000000L}};
+                timerfd_settime(tick_fd, 0, &its, NULL);
+        }
+#endif
+}
+
+static void term_wait(int timeout_ms)
+{
+#ifdef __linux__
+        if (ep_fd >= 0)
+        {
+                raw struct epoll_event evs[16];
+                int n = epoll_wait(ep_fd, evs, 16, timeout_ms);
+                for (int i = 0; i < n; i++)
+                {
+                        if (evs[i].data.fd == tick_fd)
+                        {
+                                raw uint64_t ticks;
+                                read(tick_fd, &ticks, sizeof(ticks));
+                        }
+                        if (evs[i].data.fd != sig_fd)
+                                continue;
+                        raw struct signalfd_siginfo si;
+                        while (read(sig_fd, &si, sizeof(si)) == sizeof(si))
+                        {
+                                if (si.ssi_signo == SIGWINCH)
+                                        resize_flag = 1;
+                                else
+                                        term_quit = true;
+                        }
+                }
+                return;
+        }
+#endif
+        if (tick_on && (timeout_ms < 0 || timeout_ms > term_anim_timeout))
+                timeout_ms = term_anim_timeout;
+
+        raw struct pollfd fds[3 + sizeof(extra_fds) / sizeof(extra_fds[0])];
         int nfds = 0;
         fds[nfds++] = (struct pollfd){STDIN_FILENO, POLLIN, 0};
         if (fd_m >= 0)
                 fds[nfds++] = (struct pollfd){fd_m, POLLIN, 0};
         if (fd_touch >= 0)
                 fds[nfds++] = (struct pollfd){fd_touch, POLLIN, 0};
+        for (int i = 0; i < extra_fd_count; i++)
+                fds[nfds++] = (struct pollfd){extra_fds[i], POLLIN, 0};
         poll(fds, nfds, timeout_ms);
+}
+
+/* Waits up to timeout_ms (-1 for no limit) for something to happen and
+ * returns the key pressed, if any. */
+int term_poll(int timeout_ms)
+{
+        term_wait(timeout_ms);
 
         if (resize_flag)
         {
@@ -1650,6 +1771,46 @@ void ui_list_reset(UIListState *s)
         ui_list_clear_selections(s);
 }
 
+void ui_list_reserve(UIListState *s, int count)
+{
+        if (count <= s->selections_cap)
+                return;
+        s->selections = realloc(s->selections, count * sizeof(bool)) orelse { exit(1); };
+        s->active_box_selections = realloc(s->active_box_selections, count * sizeof(bool)) orelse { exit(1); };
+        memset(s->selections + s->selections_cap, 0, (count - s->selections_cap) * sizeof(bool));
+        memset(s->active_box_selections + s->selections_cap, 0, (count - s->selections_cap) * sizeof(bool));
+        s->selections_cap = count;
+}
+
+/* Item range [*first, *end) that ui_list_do_item can report as on screen or
+ * inside the current selection box. Only valid after ui_list_begin. */
+void ui_list_visible_range(const UIListState *s, int *first, int *end)
+{
+        int cols = ui_list_cols(s);
+        int c_h = (s->mode == UI_MODE_LIST) ? 1 : s->p.cell_h;
+        int top = (int)(s->current_scroll + 0.5f);
+        if (top < 0)
+                top = 0;
+        int row_first = top / c_h;
+        int row_end = (top + s->p.h + c_h - 1) / c_h;
+
+        if (s->is_box_selecting)
+        {
+                float mouse_world = ui_get_mouse().y + s->current_scroll;
+                float lo = (s->box_start_y_world < mouse_world ? s->box_start_y_world : mouse_world) - s->p.y;
+                float hi = (s->box_start_y_world < mouse_world ? mouse_world : s->box_start_y_world) - s->p.y;
+                int box_first = (int)(lo / c_h) - 1;
+                int box_end = (int)(hi / c_h) + 2;
+                if (box_first < row_first)
+                        row_first = box_first < 0 ? 0 : box_first;
+                if (box_end > row_end)
+                        row_end = box_end;
+        }
+
+        *first = row_first * cols > s->p.item_count ? s->p.item_count : row_first * cols;
+        *end = row_end * cols > s->p.item_count ? s->p.item_count : row_end * cols;
+}
+
 void ui_list_set_mode(UIListState *s, const UIListParams *p, UIListMode mode)
 {
         if (s->mode == mode)
@@ -1687,14 +1848,7 @@ void ui_list_begin(UIListState *s, const UIListParams *p, int key)
         if ((key >= KEY_UP && key <= KEY_SHIFT_PAGE_DOWN) || key == '\t' || key == ' ' || key == KEY_ENTER || key == KEY_BACKSPACE)
                 s->ignore_mouse = true;
 
-        if (p->item_count > s->selections_cap)
-        {
-                s->selections = realloc(s->selections, p->item_count * sizeof(bool)) orelse { exit(1); };
-                s->active_box_selections = realloc(s->active_box_selections, p->item_count * sizeof(bool)) orelse { exit(1); };
-                memset(s->selections + s->selections_cap, 0, (p->item_count - s->selections_cap) * sizeof(bool));
-                memset(s->active_box_selections + s->selections_cap, 0, (p->item_count - s->selections_cap) * sizeof(bool));
-                s->selections_cap = p->item_count;
-        }
+        ui_list_reserve(s, p->item_count);
 
         if (s->selections_cap > 0)
                 memset(s->active_box_selections, 0, s->selections_cap * sizeof(bool));